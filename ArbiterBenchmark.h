@@ -0,0 +1,354 @@
+#ifndef ARBITER_BENCHMARK_H
+#define ARBITER_BENCHMARK_H
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "PerfUtils/Cycles.h"
+#include "PerfUtils/Stats.h"
+
+/**
+ * Helpers for the benchmarks that fork several CoreArbiter client processes.
+ * Whatever the clients report back to the parent lives in shared memory that
+ * is mapped before forking, so the clients record results with plain stores
+ * and the parent reads them once the clients have finished.
+ */
+
+// The socket of the CoreArbiter server, unless a benchmark is told otherwise.
+const char* const DEFAULT_ARBITER_SOCKET = "/tmp/CoreArbiter/testsocket";
+
+// The number of priority levels in a request to setRequestedCores.
+const size_t NUM_PRIORITIES = 8;
+
+/**
+ * What the parent and the clients of a run share to start and stop the
+ * clients together. Each benchmark's shared state derives from this.
+ */
+struct ClientControl {
+    // The number of clients that have connected and started their threads.
+    std::atomic<uint64_t> numReady;
+
+    // Set by the parent once every client is ready, and when the run is over.
+    std::atomic<bool> start;
+    std::atomic<bool> stop;
+};
+
+/**
+ * Map count zeroed objects of type T into memory that is shared with the
+ * processes forked after this.
+ */
+template <typename T>
+T*
+mapShared(size_t count) {
+    void* memory = mmap(NULL, std::max<size_t>(count, 1) * sizeof(T),
+                        PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS,
+                        -1, 0);
+    if (memory == MAP_FAILED) {
+        fprintf(stderr, "Error mapping shared memory: %s\n", strerror(errno));
+        exit(1);
+    }
+    return static_cast<T*>(memory);
+}
+
+template <typename T>
+void
+unmapShared(T* memory, size_t count) {
+    munmap(memory, std::max<size_t>(count, 1) * sizeof(T));
+}
+
+/**
+ * Return a request to setRequestedCores for count cores at the given
+ * priority, where 0 is the highest, and none at the others.
+ */
+inline std::vector<uint32_t>
+coresAtPriority(uint32_t priority, uint32_t count) {
+    std::vector<uint32_t> request(NUM_PRIORITIES, 0);
+    request[priority] = count;
+    return request;
+}
+
+/**
+ * Pin the calling thread to one CPU. Threads that time the arbiter from
+ * outside the cores it manages should be pinned to one it does not manage,
+ * so that the kernel cannot move them mid-measurement.
+ */
+inline void
+pinThread(int cpu) {
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    int error = pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+    if (error != 0) {
+        fprintf(stderr, "Error pinning a thread to CPU %d: %s\n", cpu,
+                strerror(error));
+        exit(1);
+    }
+}
+
+/**
+ * Parse a list of numbers separated by spaces or commas.
+ *
+ * \return
+ *      False if the list is empty or has anything else in it.
+ */
+inline bool
+parseList(const char* list, std::vector<uint64_t>* values) {
+    values->clear();
+    while (*list != '\0') {
+        char* end;
+        uint64_t value = strtoul(list, &end, 0);
+        if (end == list)
+            return false;
+        values->push_back(value);
+        list = end + strspn(end, " ,");
+    }
+    return !values->empty();
+}
+
+/**
+ * Take one from a count of the cores still to be granted or released since a
+ * change of demand, if it is positive.
+ *
+ * \return
+ *      False if nothing was pending, so the grant or release has no change
+ *      to be timed from.
+ */
+inline bool
+takePending(std::atomic<int64_t>* pending) {
+    int64_t count = pending->load();
+    while (count > 0) {
+        if (pending->compare_exchange_weak(count, count - 1))
+            return true;
+    }
+    return false;
+}
+
+/**
+ * Sleep until the given time, in cycles, unless it has passed.
+ */
+inline void
+sleepUntil(uint64_t time) {
+    uint64_t now = PerfUtils::Cycles::rdtsc();
+    if (time <= now)
+        return;
+    uint64_t ns = PerfUtils::Cycles::toNanoseconds(time - now);
+    struct timespec delay = {static_cast<time_t>(ns / 1000000000),
+                             static_cast<long>(ns % 1000000000)};
+    nanosleep(&delay, NULL);
+}
+
+/**
+ * The body of each of a client's threads that take cores: wait for a core,
+ * hold it until the arbiter wants it back, and repeat. The thread's holder
+ * is told of each step, by
+ *
+ *     void granted(uint64_t blockTime, uint64_t grantTime)
+ *         once a core is granted, with the times at which the thread called
+ *         blockUntilCoreAvailable and returned from it, and
+ *     void released(uint64_t releaseTime)
+ *         once mustReleaseCore has returned true, with the time it did.
+ */
+template <typename Holder>
+void
+holdCores(CoreArbiter::CoreArbiterClient* client, Holder holder) {
+    for (;;) {
+        uint64_t blockTime = PerfUtils::Cycles::rdtsc();
+        client->blockUntilCoreAvailable();
+        holder.granted(blockTime, PerfUtils::Cycles::rdtsc());
+
+        while (!client->mustReleaseCore()) {
+        }
+        holder.released(PerfUtils::Cycles::rdtsc());
+    }
+}
+
+/**
+ * Start numThreads threads in a client process that take cores from the
+ * arbiter (see holdCores); thread t has a holder constructed as Holder(t).
+ * Then tell the parent that the client is ready, and return once it starts
+ * the run.
+ */
+template <typename Holder>
+void
+startHolders(ClientControl* control, CoreArbiter::CoreArbiterClient* client,
+             size_t numThreads) {
+    for (size_t t = 0; t < numThreads; t++)
+        std::thread(holdCores<Holder>, client, Holder(t)).detach();
+    control->numReady++;
+    while (!control->start) {
+    }
+}
+
+/**
+ * Make a client's demand for cores step through demands, starting at step
+ * firstStep and moving on every periodNs nanoseconds, until the run is over.
+ * Each step calls changeDemand with the new demand.
+ */
+template <typename ChangeDemand>
+void
+followDemands(ClientControl* control, const std::vector<uint64_t>& demands,
+              size_t firstStep, uint64_t periodNs, ChangeDemand changeDemand) {
+    uint64_t period = PerfUtils::Cycles::fromNanoseconds(periodNs);
+    uint64_t nextChange = PerfUtils::Cycles::rdtsc();
+    for (size_t step = firstStep; !control->stop; step++) {
+        changeDemand(static_cast<uint32_t>(demands[step % demands.size()]));
+        nextChange += period;
+        sleepUntil(nextChange);
+    }
+}
+
+/**
+ * End a client process. Its threads are still blocked in or holding cores
+ * from the arbiter; exiting is how they give them up.
+ */
+inline void
+exitClient() {
+    _exit(0);
+}
+
+/**
+ * Fork numClients client processes, the one with index c running
+ * runClient(c), which must not return. If a fork fails, the clients already
+ * forked are killed and the benchmark exits.
+ *
+ * \return
+ *      The clients' process ids, in order of index.
+ */
+template <typename RunClient>
+std::vector<pid_t>
+forkClients(size_t numClients, RunClient runClient) {
+    std::vector<pid_t> pids;
+    for (size_t c = 0; c < numClients; c++) {
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Error forking client %zu: %s\n", c,
+                    strerror(errno));
+            for (size_t p = 0; p < pids.size(); p++)
+                kill(pids[p], SIGKILL);
+            exit(1);
+        }
+        if (pid == 0) {
+            runClient(c);
+            exitClient();
+        }
+        pids.push_back(pid);
+    }
+    return pids;
+}
+
+/**
+ * Wait for every client to be ready, then start the run.
+ */
+inline void
+startClients(ClientControl* control, size_t numClients) {
+    while (control->numReady < numClients)
+        usleep(100);
+    control->start = true;
+}
+
+/**
+ * End the run, and wait for every client to exit.
+ */
+inline void
+stopClients(ClientControl* control, const std::vector<pid_t>& pids) {
+    control->stop = true;
+    for (size_t p = 0; p < pids.size(); p++)
+        waitpid(pids[p], NULL, 0);
+}
+
+/**
+ * A SampleBuffer holds up to a fixed number of samples, which any thread of
+ * any process that shares it may record. Its memory is mapped before the run,
+ * so recording a sample is a single store; samples beyond its capacity are
+ * counted but dropped.
+ */
+class SampleBuffer {
+  public:
+    explicit SampleBuffer(size_t capacity)
+        : samples(mapShared<uint64_t>(capacity)),
+          capacity(capacity),
+          count(mapShared<std::atomic<uint64_t>>(1)) {}
+
+    ~SampleBuffer() {
+        unmapShared(samples, capacity);
+        unmapShared(count, 1);
+    }
+
+    void record(uint64_t sample) {
+        uint64_t index = count->fetch_add(1, std::memory_order_relaxed);
+        if (index < capacity)
+            samples[index] = sample;
+    }
+
+    /**
+     * Forget every sample, so that the buffer can be reused for another run.
+     */
+    void clear() { *count = 0; }
+
+    uint64_t* data() { return samples; }
+    size_t size() const { return std::min<size_t>(*count, capacity); }
+    uint64_t getNumDropped() const {
+        return *count > capacity ? *count - capacity : 0;
+    }
+
+  private:
+    uint64_t* samples;
+    size_t capacity;
+    std::atomic<uint64_t>* count;
+
+    SampleBuffer(const SampleBuffer&) = delete;
+    SampleBuffer& operator=(const SampleBuffer&) = delete;
+};
+
+/**
+ * Print the median, 90%, 99% and maximum of count samples in cycles, in
+ * nanoseconds, each preceded by a comma; NA if there are none.
+ */
+inline void
+printPercentiles(uint64_t* samples, size_t count) {
+    if (count == 0) {
+        printf(",NA,NA,NA,NA");
+        return;
+    }
+    Statistics stats = computeStatistics(samples, count);
+    printf(",%lu,%lu,%lu,%lu", PerfUtils::Cycles::toNanoseconds(stats.median),
+           PerfUtils::Cycles::toNanoseconds(stats.P90),
+           PerfUtils::Cycles::toNanoseconds(stats.P99),
+           PerfUtils::Cycles::toNanoseconds(stats.max));
+}
+
+/**
+ * Print the distribution of count samples in cycles as a CDF, with a row for
+ * each latency in nanoseconds and the fraction of samples at or below it.
+ * There is a row for every thousandth of the samples, and for every sample
+ * in the slowest thousandth, where the tail is. This sorts the samples.
+ */
+inline void
+printCdf(uint64_t* samples, size_t count) {
+    std::sort(samples, samples + count);
+    size_t step = std::max<size_t>(count / 1000, 1);
+    size_t tail = count - count / 1000;
+    printf("Latency (ns),Fraction\n");
+    for (size_t i = 0; i < count; i++) {
+        if (i + 1 < count && i < tail && (i + 1) % step != 0)
+            continue;
+        printf("%lu,%.6lf\n", PerfUtils::Cycles::toNanoseconds(samples[i]),
+               static_cast<double>(i + 1) / static_cast<double>(count));
+    }
+}
+
+#endif  // ARBITER_BENCHMARK_H
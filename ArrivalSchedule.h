@@ -0,0 +1,243 @@
+#ifndef ARRIVAL_SCHEDULE_H
+#define ARRIVAL_SCHEDULE_H
+
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "PerfUtils/Cycles.h"
+#include "ServiceTime.h"
+
+/**
+ * An ArrivalSchedule supplies the inter-arrival gaps, already converted to
+ * cycles, for each interval of a benchmark. The gaps are drawn from a
+ * generator with an explicit seed by a refill thread of the schedule's own,
+ * which stays at most one interval ahead of the dispatch loop, so a dispatch
+ * loop driven by a schedule only compares timestamps and creates threads,
+ * memory holds the arrivals of no more than two intervals, and two runs with
+ * the same seed see exactly the same arrivals. A schedule can also carry a
+ * service time for each arrival, drawn from the same stream.
+ */
+class ArrivalSchedule {
+  public:
+    enum Distribution { POISSON, UNIFORM };
+
+    ArrivalSchedule(uint32_t seed, Distribution distribution)
+        : distribution(distribution),
+          gen(seed),
+          mutex(),
+          refillNeeded(),
+          specs(),
+          numFinished(0),
+          stopping(false),
+          numReady(0),
+          batches(),
+          current(NULL),
+          cursor(0),
+          refiller() {
+        refiller = std::thread(&ArrivalSchedule::refill, this);
+    }
+
+    ~ArrivalSchedule() {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            stopping = true;
+        }
+        refillNeeded.notify_one();
+        refiller.join();
+    }
+
+    /**
+     * Describe the next interval: its arrivals come at creationsPerSecond
+     * until they cover timeToRun nanoseconds. Intervals must be added in the
+     * order they will run, and each before the dispatch loop starts the one
+     * ahead of it. If serviceTime is given, a service time is drawn from it
+     * for every arrival; it must be given for all intervals or none.
+     */
+    void addInterval(double creationsPerSecond, uint64_t timeToRun,
+                     const ServiceTime* serviceTime = NULL) {
+        IntervalSpec spec;
+        spec.creationsPerSecond = creationsPerSecond;
+        spec.timeToRun = timeToRun;
+        spec.hasServiceTime = serviceTime != NULL;
+        if (serviceTime)
+            spec.serviceTime = *serviceTime;
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            specs.push_back(spec);
+        }
+        refillNeeded.notify_one();
+    }
+
+    /**
+     * Position the schedule at the first arrival of the given interval, which
+     * must follow the one started last, and let the refill thread reuse the
+     * arrivals of the interval before that. Waits, which it should only do
+     * for very short intervals, if the interval's arrivals are not yet drawn.
+     */
+    void startInterval(size_t interval) {
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            numFinished = interval;
+        }
+        refillNeeded.notify_one();
+        while (numReady.load(std::memory_order_acquire) <= interval)
+            ;
+        current = &batches[interval % NUM_BATCHES];
+        cursor = 0;
+    }
+
+    /**
+     * Fetch the gap in cycles before the next arrival of the current interval.
+     * Returns false once the interval's arrivals are used up.
+     */
+    bool nextGap(uint64_t* gap) {
+        if (cursor == current->gaps.size())
+            return false;
+        *gap = current->gaps[cursor++];
+        return true;
+    }
+
+    /**
+     * Return the service time in cycles of the arrival most recently returned
+     * by nextGap. Only valid if the intervals were added with service times.
+     */
+    uint64_t serviceTime() const { return current->serviceTimes[cursor - 1]; }
+
+  private:
+    /**
+     * What addInterval was told about an interval whose arrivals are not yet
+     * drawn.
+     */
+    struct IntervalSpec {
+        double creationsPerSecond;
+        uint64_t timeToRun;
+        bool hasServiceTime;
+        ServiceTime serviceTime;
+    };
+
+    /**
+     * The arrivals of one interval.
+     */
+    struct Batch {
+        std::vector<uint64_t> gaps;
+
+        // Service times in cycles, parallel to gaps, if requested.
+        std::vector<uint64_t> serviceTimes;
+    };
+
+    // The arrivals of the interval being dispatched and of the one after it.
+    static const size_t NUM_BATCHES = 2;
+
+    /**
+     * The body of the refill thread: draw the arrivals of each interval, in
+     * order, as soon as it has been added and the batch it will go in is no
+     * longer in use.
+     */
+    void refill() {
+        ServiceTimeGenerator serviceTime;
+        for (size_t interval = 0;; interval++) {
+            IntervalSpec spec;
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                refillNeeded.wait(lock, [&] {
+                    return stopping ||
+                           (!specs.empty() &&
+                            interval < numFinished + NUM_BATCHES);
+                });
+                if (stopping)
+                    return;
+                spec = specs.front();
+                specs.pop_front();
+            }
+
+            std::exponential_distribution<double> exponential(
+                spec.creationsPerSecond);
+            std::uniform_real_distribution<double> uniform(
+                0, 2.0 / spec.creationsPerSecond);
+            if (spec.hasServiceTime)
+                serviceTime.setDistribution(spec.serviceTime);
+
+            // Stop once the gaps alone span the interval; the dispatch loop
+            // can only fall behind the schedule, never ahead of it. Clearing
+            // the batch keeps its capacity, so after the first few intervals
+            // this allocates nothing.
+            Batch& batch = batches[interval % NUM_BATCHES];
+            batch.gaps.clear();
+            batch.serviceTimes.clear();
+            uint64_t cyclesToCover =
+                PerfUtils::Cycles::fromNanoseconds(spec.timeToRun);
+            uint64_t covered = 0;
+            while (covered <= cyclesToCover) {
+                double gap = distribution == POISSON ? exponential(gen)
+                                                     : uniform(gen);
+                batch.gaps.push_back(PerfUtils::Cycles::fromSeconds(gap));
+                covered += batch.gaps.back();
+                if (spec.hasServiceTime)
+                    batch.serviceTimes.push_back(serviceTime(gen));
+            }
+            numReady.store(interval + 1, std::memory_order_release);
+        }
+    }
+
+    Distribution distribution;
+    std::mt19937 gen;
+
+    // Protects specs, numFinished and stopping, which the refill thread
+    // waits on with refillNeeded.
+    std::mutex mutex;
+    std::condition_variable refillNeeded;
+
+    // Intervals added but not yet drawn, in order.
+    std::deque<IntervalSpec> specs;
+
+    // The number of intervals that the dispatch loop is done with, whose
+    // batches may be refilled.
+    size_t numFinished;
+
+    // Set by the destructor to stop the refill thread.
+    bool stopping;
+
+    // The number of intervals whose arrivals have been drawn.
+    std::atomic<size_t> numReady;
+
+    // Interval i's arrivals are in batches[i % NUM_BATCHES].
+    Batch batches[NUM_BATCHES];
+
+    // The batch of the current interval, and the next gap in it to hand out.
+    Batch* current;
+    size_t cursor;
+
+    std::thread refiller;
+
+    ArrivalSchedule(const ArrivalSchedule&) = delete;
+    ArrivalSchedule& operator=(const ArrivalSchedule&) = delete;
+};
+
+// What nextArrival returns once the current interval's scheduled arrivals are
+// used up; the dispatch loop then waits for the next interval.
+const uint64_t NO_MORE_ARRIVALS = ~0UL;
+
+/**
+ * Return the time in cycles of the arrival after one at previousArrival:
+ * from schedule if it is not NULL, and otherwise by drawing a gap in seconds
+ * from distribution with gen.
+ */
+template <typename Generator, typename Distribution>
+uint64_t
+nextArrival(ArrivalSchedule* schedule, uint64_t previousArrival,
+            Generator& gen, Distribution& distribution) {
+    if (schedule) {
+        uint64_t gap;
+        if (!schedule->nextGap(&gap))
+            return NO_MORE_ARRIVALS;
+        return previousArrival + gap;
+    }
+    return previousArrival + PerfUtils::Cycles::fromSeconds(distribution(gen));
+}
+
+#endif  // ARRIVAL_SCHEDULE_H
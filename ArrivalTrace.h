@@ -0,0 +1,142 @@
+#ifndef ARRIVAL_TRACE_H
+#define ARRIVAL_TRACE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+
+/**
+ * One arrival in a binary trace file. A trace file is a packed array of these
+ * records in host byte order, sorted by arrivalOffset.
+ */
+struct TraceRecord {
+    // Nanoseconds from the start of the trace to this arrival.
+    uint64_t arrivalOffset;
+
+    // Service time of this request in nanoseconds.
+    uint32_t serviceTime;
+
+    // Unused by the replayer, which reports all requests together; it pads
+    // the record to 16 bytes, and tools that write traces may keep a request
+    // class here.
+    uint32_t reserved;
+};
+static_assert(sizeof(TraceRecord) == 16, "TraceRecord must be packed");
+
+/**
+ * An ArrivalTrace streams the records of a trace file through a read-only
+ * memory mapping, so traces much larger than memory can be replayed. Pages
+ * are prefetched a window ahead of the cursor and dropped a window behind it,
+ * which keeps the resident footprint at a few windows regardless of the
+ * length of the trace.
+ */
+class ArrivalTrace {
+  public:
+    explicit ArrivalTrace(const char* path)
+        : records(NULL), numRecords(0), mappedBytes(0), cursor(0),
+          windowEnd(0) {
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "Error opening trace file %s: %s\n", path,
+                    strerror(errno));
+            exit(1);
+        }
+        struct stat fileStat;
+        if (fstat(fd, &fileStat) != 0) {
+            fprintf(stderr, "Error reading size of trace file %s: %s\n",
+                    path, strerror(errno));
+            exit(1);
+        }
+        mappedBytes = static_cast<size_t>(fileStat.st_size);
+        if (mappedBytes == 0 || mappedBytes % sizeof(TraceRecord) != 0) {
+            fprintf(stderr,
+                    "Trace file %s is not a whole number of %zu-byte "
+                    "records\n",
+                    path, sizeof(TraceRecord));
+            exit(1);
+        }
+        numRecords = mappedBytes / sizeof(TraceRecord);
+
+        void* mapping = mmap(NULL, mappedBytes, PROT_READ, MAP_SHARED, fd, 0);
+        if (mapping == MAP_FAILED) {
+            fprintf(stderr, "Error mapping trace file %s: %s\n", path,
+                    strerror(errno));
+            exit(1);
+        }
+        close(fd);
+        records = static_cast<const TraceRecord*>(mapping);
+        madvise(mapping, mappedBytes, MADV_SEQUENTIAL);
+        advanceWindow();
+    }
+
+    ~ArrivalTrace() {
+        munmap(const_cast<TraceRecord*>(records), mappedBytes);
+    }
+
+    /**
+     * Return the nanoseconds from the start of the trace to its last arrival.
+     */
+    uint64_t duration() const {
+        return records[numRecords - 1].arrivalOffset;
+    }
+
+    /**
+     * Return the next record of the trace, or NULL once all records have been
+     * returned.
+     */
+    const TraceRecord* next() {
+        if (cursor == numRecords)
+            return NULL;
+        if (cursor == windowEnd)
+            advanceWindow();
+        return &records[cursor++];
+    }
+
+  private:
+    // Number of records in each prefetch window; 1 MB worth.
+    static const size_t WINDOW_RECORDS = (1 << 20) / sizeof(TraceRecord);
+
+    /**
+     * Ask the kernel to read in the window starting at the cursor and to drop
+     * the window before the previous one, which has already been replayed.
+     */
+    void advanceWindow() {
+        size_t end = std::min(cursor + WINDOW_RECORDS, numRecords);
+        madvise(pageAlign(&records[cursor]),
+                (end - cursor) * sizeof(TraceRecord), MADV_WILLNEED);
+        if (cursor >= 2 * WINDOW_RECORDS) {
+            madvise(pageAlign(&records[cursor - 2 * WINDOW_RECORDS]),
+                    WINDOW_RECORDS * sizeof(TraceRecord), MADV_DONTNEED);
+        }
+        windowEnd = end;
+    }
+
+    /**
+     * Round a pointer into the mapping down to the start of its page, as
+     * madvise requires.
+     */
+    static void* pageAlign(const TraceRecord* record) {
+        uintptr_t pageMask = ~static_cast<uintptr_t>(getpagesize() - 1);
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(record) &
+                                       pageMask);
+    }
+
+    const TraceRecord* records;
+    size_t numRecords;
+    size_t mappedBytes;
+
+    // Index of the next record to return.
+    size_t cursor;
+
+    // Index one past the last record that has been prefetched.
+    size_t windowEnd;
+};
+
+#endif  // ARRIVAL_TRACE_H
@@ -0,0 +1,40 @@
+#ifndef BENCHMARK_OPTIONS_H
+#define BENCHMARK_OPTIONS_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Look for the long option `--name` in argv and remove it, along with its
+ * argument if it takes one, so that the remaining positional arguments keep
+ * their usual meaning. This is meant for benchmarks whose arguments are
+ * otherwise positional.
+ *
+ * \return
+ *      The option's argument, or the option itself if it takes no argument.
+ *      NULL if the option was not given.
+ */
+inline const char*
+extractOption(int* argcp, const char** argv, const char* name,
+              bool takesArgument) {
+    int argc = *argcp;
+    for (int i = 1; i < argc; i++) {
+        if (argv[i][0] != '-' || argv[i][1] != '-' ||
+            strcmp(argv[i] + 2, name) != 0)
+            continue;
+        int consumed = takesArgument ? 2 : 1;
+        if (i + consumed > argc) {
+            fprintf(stderr, "Missing argument to option %s!\n", name);
+            exit(1);
+        }
+        const char* value = argv[i + consumed - 1];
+        argc -= consumed;
+        memmove(argv + i, argv + i + consumed, (argc - i) * sizeof(char*));
+        *argcp = argc;
+        return value;
+    }
+    return NULL;
+}
+
+#endif  // BENCHMARK_OPTIONS_H
@@ -0,0 +1,106 @@
+#ifndef BOUNDED_QUEUE_H
+#define BOUNDED_QUEUE_H
+
+#include <stddef.h>
+#include <vector>
+#include "Arachne/Arachne.h"
+
+/**
+ * A BoundedQueue is a FIFO of at most a fixed number of items, shared by
+ * Arachne threads. A thread that pushes to a full queue or pops from an empty
+ * one blocks on a Semaphore, so it takes no core while it waits, and the
+ * items are guarded by a SpinLock that is only held to copy one in or out.
+ */
+template <typename T>
+class BoundedQueue {
+  public:
+    explicit BoundedQueue(size_t capacity)
+        : items(capacity),
+          head(0),
+          size(0),
+          lock("BoundedQueue"),
+          freeSlots(),
+          usedSlots() {
+        for (size_t i = 0; i < capacity; i++)
+            freeSlots.notify();
+    }
+
+    /**
+     * Add an item to the back of the queue, waiting for room if it is full.
+     */
+    void push(const T& item) {
+        freeSlots.wait();
+        insert(item);
+    }
+
+    /**
+     * Add an item to the back of the queue if it has room.
+     *
+     * \return
+     *      False if the queue was full.
+     */
+    bool tryPush(const T& item) {
+        if (!freeSlots.try_wait())
+            return false;
+        insert(item);
+        return true;
+    }
+
+    /**
+     * Remove the item at the front of the queue, waiting for one if it is
+     * empty.
+     */
+    T pop() {
+        usedSlots.wait();
+        return remove();
+    }
+
+    /**
+     * Remove the item at the front of the queue into item, if there is one.
+     *
+     * \return
+     *      False if the queue was empty.
+     */
+    bool tryPop(T* item) {
+        if (!usedSlots.try_wait())
+            return false;
+        *item = remove();
+        return true;
+    }
+
+  private:
+    void insert(const T& item) {
+        lock.lock();
+        items[(head + size) % items.size()] = item;
+        size++;
+        lock.unlock();
+        usedSlots.notify();
+    }
+
+    T remove() {
+        lock.lock();
+        T item = items[head];
+        head = (head + 1) % items.size();
+        size--;
+        lock.unlock();
+        freeSlots.notify();
+        return item;
+    }
+
+    // A ring of items, of which size starting at head are in the queue;
+    // guarded by lock.
+    std::vector<T> items;
+    size_t head;
+    size_t size;
+    Arachne::SpinLock lock;
+
+    // Counts of the slots that are free for pushes and that hold items for
+    // pops, respectively.
+    Arachne::Semaphore freeSlots;
+    Arachne::Semaphore usedSlots;
+
+    BoundedQueue(const BoundedQueue&) = delete;
+    BoundedQueue& operator=(const BoundedQueue&) = delete;
+};
+
+#endif  // BOUNDED_QUEUE_H
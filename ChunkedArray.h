@@ -0,0 +1,110 @@
+#ifndef CHUNKED_ARRAY_H
+#define CHUNKED_ARRAY_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+
+/**
+ * A ChunkedArray holds one record per interval of a run. It grows at its end
+ * a chunk at a time as the run reaches each interval, rather than being sized
+ * for the whole run up front; only its directory of chunks, a pointer per
+ * CHUNK_SIZE elements, is allocated in advance. Chunks never move once
+ * allocated, so one thread may append while others read elements that it has
+ * already published to them, and chunks at the front whose elements are no
+ * longer needed can be freed while the array keeps growing.
+ */
+template <typename T>
+class ChunkedArray {
+  public:
+    ChunkedArray() : chunks(NULL), numChunks(0), count(0), numFreed(0) {}
+
+    ~ChunkedArray() { clear(); }
+
+    /**
+     * Make room in the directory for up to maxSize elements, discarding any
+     * elements there were.
+     */
+    void setMaxSize(size_t maxSize) {
+        clear();
+        numChunks = (maxSize + CHUNK_SIZE - 1) / CHUNK_SIZE;
+        chunks = new T*[numChunks]();
+    }
+
+    /**
+     * Grow the array to size value-initialized elements. The array never
+     * shrinks.
+     */
+    void resize(size_t size) {
+        if (size > numChunks * CHUNK_SIZE) {
+            fprintf(stderr, "ChunkedArray grew past its maximum size of %zu\n",
+                    numChunks * CHUNK_SIZE);
+            abort();
+        }
+        for (size_t c = count / CHUNK_SIZE; c * CHUNK_SIZE < size; c++) {
+            if (!chunks[c])
+                chunks[c] = new T[CHUNK_SIZE]();
+        }
+        count = std::max(count, size);
+    }
+
+    void push_back(const T& value) {
+        resize(count + 1);
+        back() = value;
+    }
+
+    T& operator[](size_t i) { return chunks[i / CHUNK_SIZE][i % CHUNK_SIZE]; }
+    const T& operator[](size_t i) const {
+        return chunks[i / CHUNK_SIZE][i % CHUNK_SIZE];
+    }
+    T& back() { return (*this)[count - 1]; }
+    size_t size() const { return count; }
+
+    /**
+     * Return whether setMaxSize has been called, for arrays that only some
+     * runs use.
+     */
+    bool inUse() const { return chunks != NULL; }
+
+    /**
+     * Free the chunks that lie wholly before element end. No element before
+     * end may be accessed afterwards.
+     */
+    void releaseBefore(size_t end) {
+        for (; numFreed < numChunks && (numFreed + 1) * CHUNK_SIZE <= end;
+             numFreed++) {
+            delete[] chunks[numFreed];
+            chunks[numFreed] = NULL;
+        }
+    }
+
+  private:
+    // The number of elements in each chunk.
+    static const size_t CHUNK_SIZE = 256;
+
+    void clear() {
+        for (size_t c = 0; c < numChunks; c++)
+            delete[] chunks[c];
+        delete[] chunks;
+        chunks = NULL;
+        numChunks = 0;
+        count = 0;
+        numFreed = 0;
+    }
+
+    // The directory of chunks; a chunk is NULL until the array first grows
+    // into it, and again once it is released.
+    T** chunks;
+    size_t numChunks;
+
+    // The number of elements in the array, including released ones.
+    size_t count;
+
+    // Chunks before this one have been released.
+    size_t numFreed;
+
+    ChunkedArray(const ChunkedArray&) = delete;
+    ChunkedArray& operator=(const ChunkedArray&) = delete;
+};
+
+#endif  // CHUNKED_ARRAY_H
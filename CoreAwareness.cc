@@ -7,6 +7,10 @@
 #include <sys/syscall.h>
 #include <sys/types.h>
 #include <unistd.h>
+#include "ArrivalSchedule.h"
+#include "BenchmarkOptions.h"
+#include "LatencyHistogram.h"
+#include "LatencyLog.h"
 #include "Arachne/Arachne.h"
 #include "PerfUtils/Cycles.h"
 #include "PerfUtils/TimeTrace.h"
@@ -24,12 +28,29 @@ extern bool disableLoadEstimation;
 
 using PerfUtils::TimeTrace;
 
-// Support a maximum of 100 million entries.
-#define MAX_ENTRIES (1 << 27)
+// Every latency, in per-core shards.
+LatencyLog latencyLog;
 
-uint64_t latencies[MAX_ENTRIES];
+// With --histogram, latencies are counted in a fixed-size histogram per
+// interval instead, so memory use does not grow with the length of a run.
+// There is one more histogram than intervals, for threads that finish after
+// the last interval.
+bool useHistograms = false;
+int histogramPrecision = 7;
+LatencyHistogram** histograms;
 
-std::atomic<uint64_t> arrayIndex;
+// The histogram of the interval that is currently running.
+std::atomic<LatencyHistogram*> currentHistogram;
+
+/**
+ * Allocate the histogram of an interval as it starts, and count the latencies
+ * of threads that finish from now on in it. Histograms of intervals the run
+ * never reaches are never allocated.
+ */
+void startHistogram(size_t interval) {
+    histograms[interval] = new LatencyHistogram(histogramPrecision);
+    currentHistogram = histograms[interval];
+}
 
 struct Interval {
     uint64_t timeToRun;
@@ -43,10 +64,13 @@ struct Interval {
 
 size_t numIntervals;
 
-// The values of arrayIndex before each change in load, which we can use later
-// to compute latency and throughput. Note that this value and perfStats
-// are not read atomically, but we believe the difference should be
-// negligible.
+// Arrivals generated ahead of time from --seed, or NULL to draw them inline.
+ArrivalSchedule* schedule = NULL;
+
+// The number of completions before each change in load, which we can use
+// later to compute latency and throughput. These are filled in after the run
+// from the latency log or histograms, so that completing threads do not
+// contend on a shared counter.
 std::vector<uint64_t> indices;
 // The performance statistics before each change in load, which we can use
 // later to compute utilization.
@@ -65,7 +89,10 @@ void fixedWork(uint64_t duration, uint64_t creationTime) {
     uint64_t stop = Cycles::rdtsc() + duration;
     while (Cycles::rdtsc() < stop);
     uint64_t latency = Cycles::rdtsc() - creationTime;
-    latencies[arrayIndex++] = latency;
+    if (useHistograms)
+        currentHistogram.load(std::memory_order_relaxed)->record(latency);
+    else
+        latencyLog.record(latency);
 }
 
 pid_t gettid() {
@@ -201,11 +228,10 @@ void dispatch() {
     //     Arachne::join(Arachne::createThreadOnCore(i, printMyCore));
     // }
 
-    // Page in our data store
-    memset(latencies, 0, MAX_ENTRIES*sizeof(uint64_t));
-
     // Initialize interval
     size_t currentInterval = 0;
+    if (useHistograms)
+        startHistogram(currentInterval);
 
     // Start with a DCFT-style implementation based on shared-memory for communication
     // If that becomes too expensive, then switch to a separate thread for commands.
@@ -215,14 +241,15 @@ void dispatch() {
 	std::mt19937 gen(rd());
 
     std::exponential_distribution<double> intervalGenerator(intervals[currentInterval].creationsPerSecond);
-    uint64_t nextCycleTime = Cycles::rdtsc() +
-		Cycles::fromSeconds(intervalGenerator(gen));
+    if (schedule)
+        schedule->startInterval(currentInterval);
+    uint64_t nextCycleTime = nextArrival(schedule, Cycles::rdtsc(), gen,
+                                         intervalGenerator);
 
 
     PerfStats stats;
     PerfStats::collectStats(&stats);
 
-    indices.push_back(arrayIndex);
     perfStats.push_back(stats);
 
     uint64_t currentTime = Cycles::rdtsc();
@@ -238,18 +265,21 @@ void dispatch() {
             while (Arachne::createThread(fixedWork, cyclesPerThread, currentTime) == Arachne::NullThread);
 
             // Compute the next cycle time only after we win successfully
-            nextCycleTime = currentTime +
-                Cycles::fromSeconds(intervalGenerator(gen));
+            nextCycleTime = nextArrival(schedule, currentTime, gen,
+                                        intervalGenerator);
         }
 
         if (nextIntervalTime < currentTime) {
             // Collect latency, throughput, and core utilization information from the past interval
             PerfStats::collectStats(&stats);
-            indices.push_back(arrayIndex);
             perfStats.push_back(stats);
 
             // Advance the interval
             currentInterval++;
+            if (useHistograms)
+                startHistogram(currentInterval);
+            else
+                latencyLog.startInterval(currentInterval);
             if (currentInterval == numIntervals) break;
             TimeTrace::record("Load Change START %u --> %u Creations Per Second.",
                     static_cast<uint32_t>(intervals[currentInterval - 1].creationsPerSecond),
@@ -263,6 +293,13 @@ void dispatch() {
             intervalGenerator.param(
                     std::exponential_distribution<double>::param_type(
                     intervals[currentInterval].creationsPerSecond));
+            if (schedule) {
+                // The previous interval's arrivals may have run out, so
+                // restart the arrival clock from this interval's schedule.
+                schedule->startInterval(currentInterval);
+                nextCycleTime = nextArrival(schedule, currentTime, gen,
+                                            intervalGenerator);
+            }
             TimeTrace::record("Load Change END %u --> %u Creations Per Second.",
                     static_cast<uint32_t>(intervals[currentInterval - 1].creationsPerSecond),
                     static_cast<uint32_t>(intervals[currentInterval].creationsPerSecond));
@@ -322,6 +359,13 @@ installSignalHandler() {
  *
  * Note that we should probably bechmark the cost of extracting randomness as
  * well, but we haven't yet done that.
+ *
+ * With --histogram, each interval's latencies are counted in a histogram of
+ * --histogramPrecision bits (default 7) rather than stored one by one, so
+ * memory use stays fixed however long the run is.
+ *
+ * Otherwise every latency is kept, in a log sharded by core so that recording
+ * touches no shared cache lines; --hugePages backs the log with huge pages.
  */
 
 int main(int argc, const char** argv) {
@@ -338,6 +382,24 @@ int main(int argc, const char** argv) {
     Arachne::setErrorStream(stderr);
     Arachne::init(&argc, argv);
 
+    // With --seed, arrivals are generated before the run from the given seed
+    // so that runs are reproducible and the dispatch loop draws no random
+    // numbers.
+    const char* seedOption = extractOption(&argc, argv, "seed", true);
+
+    const char* precisionOption =
+        extractOption(&argc, argv, "histogramPrecision", true);
+    if (precisionOption) {
+        histogramPrecision = atoi(precisionOption);
+        if (histogramPrecision < 1 || histogramPrecision > 20) {
+            fprintf(stderr, "histogramPrecision must be 1 to 20!\n");
+            exit(1);
+        }
+    }
+    useHistograms = extractOption(&argc, argv, "histogram", false) != NULL;
+    latencyLog.setHugePages(
+        extractOption(&argc, argv, "hugePages", false) != NULL);
+
     if (argc < 5) {
         printf("Not enough arguments\n");
         exit(1);
@@ -371,6 +433,25 @@ int main(int argc, const char** argv) {
     }
     fclose(specFile);
 
+    if (useHistograms) {
+        histograms = new LatencyHistogram*[numIntervals + 1]();
+    } else {
+        // A shard for each core, since each of Arachne's kernel threads runs
+        // on a core of its own.
+        latencyLog.prepare(std::thread::hardware_concurrency(),
+                           numIntervals + 1);
+    }
+
+    if (seedOption) {
+        schedule = new ArrivalSchedule(
+            static_cast<uint32_t>(strtoul(seedOption, NULL, 0)),
+            ArrivalSchedule::POISSON);
+        for (size_t i = 0; i < numIntervals; i++) {
+            schedule->addInterval(intervals[i].creationsPerSecond,
+                                  intervals[i].timeToRun);
+        }
+    }
+
     // Catch intermittent errors
     installSignalHandler();
     Arachne::createThreadWithClass(Arachne::DefaultCorePolicy::EXCLUSIVE, dispatch);
@@ -386,15 +467,23 @@ int main(int argc, const char** argv) {
     TimeTrace::keepOldEvents = true;
     TimeTrace::print();
 
-    // Sanity check
-    if (arrayIndex >= MAX_ENTRIES) {
-        puts("Guaranteed memory corruption.");
-        abort();
+    // Count the completions in each interval, and make room to merge the
+    // largest interval's shards.
+    indices.push_back(0);
+    uint64_t maxCount = 0;
+    for (size_t i = 1; i < perfStats.size(); i++) {
+        uint64_t count = useHistograms ? histograms[i-1]->count()
+                                       : latencyLog.count(i-1);
+        indices.push_back(indices.back() + count);
+        maxCount = std::max(maxCount, count);
     }
-
-    // Convert latencies to ns
-    for (size_t i = 0; i < arrayIndex; i++)
-        latencies[i] = Cycles::toNanoseconds(latencies[i]);
+    std::vector<uint64_t> latencies(useHistograms ? 0 : maxCount);
+    if (latencyLog.numSaturated() > 0)
+        fprintf(stderr, "%lu latencies did not fit in 32 bits of cycles\n",
+                latencyLog.numSaturated());
+    if (latencyLog.numDropped() > 0)
+        fprintf(stderr, "%lu latencies were dropped waiting for log space\n",
+                latencyLog.numDropped());
     // Output core utilization, median & 99% latency, and throughput for each interval in a
     // plottable format.
     puts("Duration,Offered Load,Core Utilization,Median Latency,99\% Latency,Throughput,Load Factor,Core++,Core--");
@@ -420,7 +509,18 @@ int main(int argc, const char** argv) {
 
         // Median and 99% Latency
         // Note that this computation will modify data
-        Statistics mathStats = computeStatistics(latencies + indices[i-1], indices[i] - indices[i-1]);
+        Statistics mathStats;
+        if (useHistograms) {
+            LatencyHistogram* histogram = histograms[i-1];
+            mathStats.median = Cycles::toNanoseconds(histogram->percentile(0.5));
+            mathStats.P99 = Cycles::toNanoseconds(histogram->percentile(0.99));
+        } else {
+            // Merge the shards and convert latencies to ns
+            uint64_t count = latencyLog.copyInterval(i-1, latencies.data());
+            for (size_t j = 0; j < count; j++)
+                latencies[j] = Cycles::toNanoseconds(latencies[j]);
+            mathStats = computeStatistics(latencies.data(), count);
+        }
         printf("%lf,%lf,%lf,%lu,%lu,%lu,%lf,%lu,%lu\n", durationOfInterval,
                 intervals[i-1].creationsPerSecond, utilization,
                 mathStats.median, mathStats.P99, throughput,
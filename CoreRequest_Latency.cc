@@ -0,0 +1,216 @@
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ArbiterBenchmark.h"
+#include "BenchmarkOptions.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+#include "PerfUtils/Stats.h"
+
+using CoreArbiter::CoreArbiterClient;
+using PerfUtils::Cycles;
+
+/**
+ * Whom the core that is timed comes from.
+ */
+enum Mode {
+    // A core that no one holds.
+    NONCONTENDED,
+
+    // A core that a process of lower priority holds, and gives up as soon as
+    // it is asked to.
+    CONTENDED,
+
+    // A core that a process of lower priority holds and never gives up, so
+    // the arbiter must take it back once its timeout expires.
+    TIMEOUT
+};
+
+const char* modeNames[] = {"noncontended", "contended", "timeout"};
+
+Mode mode = NONCONTENDED;
+uint64_t numTrials = 100000;
+uint64_t numWarmup = 1000;
+int cpu = 0;
+bool printDistribution = false;
+const char* socketPath = DEFAULT_ARBITER_SOCKET;
+
+CoreArbiterClient* client;
+
+// The time at which the core being timed was asked for.
+std::atomic<uint64_t> startCycles(0);
+
+// The cycles from each request for a core to the thread that gets it
+// running, after the warmup.
+SampleBuffer* latencies;
+
+/**
+ * The thread that is timed: it waits for a core, notes how long it took, and
+ * gives the core back as soon as it is asked to.
+ */
+void
+coreExec() {
+    for (uint64_t trial = 0; trial < numWarmup + numTrials; trial++) {
+        client->blockUntilCoreAvailable();
+        uint64_t endCycles = Cycles::rdtsc();
+        if (trial >= numWarmup)
+            latencies->record(endCycles - startCycles);
+        while (!client->mustReleaseCore()) {
+        }
+    }
+    client->unregisterThread();
+}
+
+/**
+ * The thread that asks for a core for coreExec each trial, and takes it back
+ * once coreExec is running. It holds no core of its own, and stays pinned to
+ * an unmanaged CPU.
+ */
+void
+coreRequest() {
+    pinThread(cpu);
+    for (uint64_t trial = 0; trial < numWarmup + numTrials; trial++) {
+        // Start only once coreExec is blocked and, in the contended modes,
+        // the process of lower priority has every core again.
+        while (client->getNumBlockedThreads() == 0) {
+        }
+        if (mode != NONCONTENDED) {
+            while (client->getNumUnoccupiedCores() > 0) {
+            }
+        }
+
+        startCycles = Cycles::rdtsc();
+        client->setRequestedCores(coresAtPriority(0, 1));
+        while (client->getNumBlockedThreads() == 1) {
+        }
+        client->setRequestedCores(coresAtPriority(0, 0));
+    }
+}
+
+/**
+ * Take and time cores, and return once every trial is done.
+ */
+void
+runTrials() {
+    client = CoreArbiterClient::getInstance(socketPath);
+    std::thread execThread(coreExec);
+    std::thread requestThread(coreRequest);
+    execThread.join();
+    requestThread.join();
+}
+
+/**
+ * The body of each thread of the process of lower priority: hold a core and,
+ * unless the mode is TIMEOUT, give it up whenever asked, then wait for it
+ * back. The threads run until the process exits.
+ */
+void
+lowPriorityExec() {
+    for (;;) {
+        client->blockUntilCoreAvailable();
+        while (!client->mustReleaseCore() || mode == TIMEOUT) {
+        }
+    }
+}
+
+/**
+ * This benchmark measures how long a process waits for a core from the
+ * CoreArbiter, from the moment it asks for one to the moment the thread that
+ * gets it is running. A thread pinned to --cpu, which the arbiter should not
+ * manage, repeatedly asks for one core at the highest priority, waits for
+ * the thread it is meant for to start, and gives the core back. Where the
+ * core comes from depends on --mode:
+ *
+ *     noncontended  the arbiter has a core free
+ *     contended     a process of the lowest priority holds every core the
+ *                   arbiter manages, and gives one up as soon as it is asked
+ *     timeout       a process of the lowest priority holds every core and
+ *                   ignores the arbiter's requests to give one up, so the
+ *                   arbiter must take it back when its timeout expires
+ *
+ * The first --warmup trials are discarded, and the next --trials are kept in
+ * memory allocated before the first trial, so that nothing but the trial
+ * happens while one is timed. The benchmark prints the minimum, median,
+ * 90th, 99th and 99.9th percentile and maximum latency in nanoseconds, and
+ * with --cdf, the full distribution of the latencies after that. The arbiter
+ * must already be running on --socket.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    bool valid = true;
+    if ((option = extractOption(&argc, argv, "mode", true))) {
+        valid = false;
+        for (int m = NONCONTENDED; m <= TIMEOUT; m++) {
+            if (strcmp(option, modeNames[m]) == 0) {
+                mode = static_cast<Mode>(m);
+                valid = true;
+            }
+        }
+    }
+    if ((option = extractOption(&argc, argv, "trials", true)))
+        numTrials = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "warmup", true)))
+        numWarmup = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "cpu", true)))
+        cpu = atoi(option);
+    if (extractOption(&argc, argv, "cdf", false))
+        printDistribution = true;
+    if ((option = extractOption(&argc, argv, "socket", true)))
+        socketPath = option;
+    if (!valid || argc != 1 || numTrials < 1 || cpu < 0) {
+        printf("Usage: ./CoreRequest_Latency "
+               "[--mode noncontended|contended|timeout] [--trials N] "
+               "[--warmup N] [--cpu N] [--cdf] [--socket PATH]\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    latencies = new SampleBuffer(numTrials);
+
+    if (mode == NONCONTENDED) {
+        runTrials();
+    } else {
+        // Both processes connect after forking, so that each has its own
+        // connection. The child holds the cores, and the parent times them.
+        pid_t pid = fork();
+        if (pid < 0) {
+            fprintf(stderr, "Error forking: %s\n", strerror(errno));
+            exit(1);
+        }
+        if (pid == 0) {
+            client = CoreArbiterClient::getInstance(socketPath);
+            uint32_t numCores = client->getNumUnoccupiedCores();
+            client->setRequestedCores(
+                coresAtPriority(NUM_PRIORITIES - 1, numCores));
+            for (uint32_t c = 0; c < numCores; c++)
+                std::thread(lowPriorityExec).detach();
+            for (;;)
+                pause();
+        }
+        runTrials();
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+    }
+
+    Statistics stats = computeStatistics(latencies->data(), latencies->size());
+    printf("Mode,Trials,Warmup,Min,50%%,90%%,99%%,99.9%%,Max\n");
+    printf("%s,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\n", modeNames[mode], numTrials,
+           numWarmup, Cycles::toNanoseconds(stats.min),
+           Cycles::toNanoseconds(stats.median),
+           Cycles::toNanoseconds(stats.P90), Cycles::toNanoseconds(stats.P99),
+           Cycles::toNanoseconds(stats.P999), Cycles::toNanoseconds(stats.max));
+    if (printDistribution) {
+        printf("\n");
+        printCdf(latencies->data(), latencies->size());
+    }
+    delete latencies;
+    return 0;
+}
@@ -0,0 +1,374 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "ArbiterBenchmark.h"
+#include "BenchmarkOptions.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+
+using CoreArbiter::CoreArbiterClient;
+using PerfUtils::Cycles;
+
+/**
+ * What each client reports back to the parent.
+ */
+struct ClientStats {
+    std::atomic<uint64_t> grants;
+
+    // The number of times one of the client's threads was asked to give up
+    // its core while the client still wanted it.
+    std::atomic<uint64_t> preemptions;
+
+    // The total time the client's threads held cores, in cycles; written
+    // once, when the run is over.
+    std::atomic<uint64_t> coreCycles;
+
+    // The time at which the client last increased its demand, or 0 if it
+    // has not, and the number of cores it added then that it has yet to be
+    // granted. Clients of lower priority read these to tell which increase
+    // preempted them.
+    std::atomic<uint64_t> lastIncrease;
+    std::atomic<int64_t> pendingGrants;
+
+    // The time at which one of the client's threads last gave up a core
+    // that the arbiter took from it, or 0 if none has. Clients of higher
+    // priority read this to tell when a core was handed over to them.
+    std::atomic<uint64_t> lastYield;
+};
+
+std::vector<uint64_t> priorities = {0, 1, 2, 3, 4, 5, 6, 7, 7, 7};
+size_t numThreads = 4;
+std::vector<uint64_t> demands = {1, 4};
+uint64_t periodNs = 1000000;
+double duration = 5;
+size_t numSamples = 1000000;
+const char* socketPath = DEFAULT_ARBITER_SOCKET;
+
+ClientControl* control;
+ClientStats* clientStats;
+
+// For each priority, the cycles from a client's latest increase in demand to
+// each grant of a core that it added; from the increase at a higher priority
+// that preempted one of its threads to the thread learning that it must give
+// up its core; and from one of its threads giving up a core that the arbiter
+// took to a client of higher priority being granted a core it was waiting
+// for.
+SampleBuffer* grantLatencies[NUM_PRIORITIES];
+SampleBuffer* reclaimLatencies[NUM_PRIORITIES];
+SampleBuffer* handoffLatencies[NUM_PRIORITIES];
+
+// The state of the client this process is, once forked. stats->pendingGrants
+// and pendingReleases count the cores still to be granted or released since
+// the latest change of demand, which was made at changeTime.
+CoreArbiterClient* client;
+uint32_t priority;
+ClientStats* stats;
+std::atomic<int64_t> pendingReleases(0);
+std::atomic<uint64_t> changeTime(0);
+
+// The cycles that threads have held cores for, and the time at which each
+// thread got the core it holds now, or 0.
+std::atomic<uint64_t> heldCycles(0);
+std::atomic<uint64_t>* heldSince;
+
+/**
+ * Return the latest time at which a client of higher priority than this one
+ * increased its demand, of the clients that are still waiting for cores they
+ * added then, or 0 if none is. Only such an increase can have made the
+ * arbiter preempt this client; one that has been granted all its cores
+ * cannot.
+ */
+uint64_t
+lastHigherIncrease() {
+    uint64_t latest = 0;
+    for (size_t c = 0; c < priorities.size(); c++) {
+        if (priorities[c] >= priority || clientStats[c].pendingGrants <= 0)
+            continue;
+        latest = std::max(latest, clientStats[c].lastIncrease.load());
+    }
+    return latest;
+}
+
+/**
+ * Return the latest time, no later than the given time, at which a thread of
+ * a client of lower priority than this one gave up a core that the arbiter
+ * took from it, or 0 if there is none, and set victimPriority to the
+ * priority of that client. A core this client was waiting for can only have
+ * been handed over to it by such a thread.
+ */
+uint64_t
+lastLowerYield(uint64_t time, uint32_t* victimPriority) {
+    uint64_t latest = 0;
+    for (size_t c = 0; c < priorities.size(); c++) {
+        uint64_t yield = clientStats[c].lastYield;
+        if (priorities[c] <= priority || yield > time || yield <= latest)
+            continue;
+        latest = yield;
+        *victimPriority = static_cast<uint32_t>(priorities[c]);
+    }
+    return latest;
+}
+
+/**
+ * Times the grants and preemptions of the cores that one of a client's
+ * threads holds, and how long it holds them (see holdCores).
+ */
+struct Holder {
+    explicit Holder(size_t index) : index(index), grantTime(0) {}
+
+    void granted(uint64_t blockTime, uint64_t grantTime) {
+        this->grantTime = grantTime;
+        heldSince[index] = grantTime;
+        stats->grants++;
+        if (!takePending(&stats->pendingGrants))
+            return;
+        grantLatencies[priority]->record(grantTime - changeTime);
+
+        // Only a core given up since the increase that added this one can
+        // have been handed over for it.
+        uint32_t victimPriority = 0;
+        uint64_t yield = lastLowerYield(grantTime, &victimPriority);
+        if (yield > changeTime)
+            handoffLatencies[victimPriority]->record(grantTime - yield);
+    }
+
+    void released(uint64_t releaseTime) {
+        heldSince[index] = 0;
+        heldCycles += releaseTime - grantTime;
+        if (!takePending(&pendingReleases)) {
+            // The client did not ask to give up this core, so the arbiter
+            // took it for a client of higher priority.
+            stats->preemptions++;
+            uint64_t increase = lastHigherIncrease();
+            if (increase != 0 && increase < releaseTime)
+                reclaimLatencies[priority]->record(releaseTime - increase);
+
+            // holdCores blocks, giving the core up, as soon as this returns.
+            stats->lastYield = Cycles::rdtsc();
+        }
+    }
+
+    // The thread's entry in heldSince.
+    size_t index;
+
+    // The time at which the thread got the core it holds now.
+    uint64_t grantTime;
+};
+
+/**
+ * Ask the arbiter for a new number of cores at this client's priority,
+ * noting how many cores are now to be granted or released so that the
+ * threads can time them.
+ */
+void
+changeDemand(uint32_t demand) {
+    int64_t owned = client->getNumOwnedCores();
+    stats->pendingGrants = 0;
+    pendingReleases = 0;
+    changeTime = Cycles::rdtsc();
+    if (demand > owned) {
+        // Set before the pending grants, so that a client that sees them
+        // sees the time of the increase that added them.
+        stats->lastIncrease = changeTime.load();
+        stats->pendingGrants = demand - owned;
+    } else {
+        pendingReleases = owned - demand;
+    }
+    client->setRequestedCores(coresAtPriority(priority, demand));
+}
+
+/**
+ * Run one client process until the run is over. Client index starts the
+ * demand schedule at step index, so that the clients' changes are staggered.
+ */
+void
+runClient(size_t index) {
+    client = CoreArbiterClient::getInstance(socketPath);
+    priority = static_cast<uint32_t>(priorities[index]);
+    stats = &clientStats[index];
+    heldSince = new std::atomic<uint64_t>[numThreads];
+    for (size_t t = 0; t < numThreads; t++)
+        heldSince[t] = 0;
+    startHolders<Holder>(control, client, numThreads);
+    followDemands(control, demands, index, periodNs, changeDemand);
+
+    // Cores that are still held count up to now.
+    uint64_t now = Cycles::rdtsc();
+    uint64_t coreCycles = heldCycles;
+    for (size_t t = 0; t < numThreads; t++) {
+        uint64_t since = heldSince[t];
+        if (since != 0 && since < now)
+            coreCycles += now - since;
+    }
+    stats->coreCycles = coreCycles;
+}
+
+/**
+ * Print a row of results for each priority that has clients.
+ */
+void
+printResults() {
+    printf("Priority,Clients,Grants,50%% Grant,90%% Grant,99%% Grant,"
+           "Max Grant,Preemptions,50%% Reclaim,90%% Reclaim,99%% Reclaim,"
+           "Max Reclaim,50%% Handoff,90%% Handoff,99%% Handoff,Max Handoff,"
+           "Core-Seconds,Share,Min Client Share,"
+           "Max Client Share,Fairness\n");
+    double totalSeconds = 0;
+    for (size_t c = 0; c < priorities.size(); c++)
+        totalSeconds += Cycles::toSeconds(clientStats[c].coreCycles);
+
+    for (uint32_t p = 0; p < NUM_PRIORITIES; p++) {
+        size_t numClients = 0;
+        uint64_t grants = 0;
+        uint64_t preemptions = 0;
+        double seconds = 0;
+        double squares = 0;
+        double minSeconds = 0;
+        double maxSeconds = 0;
+        for (size_t c = 0; c < priorities.size(); c++) {
+            if (priorities[c] != p)
+                continue;
+            double clientSeconds =
+                Cycles::toSeconds(clientStats[c].coreCycles);
+            if (numClients == 0 || clientSeconds < minSeconds)
+                minSeconds = clientSeconds;
+            if (numClients == 0 || clientSeconds > maxSeconds)
+                maxSeconds = clientSeconds;
+            numClients++;
+            grants += clientStats[c].grants;
+            preemptions += clientStats[c].preemptions;
+            seconds += clientSeconds;
+            squares += clientSeconds * clientSeconds;
+        }
+        if (numClients == 0)
+            continue;
+
+        printf("%u,%zu,%lu", p, numClients, grants);
+        printPercentiles(grantLatencies[p]->data(), grantLatencies[p]->size());
+        printf(",%lu", preemptions);
+        printPercentiles(reclaimLatencies[p]->data(),
+                         reclaimLatencies[p]->size());
+        printPercentiles(handoffLatencies[p]->data(),
+                         handoffLatencies[p]->size());
+        printf(",%.3lf", seconds);
+        if (totalSeconds > 0) {
+            printf(",%.4lf,%.4lf,%.4lf", seconds / totalSeconds,
+                   minSeconds / totalSeconds, maxSeconds / totalSeconds);
+        } else {
+            printf(",NA,NA,NA");
+        }
+        // Jain's index: 1 when the clients of the priority got equal
+        // shares, and 1 / clients when one of them got everything.
+        if (squares > 0) {
+            printf(",%.4lf\n", seconds * seconds /
+                                   (static_cast<double>(numClients) * squares));
+        } else {
+            printf(",NA\n");
+        }
+    }
+}
+
+/**
+ * This benchmark measures how the CoreArbiter divides cores between clients
+ * of different priorities, and between clients of the same priority. It
+ * forks one client process for each priority in --priorities, where 0 is the
+ * highest and 7 the lowest, each with --threads threads that wait for a core
+ * from the arbiter, hold it until the arbiter asks for it back, and wait
+ * again. Every --period nanoseconds, each client asks for the next number of
+ * cores in --demands at its priority; client i starts at step i of the list,
+ * so that the clients' demands change out of step with one another and
+ * overlap. The run lasts --duration seconds. The arbiter must already be
+ * running on --socket, and for clients to contend, the total demand should
+ * exceed the cores it manages.
+ *
+ * The benchmark prints a row for each priority that has clients, with
+ * latencies in nanoseconds:
+ * - Grant latency runs from a client's latest increase in demand to a thread
+ *   getting one of the cores it added.
+ * - Reclaim latency runs from the latest increase in demand by a client of
+ *   higher priority that was still waiting for cores it added to a thread
+ *   learning that it must give up a core that its client still wanted.
+ *   Preemptions while no such increase was waiting are counted, but not
+ *   timed.
+ * - Handoff latency runs from a thread of the priority giving up a core that
+ *   the arbiter took from it to a client of higher priority being granted a
+ *   core that it was waiting for. Each such grant is attributed to the
+ *   latest core given up by a client of lower priority since the grantee's
+ *   increase in demand; Reclaim and Handoff together cover the time for a
+ *   core to pass from the priority to the client that preempted it.
+ * - Share is the fraction of all the core-seconds the clients held that went
+ *   to the priority, and Min and Max Client Share are those of the clients
+ *   of the priority that held the least and the most. Fairness is Jain's
+ *   index of the core-seconds of the clients of the priority.
+ * At most --samples latencies of each kind are kept per priority.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    bool valid = true;
+    if ((option = extractOption(&argc, argv, "priorities", true)))
+        valid &= parseList(option, &priorities);
+    if ((option = extractOption(&argc, argv, "threads", true)))
+        numThreads = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "demands", true)))
+        valid &= parseList(option, &demands);
+    if ((option = extractOption(&argc, argv, "period", true)))
+        periodNs = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "duration", true)))
+        duration = atof(option);
+    if ((option = extractOption(&argc, argv, "samples", true)))
+        numSamples = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "socket", true)))
+        socketPath = option;
+    for (size_t d = 0; d < demands.size(); d++)
+        valid &= demands[d] <= numThreads;
+    for (size_t c = 0; c < priorities.size(); c++)
+        valid &= priorities[c] < NUM_PRIORITIES;
+    if (!valid || argc != 1 || numThreads < 1 || periodNs < 1 ||
+        duration <= 0) {
+        printf("Usage: ./CoreRequest_Priorities [--priorities \"P1 P2 ...\"] "
+               "[--threads N] [--demands \"D1 D2 ...\"] [--period NS] "
+               "[--duration SECONDS] [--samples N] [--socket PATH]\n"
+               "Priorities run from 0 to 7, and no demand may exceed the "
+               "number of threads.\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    control = mapShared<ClientControl>(1);
+    clientStats = mapShared<ClientStats>(priorities.size());
+    for (size_t p = 0; p < NUM_PRIORITIES; p++) {
+        grantLatencies[p] = new SampleBuffer(numSamples);
+        reclaimLatencies[p] = new SampleBuffer(numSamples);
+        handoffLatencies[p] = new SampleBuffer(numSamples);
+    }
+
+    std::vector<pid_t> pids = forkClients(priorities.size(), runClient);
+    startClients(control, priorities.size());
+    usleep(static_cast<useconds_t>(duration * 1e6));
+    stopClients(control, pids);
+
+    printResults();
+    for (size_t p = 0; p < NUM_PRIORITIES; p++) {
+        if (grantLatencies[p]->getNumDropped() > 0 ||
+            reclaimLatencies[p]->getNumDropped() > 0 ||
+            handoffLatencies[p]->getNumDropped() > 0) {
+            fprintf(stderr,
+                    "%lu grant, %lu reclaim and %lu handoff samples at "
+                    "priority %zu did not fit in --samples\n",
+                    grantLatencies[p]->getNumDropped(),
+                    reclaimLatencies[p]->getNumDropped(),
+                    handoffLatencies[p]->getNumDropped(), p);
+        }
+        delete grantLatencies[p];
+        delete reclaimLatencies[p];
+        delete handoffLatencies[p];
+    }
+    unmapShared(clientStats, priorities.size());
+    unmapShared(control, 1);
+    return 0;
+}
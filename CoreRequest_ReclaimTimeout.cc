@@ -0,0 +1,272 @@
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "ArbiterBenchmark.h"
+#include "BenchmarkOptions.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+
+using CoreArbiter::CoreArbiterClient;
+using PerfUtils::Cycles;
+
+/**
+ * What the victim process shares with the parent.
+ */
+struct Control {
+    // How long, in cycles, a victim thread waits after it is asked to give
+    // up its core before it blocks; set by the parent for each delay.
+    std::atomic<uint64_t> delayCycles;
+
+    // When the victim thread of the current trial learned that it must give
+    // up its core, and when it gave it up, either by blocking or by finding
+    // that the arbiter had moved it off the core; 0 until then.
+    std::atomic<uint64_t> notifyTime;
+    std::atomic<uint64_t> releaseTime;
+
+    // True if the arbiter moved the victim thread before it blocked.
+    std::atomic<bool> forced;
+};
+
+std::vector<uint64_t> delays = {0, 1000, 10000, 100000, 1000000, 10000000};
+uint64_t numTrials = 1000;
+uint64_t numWarmup = 10;
+uint64_t timeoutNs = 0;
+int cpu = 0;
+const char* socketPath = DEFAULT_ARBITER_SOCKET;
+
+Control* control;
+CoreArbiterClient* client;
+
+// The time at which the high-priority thread got its core in the current
+// trial, or 0 until then.
+std::atomic<uint64_t> wakeupTime(0);
+
+// For the current delay, the cycles of each trial from the request for a
+// core to the high-priority thread running, and of each stage of that:
+// - notification: from the request until the victim learns of it;
+// - grace: from then until the victim blocks or finds itself moved;
+// - move: for forced trials, how much longer than the timeout the grace
+//   took, if the timeout is known;
+// - wakeup: from the victim giving up its core until the high-priority
+//   thread runs on it.
+SampleBuffer* latencies;
+SampleBuffer* notifications;
+SampleBuffer* graces;
+SampleBuffer* moves;
+SampleBuffer* wakeups;
+
+/**
+ * The body of each thread of the victim process: hold a core and, when asked
+ * to give it up, wait for the current delay before blocking, noting whether
+ * the arbiter moved the thread in the meantime.
+ */
+void
+victimThread() {
+    for (;;) {
+        client->blockUntilCoreAvailable();
+        int grantedCpu = sched_getcpu();
+        while (!client->mustReleaseCore()) {
+        }
+        uint64_t notifyTime = Cycles::rdtsc();
+        control->notifyTime = notifyTime;
+
+        uint64_t blockTime = notifyTime + control->delayCycles;
+        bool forced = false;
+        uint64_t now;
+        while ((now = Cycles::rdtsc()) < blockTime) {
+            if (!forced && sched_getcpu() != grantedCpu) {
+                forced = true;
+                control->forced = true;
+                control->releaseTime = now;
+            }
+        }
+        if (!forced)
+            control->releaseTime = Cycles::rdtsc();
+    }
+}
+
+/**
+ * The high-priority thread that is given the victim's core each trial.
+ */
+void
+highPriorityExec() {
+    for (;;) {
+        client->blockUntilCoreAvailable();
+        wakeupTime = Cycles::rdtsc();
+        while (!client->mustReleaseCore()) {
+        }
+    }
+}
+
+/**
+ * Run the trials for one delay, and print a row of results.
+ */
+void
+runDelay(uint64_t delayNs) {
+    control->delayCycles = Cycles::fromNanoseconds(delayNs);
+    latencies->clear();
+    notifications->clear();
+    graces->clear();
+    moves->clear();
+    wakeups->clear();
+    uint64_t timeoutCycles = Cycles::fromNanoseconds(timeoutNs);
+    uint64_t numForced = 0;
+
+    for (uint64_t trial = 0; trial < numWarmup + numTrials; trial++) {
+        // Start only once the high-priority thread is blocked and the victim
+        // has every core again.
+        while (client->getNumBlockedThreads() == 0) {
+        }
+        while (client->getNumUnoccupiedCores() > 0) {
+        }
+        control->notifyTime = 0;
+        control->releaseTime = 0;
+        control->forced = false;
+        wakeupTime = 0;
+
+        uint64_t requestTime = Cycles::rdtsc();
+        client->setRequestedCores(coresAtPriority(0, 1));
+        while (wakeupTime == 0) {
+        }
+        client->setRequestedCores(coresAtPriority(0, 0));
+
+        // A victim that was moved may only notice once it runs again.
+        while (control->releaseTime == 0) {
+        }
+        if (trial < numWarmup)
+            continue;
+        uint64_t notifyTime = control->notifyTime;
+        uint64_t releaseTime = control->releaseTime;
+        latencies->record(wakeupTime - requestTime);
+        notifications->record(notifyTime - requestTime);
+        graces->record(releaseTime - notifyTime);
+        wakeups->record(wakeupTime > releaseTime ? wakeupTime - releaseTime
+                                                 : 0);
+        if (control->forced) {
+            numForced++;
+            if (timeoutNs != 0) {
+                uint64_t grace = releaseTime - notifyTime;
+                moves->record(grace > timeoutCycles ? grace - timeoutCycles
+                                                    : 0);
+            }
+        }
+    }
+
+    printf("%lu,%lu,%lu", delayNs, numTrials, numForced);
+    printPercentiles(latencies->data(), latencies->size());
+    printPercentiles(notifications->data(), notifications->size());
+    printPercentiles(graces->data(), graces->size());
+    printPercentiles(moves->data(), moves->size());
+    printPercentiles(wakeups->data(), wakeups->size());
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * This benchmark measures how long the CoreArbiter takes to reclaim a core
+ * from a process that is slow to give it up, as a function of how slow the
+ * process is, so that the arbiter's timeout can be compared with what it
+ * costs. A victim process at the lowest priority holds every core the
+ * arbiter manages. A thread pinned to --cpu, which the arbiter should not
+ * manage, repeatedly asks for one core at the highest priority, waits for
+ * its thread to run, and gives the core back. For each delay in --delays,
+ * in nanoseconds, the victim's threads wait that long after learning that
+ * they must give up their cores before blocking, and the benchmark runs
+ * --warmup trials that it discards and then --trials that it keeps. The
+ * arbiter must already be running on --socket; its timeout is set on its own
+ * command line, and can be given to the benchmark as --timeout, in
+ * nanoseconds.
+ *
+ * Each delay prints a row with the number of trials in which the arbiter
+ * moved the victim's thread off its core before the thread blocked, and the
+ * distributions, in nanoseconds, of the latency from the request for a core
+ * to the high-priority thread running, and of the stages of that latency:
+ * - Notification: until the victim learns that it must give up the core.
+ * - Grace: until the victim blocks or, if the arbiter moves it first, finds
+ *   that it is on another core. The victim only notices once it runs again,
+ *   so this may overstate when it was moved.
+ * - Move: for trials in which the victim was moved, how much longer than
+ *   --timeout the grace was, which is the time the arbiter took to notice
+ *   the timeout's expiry and move the victim out of the core's cpuset; NA
+ *   without --timeout.
+ * - Wakeup: from the end of the grace until the high-priority thread runs,
+ *   or 0 if the victim noticed that it was moved only after that.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    bool valid = true;
+    if ((option = extractOption(&argc, argv, "delays", true)))
+        valid &= parseList(option, &delays);
+    if ((option = extractOption(&argc, argv, "trials", true)))
+        numTrials = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "warmup", true)))
+        numWarmup = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "timeout", true)))
+        timeoutNs = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "cpu", true)))
+        cpu = atoi(option);
+    if ((option = extractOption(&argc, argv, "socket", true)))
+        socketPath = option;
+    if (!valid || argc != 1 || numTrials < 1 || cpu < 0) {
+        printf("Usage: ./CoreRequest_ReclaimTimeout [--delays \"NS1 NS2 ...\"] "
+               "[--trials N] [--warmup N] [--timeout NS] [--cpu N] "
+               "[--socket PATH]\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    control = mapShared<Control>(1);
+    latencies = new SampleBuffer(numTrials);
+    notifications = new SampleBuffer(numTrials);
+    graces = new SampleBuffer(numTrials);
+    moves = new SampleBuffer(numTrials);
+    wakeups = new SampleBuffer(numTrials);
+
+    // Both processes connect after forking, so that each has its own
+    // connection. The child is the victim, and the parent times it.
+    pid_t pid = fork();
+    if (pid < 0) {
+        fprintf(stderr, "Error forking: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (pid == 0) {
+        client = CoreArbiterClient::getInstance(socketPath);
+        uint32_t numCores = client->getNumUnoccupiedCores();
+        client->setRequestedCores(
+            coresAtPriority(NUM_PRIORITIES - 1, numCores));
+        for (uint32_t c = 0; c < numCores; c++)
+            std::thread(victimThread).detach();
+        for (;;)
+            pause();
+    }
+
+    client = CoreArbiterClient::getInstance(socketPath);
+    std::thread(highPriorityExec).detach();
+    pinThread(cpu);
+    printf("Delay,Trials,Forced,50%% Latency,90%% Latency,99%% Latency,"
+           "Max Latency,50%% Notification,90%% Notification,"
+           "99%% Notification,Max Notification,50%% Grace,90%% Grace,"
+           "99%% Grace,Max Grace,50%% Move,90%% Move,99%% Move,Max Move,"
+           "50%% Wakeup,90%% Wakeup,99%% Wakeup,Max Wakeup\n");
+    for (size_t d = 0; d < delays.size(); d++)
+        runDelay(delays[d]);
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    delete latencies;
+    delete notifications;
+    delete graces;
+    delete moves;
+    delete wakeups;
+    unmapShared(control, 1);
+    return 0;
+}
@@ -0,0 +1,221 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+#include "ArbiterBenchmark.h"
+#include "BenchmarkOptions.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+
+using CoreArbiter::CoreArbiterClient;
+using PerfUtils::Cycles;
+
+/**
+ * What the clients of one run share with the parent.
+ */
+struct Control : ClientControl {
+    // The number of cores the arbiter had free when the first client
+    // connected, plus one so that 0 means not yet known.
+    std::atomic<uint64_t> numCoresPlusOne;
+
+    // Totals over all clients.
+    std::atomic<uint64_t> demandChanges;
+    std::atomic<uint64_t> grants;
+    std::atomic<uint64_t> revocations;
+};
+
+std::vector<uint64_t> clientCounts = {1, 2, 4, 8, 16, 24};
+size_t numThreads = 4;
+std::vector<uint64_t> demands = {1, 3};
+uint64_t periodNs = 1000000;
+double duration = 5;
+size_t numSamples = 1000000;
+const char* socketPath = DEFAULT_ARBITER_SOCKET;
+
+Control* control;
+
+// The cycles from a client's latest demand increase to each grant of a core
+// that it asked for, and from its latest decrease to each thread learning
+// that it must release its core.
+SampleBuffer* grantLatencies;
+SampleBuffer* revocationLatencies;
+
+// The state of the client this process is, once forked. pendingGrants and
+// pendingReleases count the cores still to be granted or released since the
+// latest change of demand, which was made at changeTime.
+CoreArbiterClient* client;
+std::atomic<int64_t> pendingGrants(0);
+std::atomic<int64_t> pendingReleases(0);
+std::atomic<uint64_t> changeTime(0);
+
+/**
+ * Times the grants and revocations of the cores that one of a client's
+ * threads holds (see holdCores).
+ */
+struct Holder {
+    explicit Holder(size_t index) {}
+
+    void granted(uint64_t blockTime, uint64_t grantTime) {
+        control->grants++;
+        if (takePending(&pendingGrants))
+            grantLatencies->record(grantTime - changeTime);
+    }
+
+    void released(uint64_t releaseTime) {
+        control->revocations++;
+        if (takePending(&pendingReleases))
+            revocationLatencies->record(releaseTime - changeTime);
+    }
+};
+
+/**
+ * Ask the arbiter for a new number of cores, noting how many cores are now to
+ * be granted or released so that the threads can time them.
+ */
+void
+changeDemand(uint32_t demand) {
+    int64_t owned = client->getNumOwnedCores();
+    pendingGrants = 0;
+    pendingReleases = 0;
+    changeTime = Cycles::rdtsc();
+    if (demand > owned)
+        pendingGrants = demand - owned;
+    else
+        pendingReleases = owned - demand;
+    client->setRequestedCores(coresAtPriority(0, demand));
+    control->demandChanges++;
+}
+
+/**
+ * Run one client process until the run is over. Client index starts the
+ * demand schedule at step index, so that the clients' changes are staggered.
+ * The first client counts the arbiter's free cores; no client asks for any
+ * until the run starts.
+ */
+void
+runClient(size_t index) {
+    client = CoreArbiterClient::getInstance(socketPath);
+    if (index == 0)
+        control->numCoresPlusOne = client->getNumUnoccupiedCores() + 1;
+    startHolders<Holder>(control, client, numThreads);
+    followDemands(control, demands, index, periodNs, changeDemand);
+}
+
+/**
+ * Fork numClients clients, run them for the duration, and print a row of
+ * results.
+ */
+void
+runClients(size_t numClients) {
+    control->numReady = 0;
+    control->start = false;
+    control->stop = false;
+    control->numCoresPlusOne = 0;
+    control->demandChanges = 0;
+    control->grants = 0;
+    control->revocations = 0;
+    grantLatencies->clear();
+    revocationLatencies->clear();
+
+    std::vector<pid_t> pids = forkClients(numClients, runClient);
+    startClients(control, numClients);
+    uint64_t startTime = Cycles::rdtsc();
+    usleep(static_cast<useconds_t>(duration * 1e6));
+    double elapsed = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+    stopClients(control, pids);
+
+    if (grantLatencies->getNumDropped() > 0 ||
+        revocationLatencies->getNumDropped() > 0) {
+        fprintf(stderr,
+                "%lu grant and %lu revocation samples with %zu clients did "
+                "not fit in --samples\n",
+                grantLatencies->getNumDropped(),
+                revocationLatencies->getNumDropped(), numClients);
+    }
+    printf("%zu,%zu,%lu,%.0lf,%.0lf,%lu", numClients, numThreads,
+           control->numCoresPlusOne - 1,
+           static_cast<double>(control->demandChanges) / elapsed,
+           static_cast<double>(control->grants + control->revocations) /
+               elapsed,
+           control->grants.load());
+    printPercentiles(grantLatencies->data(), grantLatencies->size());
+    printf(",%lu", control->revocations.load());
+    printPercentiles(revocationLatencies->data(),
+                     revocationLatencies->size());
+    printf("\n");
+    fflush(stdout);
+}
+
+/**
+ * This benchmark measures how the CoreArbiter copes with many client
+ * processes changing their demand for cores at once. For each count in
+ * --clients, it forks that many client processes, each with --threads
+ * threads that wait for a core from the arbiter, hold it until the arbiter
+ * asks for it back, and wait again. Every --period nanoseconds, each client
+ * asks for the next number of cores in --demands, all at priority 0; client
+ * i starts at step i of the list, so that the clients' demands change out of
+ * step with one another. Each run lasts --duration seconds. The arbiter must
+ * already be running on --socket, and the number of cores it manages, which
+ * is set on its own command line, is the other axis of the benchmark.
+ *
+ * Each run prints a row with the number of cores the arbiter had free at the
+ * start, the rate of demand changes, the rate of the arbiter's decisions (the
+ * cores granted and the cores revoked per second), and the distributions of
+ * grant and revocation latency in nanoseconds. Grant latency runs from a
+ * client's latest increase in demand to a thread getting one of the cores it
+ * added; revocation latency runs from a client's latest decrease to a thread
+ * learning that it must give up its core. Grants and revocations that the
+ * arbiter makes for other reasons, such as a core that another client gave
+ * up, are counted but not timed. At most --samples latencies of each kind
+ * are kept per run.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    bool valid = true;
+    if ((option = extractOption(&argc, argv, "clients", true)))
+        valid &= parseList(option, &clientCounts);
+    if ((option = extractOption(&argc, argv, "threads", true)))
+        numThreads = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "demands", true)))
+        valid &= parseList(option, &demands);
+    if ((option = extractOption(&argc, argv, "period", true)))
+        periodNs = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "duration", true)))
+        duration = atof(option);
+    if ((option = extractOption(&argc, argv, "samples", true)))
+        numSamples = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "socket", true)))
+        socketPath = option;
+    for (size_t d = 0; d < demands.size(); d++)
+        valid &= demands[d] <= numThreads;
+    for (size_t c = 0; c < clientCounts.size(); c++)
+        valid &= clientCounts[c] >= 1;
+    if (!valid || argc != 1 || numThreads < 1 || periodNs < 1 ||
+        duration <= 0) {
+        printf("Usage: ./CoreRequest_Scalability [--clients \"N1 N2 ...\"] "
+               "[--threads N] [--demands \"D1 D2 ...\"] [--period NS] "
+               "[--duration SECONDS] [--samples N] [--socket PATH]\n"
+               "No demand may exceed the number of threads.\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    control = mapShared<Control>(1);
+    grantLatencies = new SampleBuffer(numSamples);
+    revocationLatencies = new SampleBuffer(numSamples);
+
+    printf("Clients,Threads,Cores,Demand Changes/s,Decisions/s,Grants,"
+           "50%% Grant,90%% Grant,99%% Grant,Max Grant,Revocations,"
+           "50%% Revocation,90%% Revocation,99%% Revocation,"
+           "Max Revocation\n");
+    for (size_t c = 0; c < clientCounts.size(); c++)
+        runClients(clientCounts[c]);
+
+    delete grantLatencies;
+    delete revocationLatencies;
+    unmapShared(control, 1);
+    return 0;
+}
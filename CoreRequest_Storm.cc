@@ -0,0 +1,424 @@
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <random>
+#include <thread>
+#include <vector>
+#include "ArbiterBenchmark.h"
+#include "BenchmarkOptions.h"
+#include "CoreArbiter/CoreArbiterClient.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+
+using CoreArbiter::CoreArbiterClient;
+using PerfUtils::Cycles;
+
+/**
+ * What each client publishes for the parent's monitor.
+ */
+struct ClientState {
+    // The number of cores the client last asked for.
+    std::atomic<uint64_t> demand;
+
+    // The number of the client's threads that hold cores.
+    std::atomic<uint64_t> holders;
+};
+
+/**
+ * What the clients share with the parent.
+ */
+struct Control : ClientControl {
+    // The number of cores the arbiter manages, as the parent found it before
+    // the run.
+    std::atomic<uint64_t> numCores;
+
+    // Totals over all clients.
+    std::atomic<uint64_t> requests;
+    std::atomic<uint64_t> coalesced;
+    std::atomic<uint64_t> dropped;
+    std::atomic<uint64_t> grants;
+    std::atomic<uint64_t> releases;
+
+    // The number of threads of all clients that hold each CPU, by the CPU
+    // each found itself on when it was granted a core; the number of CPUs
+    // that any thread holds, and the most that ever did.
+    std::atomic<uint32_t> holdersOnCpu[CPU_SETSIZE];
+    std::atomic<uint64_t> heldCpus;
+    std::atomic<uint64_t> maxHeldCpus;
+
+    // The number of threads that were moved off their core before they
+    // released it, and the number of grants that left a CPU with two
+    // holders, or more CPUs held than the arbiter manages.
+    std::atomic<uint64_t> forcedMoves;
+    std::atomic<uint64_t> violations;
+};
+
+size_t numClients = 8;
+size_t numThreads = 4;
+size_t numRequesters = 2;
+double requestsPerSecond = 1000;
+double duration = 5;
+uint64_t seed = 1;
+uint64_t monitorNs = 100000;
+
+// How long a thread that is granted a CPU that another thread still holds
+// waits for that thread to release it, in case the arbiter moved it off the
+// core before it noticed that it must release it.
+const uint64_t MOVE_GRACE_NS = 5000000;
+size_t numSamples = 1000000;
+const char* socketPath = DEFAULT_ARBITER_SOCKET;
+
+Control* control;
+ClientState* clientStates;
+
+// The cycles from a client's latest increase in demand to each grant of a
+// core it added, and from its latest decrease to each thread learning that
+// it must release its core.
+SampleBuffer* grantLatencies;
+SampleBuffer* releaseLatencies;
+
+// The state of the client this process is, once forked. pendingGrants and
+// pendingReleases count the cores still to be granted or released since the
+// latest change of demand, which was made at changeTime and asked for
+// changeSize cores in all; demandLock serializes the changes.
+CoreArbiterClient* client;
+ClientState* state;
+std::mutex demandLock;
+std::atomic<int64_t> pendingGrants(0);
+std::atomic<int64_t> pendingReleases(0);
+std::atomic<uint64_t> changeTime(0);
+int64_t changeSize = 0;
+
+/**
+ * Count the calling thread as holding the given CPU, which it has just been
+ * granted, and check that no other thread holds it and that no more CPUs are
+ * held than the arbiter has.
+ */
+void
+holdCpu(int cpu) {
+    if (++control->holdersOnCpu[cpu] == 1) {
+        uint64_t held = ++control->heldCpus;
+        uint64_t maxHeld = control->maxHeldCpus;
+        while (held > maxHeld &&
+               !control->maxHeldCpus.compare_exchange_weak(maxHeld, held)) {
+        }
+        if (held > control->numCores)
+            control->violations++;
+        return;
+    }
+
+    // The thread that held the CPU before may have been moved off it, and
+    // will release it once it notices; if it does not, it is still there,
+    // and the arbiter granted the core twice.
+    uint64_t deadline =
+        Cycles::rdtsc() + Cycles::fromNanoseconds(MOVE_GRACE_NS);
+    while (control->holdersOnCpu[cpu] > 1) {
+        if (Cycles::rdtsc() > deadline) {
+            control->violations++;
+            return;
+        }
+    }
+}
+
+/**
+ * Stop counting the calling thread as holding the given CPU.
+ */
+void
+releaseCpu(int cpu) {
+    if (--control->holdersOnCpu[cpu] == 0)
+        control->heldCpus--;
+}
+
+/**
+ * Counts and times the grants and releases of the cores that one of a
+ * client's threads holds, and checks which CPU it holds (see holdCores).
+ */
+struct Holder {
+    explicit Holder(size_t index) : cpu(-1) {}
+
+    void granted(uint64_t blockTime, uint64_t grantTime) {
+        control->grants++;
+        state->holders++;
+        if (takePending(&pendingGrants))
+            grantLatencies->record(grantTime - changeTime);
+        cpu = sched_getcpu();
+        if (cpu >= 0 && cpu < CPU_SETSIZE)
+            holdCpu(cpu);
+        else
+            cpu = -1;
+    }
+
+    /**
+     * The thread blocks, giving up its core, right after this, so it holds
+     * its CPU until then.
+     */
+    void released(uint64_t releaseTime) {
+        control->releases++;
+        if (takePending(&pendingReleases))
+            releaseLatencies->record(releaseTime - changeTime);
+        state->holders--;
+        if (cpu < 0)
+            return;
+        if (sched_getcpu() != cpu)
+            control->forcedMoves++;
+        releaseCpu(cpu);
+    }
+
+    // The CPU the thread was on when it was granted its core, or -1.
+    int cpu;
+};
+
+/**
+ * Ask the arbiter for a new number of cores, noting how many cores are now to
+ * be granted or released so that the threads can time them, and whether the
+ * change before was still pending.
+ */
+void
+changeDemand(uint32_t demand) {
+    std::lock_guard<std::mutex> guard(demandLock);
+    int64_t left = pendingGrants.exchange(0) + pendingReleases.exchange(0);
+    if (left > 0 && left == changeSize)
+        control->dropped++;
+    else if (left > 0)
+        control->coalesced++;
+
+    int64_t owned = client->getNumOwnedCores();
+    changeTime = Cycles::rdtsc();
+    if (demand > owned) {
+        changeSize = demand - owned;
+        pendingGrants = changeSize;
+    } else {
+        changeSize = owned - demand;
+        pendingReleases = changeSize;
+    }
+    state->demand = demand;
+    client->setRequestedCores(coresAtPriority(0, demand));
+    control->requests++;
+}
+
+/**
+ * The body of each of a client's threads that change its demand: at random
+ * times, ask for a random number of cores, until the run is over.
+ *
+ * \param threadSeed
+ *      Seeds the times and demands, so that they are the same each run.
+ */
+void
+requesterThread(uint64_t threadSeed) {
+    std::mt19937_64 generator(threadSeed);
+    std::exponential_distribution<double> interval(
+        requestsPerSecond / static_cast<double>(numRequesters));
+    std::uniform_int_distribution<uint32_t> demands(
+        0, static_cast<uint32_t>(numThreads));
+    uint64_t nextRequest = Cycles::rdtsc();
+    while (!control->stop) {
+        nextRequest += Cycles::fromSeconds(interval(generator));
+        sleepUntil(nextRequest);
+        changeDemand(demands(generator));
+    }
+}
+
+/**
+ * Run one client process until the run is over.
+ */
+void
+runClient(size_t index) {
+    client = CoreArbiterClient::getInstance(socketPath);
+    state = &clientStates[index];
+    startHolders<Holder>(control, client, numThreads);
+
+    std::vector<std::thread> requesters;
+    for (size_t r = 0; r < numRequesters; r++) {
+        requesters.push_back(
+            std::thread(requesterThread, seed + index * numRequesters + r));
+    }
+    for (size_t r = 0; r < numRequesters; r++)
+        requesters[r].join();
+}
+
+/**
+ * Print a histogram of grant and release latency, with buckets that double
+ * in width.
+ */
+void
+printHistogram() {
+    const size_t numBuckets = 40;
+    uint64_t grantCounts[numBuckets] = {};
+    uint64_t releaseCounts[numBuckets] = {};
+    SampleBuffer* buffers[] = {grantLatencies, releaseLatencies};
+    uint64_t* counts[] = {grantCounts, releaseCounts};
+    size_t usedBuckets = 0;
+    for (size_t b = 0; b < 2; b++) {
+        for (size_t i = 0; i < buffers[b]->size(); i++) {
+            uint64_t ns = Cycles::toNanoseconds(buffers[b]->data()[i]);
+            size_t bucket = 0;
+            while (ns > 0 && bucket < numBuckets - 1) {
+                ns >>= 1;
+                bucket++;
+            }
+            counts[b][bucket]++;
+            usedBuckets = std::max(usedBuckets, bucket + 1);
+        }
+    }
+    printf("\nLatency Below (ns),Grants,Releases\n");
+    for (size_t bucket = 0; bucket < usedBuckets; bucket++) {
+        printf("%lu,%lu,%lu\n", 1UL << bucket, grantCounts[bucket],
+               releaseCounts[bucket]);
+    }
+}
+
+/**
+ * This benchmark subjects the CoreArbiter to a storm of erratic requests for
+ * cores, to find where its throughput falls off and to check that it never
+ * hands out a core it does not have. It forks --clients client processes.
+ * Each has --threads threads that wait for a core from the arbiter, hold it
+ * until the arbiter asks for it back, and wait again, and --requesters
+ * threads that each ask the arbiter for a uniformly random number of cores,
+ * from 0 to --threads, at exponentially distributed intervals, so that each
+ * client makes --rate requests per second in all. The intervals and demands
+ * come from generators seeded from --seed, the client and the thread, so a
+ * run can be replayed with the same seed. The run lasts --duration seconds,
+ * and the arbiter must already be running on --socket.
+ *
+ * While the clients run, the benchmark looks every --monitor nanoseconds for
+ * cores that the arbiter leaves free while clients are asking for more than
+ * they hold. It prints a row with:
+ * - the requests made, and the requests that came while the one before was
+ *   still pending: Coalesced if the arbiter had acted on part of it, and
+ *   Dropped if it had not acted on any;
+ * - the grants and releases, and the distributions of grant and release
+ *   latency in nanoseconds, from the latest change of demand that asked for
+ *   them;
+ * - the fraction of monitor samples that found cores idle while demand was
+ *   unmet, and the core-seconds so idled;
+ * - the most CPUs that the threads held at once, Forced Moves, the number
+ *   of threads that the arbiter moved off their cores before they released
+ *   them, and Violations, the number of grants that left two threads
+ *   holding the same CPU, or more CPUs held than the arbiter manages.
+ * It then prints a histogram of the grant and release latencies, whose
+ * buckets double in width. At most --samples latencies of each kind are
+ * kept.
+ *
+ * Violations are checked by core identity: each thread that is granted a
+ * core holds the CPU it finds itself on, from then until just before it
+ * blocks to give the core up, so threads that the arbiter has moved off
+ * their cores are not counted as holding them once they notice. A thread
+ * granted a CPU that another still holds waits up to MOVE_GRACE_NS for that
+ * one to notice before counting a violation, so a core granted twice is only
+ * caught if both threads hold it for longer than that. The check sees only
+ * this benchmark's clients, not cores that other processes hold, and trusts
+ * the arbiter's count of its cores from before the run.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    if ((option = extractOption(&argc, argv, "clients", true)))
+        numClients = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "threads", true)))
+        numThreads = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "requesters", true)))
+        numRequesters = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "rate", true)))
+        requestsPerSecond = atof(option);
+    if ((option = extractOption(&argc, argv, "duration", true)))
+        duration = atof(option);
+    if ((option = extractOption(&argc, argv, "seed", true)))
+        seed = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "monitor", true)))
+        monitorNs = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "samples", true)))
+        numSamples = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "socket", true)))
+        socketPath = option;
+    if (argc != 1 || numClients < 1 || numThreads < 1 || numRequesters < 1 ||
+        requestsPerSecond <= 0 || duration <= 0 || monitorNs < 1) {
+        printf("Usage: ./CoreRequest_Storm [--clients N] [--threads N] "
+               "[--requesters N] [--rate REQUESTS_PER_SECOND] "
+               "[--duration SECONDS] [--seed N] [--monitor NS] "
+               "[--samples N] [--socket PATH]\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    control = mapShared<Control>(1);
+    clientStates = mapShared<ClientState>(numClients);
+    grantLatencies = new SampleBuffer(numSamples);
+    releaseLatencies = new SampleBuffer(numSamples);
+
+    std::vector<pid_t> pids = forkClients(numClients, runClient);
+
+    // The parent connects only after forking, so that the clients do not
+    // share its connection; it never asks for cores itself, and no client
+    // does before the run starts.
+    CoreArbiterClient* monitor = CoreArbiterClient::getInstance(socketPath);
+    control->numCores = monitor->getNumUnoccupiedCores();
+    startClients(control, numClients);
+    uint64_t startTime = Cycles::rdtsc();
+    uint64_t endTime = startTime + Cycles::fromSeconds(duration);
+    uint64_t monitorCycles = Cycles::fromNanoseconds(monitorNs);
+    uint64_t numMonitorSamples = 0;
+    uint64_t idleSamples = 0;
+    uint64_t idleCoreCycles = 0;
+    for (uint64_t next = startTime; next < endTime; next += monitorCycles) {
+        while (Cycles::rdtsc() < next) {
+        }
+        uint64_t unmet = 0;
+        for (size_t c = 0; c < numClients; c++) {
+            uint64_t demand = clientStates[c].demand;
+            uint64_t holders = clientStates[c].holders;
+            if (demand > holders)
+                unmet += demand - holders;
+        }
+        uint64_t idle = monitor->getNumUnoccupiedCores();
+        numMonitorSamples++;
+        if (idle > 0 && unmet > 0) {
+            idleSamples++;
+            idleCoreCycles += std::min(idle, unmet) * monitorCycles;
+        }
+    }
+    double elapsed = Cycles::toSeconds(Cycles::rdtsc() - startTime);
+    stopClients(control, pids);
+
+    printf("Clients,Cores,Requests/s,Coalesced,Dropped,Grants,50%% Grant,"
+           "90%% Grant,99%% Grant,Max Grant,Releases,50%% Release,"
+           "90%% Release,99%% Release,Max Release,Idle While Unmet,"
+           "Idle Core-Seconds,Max Held CPUs,Forced Moves,Violations\n");
+    printf("%zu,%lu,%.0lf,%lu,%lu,%lu", numClients, control->numCores.load(),
+           static_cast<double>(control->requests) / elapsed,
+           control->coalesced.load(), control->dropped.load(),
+           control->grants.load());
+    printPercentiles(grantLatencies->data(), grantLatencies->size());
+    printf(",%lu", control->releases.load());
+    printPercentiles(releaseLatencies->data(), releaseLatencies->size());
+    printf(",%.4lf,%.4lf,%lu,%lu,%lu\n",
+           static_cast<double>(idleSamples) /
+               static_cast<double>(std::max<uint64_t>(numMonitorSamples, 1)),
+           Cycles::toSeconds(idleCoreCycles), control->maxHeldCpus.load(),
+           control->forcedMoves.load(), control->violations.load());
+    printHistogram();
+
+    if (grantLatencies->getNumDropped() > 0 ||
+        releaseLatencies->getNumDropped() > 0) {
+        fprintf(stderr,
+                "%lu grant and %lu release samples did not fit in "
+                "--samples\n",
+                grantLatencies->getNumDropped(),
+                releaseLatencies->getNumDropped());
+    }
+    uint64_t violations = control->violations;
+    if (violations > 0) {
+        fprintf(stderr,
+                "The arbiter granted a core it did not have %lu times, "
+                "with %lu cores\n",
+                violations, control->numCores.load());
+    }
+    delete grantLatencies;
+    delete releaseLatencies;
+    unmapShared(clientStates, numClients);
+    unmapShared(control, 1);
+    return violations > 0 ? 1 : 0;
+}
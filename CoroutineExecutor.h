@@ -0,0 +1,252 @@
+#ifndef COROUTINE_EXECUTOR_H
+#define COROUTINE_EXECUTOR_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "LockFreeQueue.h"
+#include "ThreadExecutor.h"
+#include "PerfUtils/Cycles.h"
+
+/**
+ * A Coroutine is a stackless task: it keeps whatever it needs between steps
+ * in its own fields rather than on a stack, and runs one step each time it is
+ * resumed. This is what a compiler makes of a coroutine, written out by hand,
+ * so an in-flight task costs only the size of its object, and starting or
+ * resuming one is a virtual call rather than a context switch.
+ */
+class Coroutine {
+  public:
+    virtual ~Coroutine() {}
+
+    /**
+     * Run the coroutine until it completes or must wait.
+     *
+     * \return
+     *      0 if the coroutine has completed, or else the time, in cycles, at
+     *      which to resume it.
+     */
+    virtual uint64_t resume() = 0;
+};
+
+/**
+ * A CoroutineExecutor runs coroutines on a fixed number of kernel threads,
+ * each with a lock-free run queue of its own that submitted coroutines are
+ * spread over round robin. A coroutine that waits stays with the thread that
+ * started it, in a heap ordered by the time it resumes at, so that it never
+ * holds up the thread while it waits. It is named on the command line as
+ *
+ *     coroutine <threads> [<capacity>]
+ *
+ * where <capacity> is the number of coroutines the run queues hold in all
+ * (4096 unless given). A thread that finds nothing to run for a while parks
+ * until a coroutine is submitted to it or one of its waiting coroutines is
+ * due.
+ */
+class CoroutineExecutor : public ThreadExecutor {
+  public:
+    /**
+     * Create and start the executor that spec names.
+     *
+     * \return
+     *      NULL if spec does not name a coroutine executor, or its
+     *      parameters are malformed.
+     */
+    static CoroutineExecutor* create(const char* spec) {
+        char name[16];
+        unsigned long numThreads = 0;
+        unsigned long capacity = 4096;
+        if (sscanf(spec, "%15s %lu %lu", name, &numThreads, &capacity) < 2 ||
+            strcmp(name, "coroutine") != 0 || numThreads < 1 || capacity < 1)
+            return NULL;
+        return new CoroutineExecutor(numThreads, capacity);
+    }
+
+    CoroutineExecutor(size_t numThreads, size_t capacity)
+        : cores(), nextCore(0) {
+        size_t perCore = 2;
+        while (perCore * numThreads < capacity)
+            perCore *= 2;
+        for (size_t t = 0; t < numThreads; t++)
+            cores.push_back(new Core(perCore));
+        for (size_t t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(&CoroutineExecutor::work, this, t));
+    }
+
+    ~CoroutineExecutor() {
+        stop();
+        for (size_t c = 0; c < cores.size(); c++)
+            delete cores[c];
+    }
+
+    /**
+     * Run a task as a coroutine that completes in one step.
+     */
+    bool submit(const Task& task) {
+        FunctionCoroutine* coroutine = new FunctionCoroutine(task);
+        if (start(coroutine))
+            return true;
+        delete coroutine;
+        return false;
+    }
+
+    /**
+     * Start running a coroutine, which the executor deletes once it
+     * completes, unless the run queues have no room for it.
+     *
+     * \return
+     *      False if the coroutine was not accepted; the caller still owns it
+     *      and may try again.
+     */
+    bool start(Coroutine* coroutine) {
+        size_t first = nextCore.fetch_add(1, std::memory_order_relaxed);
+        for (size_t c = 0; c < cores.size(); c++) {
+            Core& core = *cores[(first + c) % cores.size()];
+            if (core.runQueue.push(coroutine)) {
+                // Either the thread sees the coroutine when it looks again
+                // under its lock, or this sees it parking.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (core.parked.load()) {
+                    std::lock_guard<std::mutex> guard(core.lock);
+                    core.unparked.notify_one();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void stop() {
+        for (size_t c = 0; c < cores.size(); c++) {
+            std::lock_guard<std::mutex> guard(cores[c]->lock);
+            cores[c]->stopping = true;
+            cores[c]->unparked.notify_one();
+        }
+        for (size_t t = 0; t < threads.size(); t++) {
+            if (threads[t].joinable())
+                threads[t].join();
+        }
+    }
+
+    const char* getName() const { return "coroutine"; }
+
+    size_t getReservedBytesPerTask() const { return sizeof(Coroutine*); }
+
+  private:
+    // The number of times a thread finds nothing to run before parking.
+    static const int SPINS_BEFORE_PARKING = 1000;
+
+    class FunctionCoroutine : public Coroutine {
+      public:
+        explicit FunctionCoroutine(const Task& task) : task(task) {}
+        uint64_t resume() {
+            run(task);
+            return 0;
+        }
+
+      private:
+        Task task;
+    };
+
+    // A waiting coroutine and the time it resumes at.
+    typedef std::pair<uint64_t, Coroutine*> Waiting;
+    typedef std::priority_queue<Waiting, std::vector<Waiting>,
+                                std::greater<Waiting>>
+        WaitingHeap;
+
+    // The run queue of one thread, and what it needs to park.
+    struct Core {
+        explicit Core(size_t size)
+            : runQueue(size),
+              lock(),
+              unparked(),
+              parked(false),
+              stopping(false) {}
+
+        LockFreeQueue<Coroutine*> runQueue;
+
+        // Guards stopping, and parking.
+        std::mutex lock;
+        std::condition_variable unparked;
+        std::atomic<bool> parked;
+
+        // Set once no more coroutines will be submitted; the thread exits
+        // once it has none left.
+        bool stopping;
+    };
+
+    /**
+     * Find the next coroutine for a thread to resume, parking while it has
+     * none.
+     *
+     * \return
+     *      False if the executor has stopped and the thread has nothing left
+     *      to run.
+     */
+    bool next(Core& core, WaitingHeap& waiting, Coroutine** coroutine) {
+        for (int spins = 0;; spins++) {
+            if (!waiting.empty() &&
+                waiting.top().first <= PerfUtils::Cycles::rdtsc()) {
+                *coroutine = waiting.top().second;
+                waiting.pop();
+                return true;
+            }
+            if (core.runQueue.pop(coroutine))
+                return true;
+            if (spins < SPINS_BEFORE_PARKING)
+                continue;
+            spins = 0;
+
+            std::unique_lock<std::mutex> guard(core.lock);
+            core.parked = true;
+            bool found = core.runQueue.pop(coroutine);
+            if (!found && waiting.empty()) {
+                if (core.stopping) {
+                    core.parked = false;
+                    return false;
+                }
+                core.unparked.wait(guard);
+            } else if (!found) {
+                uint64_t now = PerfUtils::Cycles::rdtsc();
+                if (waiting.top().first > now) {
+                    core.unparked.wait_for(
+                        guard, std::chrono::nanoseconds(
+                                   PerfUtils::Cycles::toNanoseconds(
+                                       waiting.top().first - now)));
+                }
+            }
+            core.parked = false;
+            if (found)
+                return true;
+        }
+    }
+
+    void work(size_t self) {
+        Core& core = *cores[self];
+        WaitingHeap waiting;
+        Coroutine* coroutine;
+        while (next(core, waiting, &coroutine)) {
+            uint64_t resumeTime = coroutine->resume();
+            if (resumeTime == 0)
+                delete coroutine;
+            else
+                waiting.push(Waiting(resumeTime, coroutine));
+        }
+    }
+
+    std::vector<Core*> cores;
+
+    // The core the next submitted coroutine is offered to first.
+    std::atomic<size_t> nextCore;
+};
+
+#endif  // COROUTINE_EXECUTOR_H
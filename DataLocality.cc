@@ -0,0 +1,328 @@
+#include <linux/perf_event.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include "BenchmarkOptions.h"
+#include "Arachne/Arachne.h"
+#include "Arachne/DefaultCorePolicy.h"
+#include "CoreArbiter/Logger.h"
+#include "PerfUtils/Cycles.h"
+#include "PerfUtils/Stats.h"
+
+using PerfUtils::Cycles;
+
+namespace Arachne {
+extern bool disableLoadEstimation;
+}
+
+/**
+ * How the requests of a session after its first are placed.
+ */
+enum Placement {
+    // createThread, which lets Arachne choose the core.
+    DEFAULT,
+
+    // createThreadOnCore, to the core that ran the session's last request.
+    AFFINITY
+};
+
+/**
+ * A session is a sequence of requests that each read and write the same
+ * buffer. Only one request of a session runs at a time; each one creates the
+ * next when it finishes.
+ */
+struct Session {
+    char* buffer;
+
+    // The Arachne core that ran the session's last request.
+    int lastCore;
+
+    // The number of requests the session has left to issue.
+    uint64_t remaining;
+};
+
+/**
+ * The measurements of one request.
+ */
+struct Sample {
+    // From the creation of the request's thread to the end of the request.
+    uint64_t latency;
+
+    // The time spent working on the session's buffer.
+    uint64_t workTime;
+
+    // The last-level cache references and misses while working on the buffer,
+    // or 0 if the counters are unavailable.
+    uint64_t cacheReferences;
+    uint64_t cacheMisses;
+
+    // True if the request ran on a different core than the session's last.
+    bool moved;
+};
+
+size_t numCores = 4;
+size_t numSessions = 64;
+size_t bufferSize = 256 << 10;
+uint64_t requestsPerRun = 200000;
+
+Placement placement;
+Session* sessions;
+
+// The Arachne core of each CPU the kernel threads run on, or -1.
+std::vector<int> coreOfCpu;
+
+// Samples are preallocated and handed out in order.
+std::vector<Sample> samples;
+std::atomic<uint64_t> nextSample;
+
+// Notified by each session once it has issued its last request.
+Arachne::Semaphore sessionsDone;
+
+// Set if any kernel thread could not open the cache counters.
+std::atomic<bool> countersUnavailable;
+
+/**
+ * Read the last-level cache references and misses of the calling kernel
+ * thread, opening the counters on first use.
+ *
+ * \return
+ *      False if the counters are unavailable.
+ */
+bool
+readCacheCounters(uint64_t* references, uint64_t* misses) {
+    static thread_local int groupFd = -2;
+    if (groupFd == -2) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PERF_TYPE_HARDWARE;
+        attr.config = PERF_COUNT_HW_CACHE_REFERENCES;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        groupFd = static_cast<int>(
+            syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0));
+        if (groupFd >= 0) {
+            attr.config = PERF_COUNT_HW_CACHE_MISSES;
+            if (syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0) < 0) {
+                close(groupFd);
+                groupFd = -1;
+            }
+        }
+        if (groupFd < 0)
+            countersUnavailable = true;
+    }
+    if (groupFd < 0)
+        return false;
+    // The group is read as its number of counters followed by their values.
+    uint64_t values[3];
+    if (read(groupFd, values, sizeof(values)) != sizeof(values))
+        return false;
+    *references = values[1];
+    *misses = values[2];
+    return true;
+}
+
+/**
+ * Record the Arachne core that the calling thread runs on.
+ */
+void
+recordCore(int core) {
+    coreOfCpu[sched_getcpu()] = core;
+}
+
+/**
+ * Serve one request of a session: read and write every cache line of its
+ * buffer, then create the session's next request.
+ */
+void
+serveRequest(Session* session, uint64_t creationTime) {
+    int core = coreOfCpu[sched_getcpu()];
+    uint64_t referencesBefore = 0, missesBefore = 0;
+    uint64_t referencesAfter = 0, missesAfter = 0;
+    bool counted = readCacheCounters(&referencesBefore, &missesBefore);
+    uint64_t startTime = Cycles::rdtsc();
+    for (size_t i = 0; i < bufferSize; i += 64)
+        session->buffer[i]++;
+    uint64_t endTime = Cycles::rdtsc();
+    counted = counted && readCacheCounters(&referencesAfter, &missesAfter);
+
+    uint64_t index = nextSample++;
+    if (index < samples.size()) {
+        Sample& sample = samples[index];
+        sample.latency = endTime - creationTime;
+        sample.workTime = endTime - startTime;
+        sample.cacheReferences = counted ? referencesAfter - referencesBefore
+                                         : 0;
+        sample.cacheMisses = counted ? missesAfter - missesBefore : 0;
+        sample.moved = session->lastCore >= 0 && session->lastCore != core;
+    }
+    session->lastCore = core;
+
+    if (session->remaining == 0) {
+        sessionsDone.notify();
+        return;
+    }
+    session->remaining--;
+    // Keep trying to create the next request until we succeed.
+    if (placement == AFFINITY) {
+        while (Arachne::createThreadOnCore(core, serveRequest, session,
+                                           Cycles::rdtsc()) ==
+               Arachne::NullThread)
+            ;
+    } else {
+        while (Arachne::createThread(serveRequest, session, Cycles::rdtsc()) ==
+               Arachne::NullThread)
+            ;
+    }
+}
+
+/**
+ * Run every session until requestsPerRun requests have completed, with the
+ * given placement, and print a row of results.
+ */
+void
+runPlacement(Placement mode) {
+    placement = mode;
+    nextSample = 0;
+    uint64_t requestsPerSession = requestsPerRun / numSessions;
+    for (size_t s = 0; s < numSessions; s++) {
+        sessions[s].lastCore = -1;
+        sessions[s].remaining = requestsPerSession - 1;
+    }
+    // The first request of each session goes to a core round robin in both
+    // runs, so the runs differ only in where later requests go.
+    for (size_t s = 0; s < numSessions; s++) {
+        while (Arachne::createThreadOnCore(
+                   static_cast<uint32_t>(s % numCores), serveRequest,
+                   &sessions[s], Cycles::rdtsc()) == Arachne::NullThread)
+            ;
+    }
+    for (size_t s = 0; s < numSessions; s++)
+        sessionsDone.wait();
+
+    uint64_t count = std::min<uint64_t>(nextSample, samples.size());
+    std::vector<uint64_t> latencies(count);
+    std::vector<uint64_t> workTimes(count);
+    uint64_t numMoved = 0;
+    uint64_t totalReferences = 0;
+    uint64_t totalMisses = 0;
+    for (uint64_t i = 0; i < count; i++) {
+        latencies[i] = samples[i].latency;
+        workTimes[i] = samples[i].workTime;
+        numMoved += samples[i].moved;
+        totalReferences += samples[i].cacheReferences;
+        totalMisses += samples[i].cacheMisses;
+    }
+    Statistics latencyStats = computeStatistics(latencies.data(), count);
+    Statistics workStats = computeStatistics(workTimes.data(), count);
+
+    printf("%s,%lu,%lf,%lu,%lu,%lu,%lu,%lu,%lu",
+           placement == AFFINITY ? "Affinity" : "Default", count,
+           static_cast<double>(numMoved) / static_cast<double>(count),
+           Cycles::toNanoseconds(latencyStats.median),
+           Cycles::toNanoseconds(latencyStats.P90),
+           Cycles::toNanoseconds(latencyStats.P99),
+           Cycles::toNanoseconds(latencyStats.max),
+           Cycles::toNanoseconds(workStats.median),
+           Cycles::toNanoseconds(workStats.P99));
+    if (countersUnavailable) {
+        printf(",NA,NA\n");
+    } else {
+        printf(",%lf,%lf\n",
+               static_cast<double>(totalReferences) /
+                   static_cast<double>(count),
+               static_cast<double>(totalMisses) / static_cast<double>(count));
+    }
+    fflush(stdout);
+}
+
+void
+runBenchmark() {
+    // Map each kernel thread's CPU to its Arachne core, so that a request can
+    // tell which core it runs on.
+    coreOfCpu.assign(std::thread::hardware_concurrency(), -1);
+    for (uint32_t i = 0; i < numCores; i++)
+        Arachne::join(Arachne::createThreadOnCore(i, recordCore, i));
+
+    sessions = new Session[numSessions];
+    for (size_t s = 0; s < numSessions; s++) {
+        sessions[s].buffer = new char[bufferSize];
+        memset(sessions[s].buffer, 0, bufferSize);
+    }
+    samples.resize(requestsPerRun);
+
+    printf("Placement,Requests,Moved,50%% Latency,90%%,99%%,Max,50%% Work,"
+           "99%% Work,Cache References/Request,Cache Misses/Request\n");
+    runPlacement(DEFAULT);
+    runPlacement(AFFINITY);
+    if (countersUnavailable) {
+        fprintf(stderr,
+                "Cache counters are unavailable; check "
+                "/proc/sys/kernel/perf_event_paranoid\n");
+    }
+
+    for (size_t s = 0; s < numSessions; s++)
+        delete[] sessions[s].buffer;
+    delete[] sessions;
+    Arachne::shutDown();
+}
+
+/**
+ * This benchmark measures what it costs to run a request on a different core
+ * than the one that last touched its data. Each of --sessions sessions owns a
+ * buffer of --bufferSize bytes, and issues requests one at a time that each
+ * read and write every cache line of the buffer. The benchmark runs twice on
+ * a fixed number of --cores cores: first with each request of a session after
+ * its first placed by Arachne (createThread), and then with each one created
+ * on the core of the session's previous request (createThreadOnCore). Each
+ * run has --requests requests.
+ *
+ * Each run prints the fraction of requests that ran on a different core than
+ * their session's previous request, the latency of requests from creation,
+ * the time spent on the buffer, and the last-level cache references and
+ * misses per request while on the buffer. The cache counters need
+ * perf_event_open, and are reported as NA without it. For the buffers to
+ * stay in a core's private caches between a session's requests, the buffers
+ * of all sessions on a core should fit in them.
+ */
+int
+main(int argc, const char** argv) {
+    const char* option;
+    if ((option = extractOption(&argc, argv, "cores", true)))
+        numCores = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "sessions", true)))
+        numSessions = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "bufferSize", true)))
+        bufferSize = strtoul(option, NULL, 0);
+    if ((option = extractOption(&argc, argv, "requests", true)))
+        requestsPerRun = strtoul(option, NULL, 0);
+    if (numCores < 1 || numSessions < 1 || requestsPerRun < numSessions) {
+        printf("Usage: ./DataLocality [--cores N] [--sessions N] "
+               "[--bufferSize BYTES] [--requests N]\n"
+               "There must be at least one request per session.\n");
+        exit(1);
+    }
+
+    CoreArbiter::Logger::setLogLevel(CoreArbiter::ERROR);
+    Arachne::Logger::setLogLevel(Arachne::ERROR);
+
+    // Keep the cores fixed so that the core of a session's last request
+    // remains valid, and so that both runs have the same cores.
+    Arachne::disableLoadEstimation = true;
+    Arachne::minNumCores = static_cast<int>(numCores);
+    Arachne::maxNumCores = static_cast<int>(numCores);
+    Arachne::setErrorStream(stderr);
+    Arachne::init(&argc, argv);
+
+    Arachne::createThread(runBenchmark);
+    Arachne::waitForTermination();
+    return 0;
+}
@@ -0,0 +1,142 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <stdint.h>
+#include <algorithm>
+#include <atomic>
+
+/**
+ * A log-linear histogram of latencies in the style of HdrHistogram. Values
+ * below 2^precision are counted exactly. Above that, each power-of-two range
+ * is split into 2^(precision - 1) equal buckets, so any percentile read back
+ * is within a relative error of 2^-(precision - 1) of the true value. The
+ * memory used depends only on the precision and the largest trackable value,
+ * never on the number of samples, so runs can be arbitrarily long.
+ *
+ * Recording is safe from any number of threads concurrently.
+ */
+class LatencyHistogram {
+  public:
+    /**
+     * \param precision
+     *      Number of bits of each value that are kept; between 1 and 20.
+     * \param maxValueBits
+     *      Values of 2^maxValueBits or more are counted in the last bucket.
+     *      The maximum is still tracked exactly.
+     */
+    explicit LatencyHistogram(int precision = 7, int maxValueBits = 40)
+        : precision(precision),
+          subBucketHalfCount(1UL << (precision - 1)),
+          numBuckets((1UL << precision) +
+                     static_cast<size_t>(maxValueBits - precision) *
+                         (1UL << (precision - 1))),
+          counts(new std::atomic<uint64_t>[numBuckets]),
+          maxValue(0) {
+        reset();
+    }
+
+    ~LatencyHistogram() { delete[] counts; }
+
+    /**
+     * Count one value. The maximum is updated before the count, so a reader
+     * that sees the count also sees the maximum.
+     */
+    void record(uint64_t value) {
+        uint64_t currentMax = maxValue.load(std::memory_order_relaxed);
+        while (value > currentMax &&
+               !maxValue.compare_exchange_weak(currentMax, value,
+                                               std::memory_order_relaxed))
+            ;
+        counts[bucketIndex(value)].fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Fold the counts of another histogram with the same shape into this one.
+     * Neither histogram may be recorded into concurrently.
+     */
+    void add(const LatencyHistogram& other) {
+        for (size_t i = 0; i < numBuckets; i++)
+            counts[i] += other.counts[i].load();
+        if (other.maxValue > maxValue)
+            maxValue = other.maxValue.load();
+    }
+
+    void reset() {
+        for (size_t i = 0; i < numBuckets; i++)
+            counts[i] = 0;
+        maxValue = 0;
+    }
+
+    /**
+     * Return the number of samples recorded. There is deliberately no shared
+     * running total, so that recording touches only one bucket.
+     */
+    uint64_t count() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < numBuckets; i++)
+            total += counts[i].load(std::memory_order_acquire);
+        return total;
+    }
+
+    uint64_t max() const { return maxValue; }
+
+    /**
+     * Return the value below which the given fraction of samples fall, using
+     * the same rank as PerfUtils computeStatistics (element count * fraction
+     * of the sorted samples). The result is the largest value in the bucket
+     * holding that sample, clamped to the maximum.
+     */
+    uint64_t percentile(double fraction) const {
+        uint64_t total = count();
+        if (total == 0)
+            return 0;
+        uint64_t rank =
+            static_cast<uint64_t>(static_cast<double>(total) * fraction) + 1;
+        if (rank > total)
+            rank = total;
+        uint64_t seen = 0;
+        for (size_t i = 0; i < numBuckets; i++) {
+            seen += counts[i].load(std::memory_order_relaxed);
+            if (seen >= rank)
+                return std::min(highestInBucket(i), maxValue.load());
+        }
+        return maxValue;
+    }
+
+    /**
+     * Return the number of bytes of counters this histogram uses.
+     */
+    size_t footprint() const { return numBuckets * sizeof(counts[0]); }
+
+  private:
+    size_t bucketIndex(uint64_t value) const {
+        if (value < 2 * subBucketHalfCount)
+            return value;
+        int msb = 63 - __builtin_clzl(value);
+        int shift = msb - (precision - 1);
+        size_t index = 2 * subBucketHalfCount +
+                       static_cast<size_t>(shift - 1) * subBucketHalfCount +
+                       ((value >> shift) - subBucketHalfCount);
+        return index < numBuckets ? index : numBuckets - 1;
+    }
+
+    uint64_t highestInBucket(size_t index) const {
+        if (index < 2 * subBucketHalfCount)
+            return index;
+        size_t offset = index - 2 * subBucketHalfCount;
+        int shift = static_cast<int>(offset / subBucketHalfCount) + 1;
+        uint64_t subBucket = subBucketHalfCount + offset % subBucketHalfCount;
+        return ((subBucket + 1) << shift) - 1;
+    }
+
+    int precision;
+    size_t subBucketHalfCount;
+    size_t numBuckets;
+    std::atomic<uint64_t>* counts;
+    std::atomic<uint64_t> maxValue;
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+};
+
+#endif  // LATENCY_HISTOGRAM_H
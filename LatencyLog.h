@@ -0,0 +1,447 @@
+#ifndef LATENCY_LOG_H
+#define LATENCY_LOG_H
+
+#include <dirent.h>
+#include <errno.h>
+#include <linux/mempolicy.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "Arachne/Arachne.h"
+#include "ChunkedArray.h"
+
+/**
+ * A LatencyLog records every latency, in cycles, without any state that is
+ * written by more than one kernel thread. Each kernel thread appends to a
+ * shard of its own, claimed on its first sample from shards that prepare
+ * creates before the load starts, one for each core. Samples are stored as
+ * 32-bit cycle deltas, half the size of the raw 64-bit latencies. A latency
+ * too long for 32 bits (over a second at typical clock rates) is saturated
+ * and counted.
+ *
+ * Recording never allocates, locks or makes a system call: a refill thread
+ * outside the benchmark's workers keeps a spare, faulted-in chunk ready for
+ * each shard, and a shard that fills its chunk before the spare is ready
+ * drops samples, which are counted, until it is. The only shared state read
+ * while recording is the current interval, which the dispatcher writes once
+ * per interval, after growing each shard's table of interval starts to hold
+ * it. Once recording has stopped, the shards are merged back together by
+ * interval.
+ *
+ * Every chunk of a shard is placed on the NUMA node of the kernel thread that
+ * owns the shard. prepare has a thread on each of Arachne's cores claim a
+ * shard and fault its first chunk and spare in itself, and the refill thread
+ * binds each later spare to the owner's node before faulting it in. Shards
+ * that kernel threads added during the run claim were faulted in by prepare
+ * without knowing their owner, so only their refills are placed.
+ */
+class LatencyLog {
+  public:
+    LatencyLog()
+        : hugePages(false),
+          currentInterval(0),
+          generation(1),
+          cpuNodes(),
+          shards(),
+          nextShard(0),
+          mutex(),
+          stopping(false),
+          refiller() {}
+
+    ~LatencyLog() { reset(); }
+
+    /**
+     * Back the shards with 2 MB huge pages if the kernel has any reserved,
+     * which saves TLB misses while recording. Falls back to normal pages.
+     */
+    void setHugePages(bool enable) { hugePages = enable; }
+
+    /**
+     * Create numShards shards, one for each core whose kernel thread may
+     * record, with their first chunks and spares mapped and faulted in, and
+     * start the refill thread. Each of Arachne's active cores claims a shard
+     * here, so Arachne must be initialized. This must be called before the
+     * load starts, and again after each reset. Intervals up to
+     * numIntervals - 1 may be started; the shards only make room for them as
+     * they are.
+     */
+    void prepare(size_t numShards, size_t numIntervals) {
+        if (cpuNodes.empty()) {
+            for (unsigned cpu = 0; cpu < std::thread::hardware_concurrency();
+                 cpu++)
+                cpuNodes.push_back(nodeOfCpu(cpu));
+        }
+        for (size_t i = 0; i < numShards; i++)
+            shards.push_back(new Shard(numIntervals));
+
+        // Wait with usleep rather than join, since this need not run on an
+        // Arachne thread.
+        std::atomic<uint32_t> numClaimed(0);
+        uint32_t numCores = Arachne::numActiveCores;
+        uint32_t numStarted = 0;
+        for (uint32_t core = 0; core < numCores; core++) {
+            if (Arachne::createThreadOnCore(core, claimShard, this,
+                                            &numClaimed) !=
+                Arachne::NullThread)
+                numStarted++;
+        }
+        while (numClaimed.load(std::memory_order_acquire) < numStarted)
+            usleep(REFILL_INTERVAL_US);
+        for (size_t i = 0; i < shards.size(); i++) {
+            if (shards[i]->chunks.empty())
+                addFirstChunk(shards[i]);
+        }
+        stopping = false;
+        refiller = std::thread(&LatencyLog::refill, this);
+    }
+
+    /**
+     * Attribute the samples recorded from now on to the given interval.
+     * Intervals must be started in increasing order.
+     */
+    void startInterval(size_t interval) {
+        for (size_t i = 0; i < shards.size(); i++)
+            shards[i]->intervalStarts.resize(interval + 1);
+        currentInterval.store(interval, std::memory_order_release);
+    }
+
+    void record(uint64_t latency) {
+        Shard* shard = localShard();
+        size_t interval = currentInterval.load(std::memory_order_acquire);
+        while (shard->numIntervalsSeen <= interval)
+            shard->intervalStarts[shard->numIntervalsSeen++] = shard->size;
+        if (shard->next == shard->chunkEnd) {
+            uint32_t* chunk =
+                shard->spare.exchange(NULL, std::memory_order_acquire);
+            if (!chunk) {
+                shard->numDropped++;
+                return;
+            }
+            shard->next = chunk;
+            shard->chunkEnd = chunk + CHUNK_SAMPLES;
+        }
+        if (latency > UINT32_MAX) {
+            latency = UINT32_MAX;
+            shard->numSaturated++;
+        }
+        *shard->next++ = static_cast<uint32_t>(latency);
+        shard->size++;
+    }
+
+    /**
+     * Return the number of samples recorded during the given interval.
+     * Recording must have stopped.
+     */
+    uint64_t count(size_t interval) const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < shards.size(); i++) {
+            uint64_t begin, end;
+            shards[i]->range(interval, &begin, &end);
+            total += end - begin;
+        }
+        return total;
+    }
+
+    /**
+     * Copy the samples of the given interval, in cycles, to out, which must
+     * have room for count(interval) of them. Recording must have stopped.
+     *
+     * \return
+     *      The number of samples copied.
+     */
+    uint64_t copyInterval(size_t interval, uint64_t* out) const {
+        std::lock_guard<std::mutex> guard(mutex);
+        uint64_t copied = 0;
+        for (size_t i = 0; i < shards.size(); i++) {
+            uint64_t begin, end;
+            shards[i]->range(interval, &begin, &end);
+            for (uint64_t j = begin; j < end; j++)
+                out[copied++] = shards[i]->chunks[j / CHUNK_SAMPLES]
+                                                 [j % CHUNK_SAMPLES];
+        }
+        return copied;
+    }
+
+    /**
+     * Return the number of latencies that did not fit in 32 bits.
+     */
+    uint64_t numSaturated() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < shards.size(); i++)
+            total += shards[i]->numSaturated;
+        return total;
+    }
+
+    /**
+     * Return the number of latencies that were dropped because a shard's
+     * spare chunk was not ready when it was needed.
+     */
+    uint64_t numDropped() const {
+        uint64_t total = 0;
+        for (size_t i = 0; i < shards.size(); i++)
+            total += shards[i]->numDropped;
+        return total;
+    }
+
+    /**
+     * Stop the refill thread, discard all samples and unmap the shards.
+     * Recording must have stopped; call prepare before recording again.
+     */
+    void reset() {
+        if (refiller.joinable()) {
+            stopping = true;
+            refiller.join();
+        }
+        for (size_t i = 0; i < shards.size(); i++) {
+            for (size_t j = 0; j < shards[i]->chunks.size(); j++)
+                munmap(shards[i]->chunks[j], CHUNK_BYTES);
+            delete shards[i];
+        }
+        shards.clear();
+        nextShard = 0;
+        generation++;
+        currentInterval = 0;
+    }
+
+  private:
+    // Shards grow in chunks of one huge page, so that a single fault maps a
+    // whole chunk when huge pages are in use.
+    static const size_t CHUNK_BYTES = 2 << 20;
+    static const size_t CHUNK_SAMPLES = CHUNK_BYTES / sizeof(uint32_t);
+
+    // How often the refill thread looks for shards that used their spare. A
+    // chunk holds half a million samples, so this leaves plenty of margin.
+    static const useconds_t REFILL_INTERVAL_US = 100;
+
+    struct Shard {
+        explicit Shard(size_t maxIntervals)
+            : next(NULL),
+              chunkEnd(NULL),
+              size(0),
+              numSaturated(0),
+              numDropped(0),
+              intervalStarts(),
+              numIntervalsSeen(0),
+              node(-1),
+              spare(NULL),
+              chunks() {
+            intervalStarts.setMaxSize(maxIntervals);
+            intervalStarts.resize(1);
+        }
+
+        /**
+         * Compute the range of sample indices in this shard that belong to
+         * the given interval. Samples are appended in interval order.
+         */
+        void range(size_t interval, uint64_t* begin, uint64_t* end) const {
+            if (interval >= numIntervalsSeen) {
+                *begin = *end = size;
+                return;
+            }
+            *begin = intervalStarts[interval];
+            *end = interval + 1 < numIntervalsSeen
+                       ? intervalStarts[interval + 1]
+                       : size;
+        }
+
+        // Where the next sample goes, and the end of the current chunk.
+        uint32_t* next;
+        uint32_t* chunkEnd;
+
+        uint64_t size;
+        uint64_t numSaturated;
+        uint64_t numDropped;
+
+        // Index of the first sample of each interval seen so far. This only
+        // grows, in startInterval, as the run reaches each interval, so that
+        // recording never allocates.
+        ChunkedArray<uint64_t> intervalStarts;
+        size_t numIntervalsSeen;
+
+        // The NUMA node of the kernel thread that claimed this shard, or -1
+        // if it is not yet claimed or the kernel does not say.
+        std::atomic<int> node;
+
+        // The chunk to switch to when the current one fills, or NULL until
+        // the refill thread maps one.
+        std::atomic<uint32_t*> spare;
+
+        // Every chunk mapped for this shard, in the order they are used;
+        // appended to under the log's mutex.
+        std::vector<uint32_t*> chunks;
+    };
+
+    /**
+     * Return the calling kernel thread's shard, claiming one of the prepared
+     * shards on its first sample.
+     */
+    Shard* localShard() {
+        static thread_local const LatencyLog* owner = NULL;
+        static thread_local uint64_t ownerGeneration = 0;
+        static thread_local Shard* shard = NULL;
+        if (owner != this || ownerGeneration != generation) {
+            size_t index = nextShard.fetch_add(1, std::memory_order_relaxed);
+            if (index >= shards.size()) {
+                fprintf(stderr,
+                        "More kernel threads recorded latencies than the %zu "
+                        "shards prepared\n",
+                        shards.size());
+                abort();
+            }
+            shard = shards[index];
+            owner = this;
+            ownerGeneration = generation;
+
+            // Only the first sample of each kernel thread gets here, and
+            // sched_getcpu is answered without a system call.
+            int cpu = sched_getcpu();
+            if (cpu >= 0 && static_cast<size_t>(cpu) < cpuNodes.size())
+                shard->node.store(cpuNodes[cpu], std::memory_order_relaxed);
+        }
+        return shard;
+    }
+
+    /**
+     * Return the NUMA node of the given CPU, from the nodeN link in its sysfs
+     * directory, or -1 if there is none.
+     */
+    static int nodeOfCpu(unsigned cpu) {
+        char path[64];
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%u", cpu);
+        DIR* dir = opendir(path);
+        if (!dir)
+            return -1;
+        int node = -1;
+        struct dirent* entry;
+        while (node < 0 && (entry = readdir(dir)) != NULL) {
+            if (sscanf(entry->d_name, "node%d", &node) != 1)
+                node = -1;
+        }
+        closedir(dir);
+        return node;
+    }
+
+    /**
+     * The body of the threads that prepare runs on each of Arachne's cores:
+     * claim a shard for this kernel thread and fault its first chunk and
+     * spare in from here, so that they are local to it.
+     */
+    static void claimShard(LatencyLog* log, std::atomic<uint32_t>* numClaimed) {
+        log->addFirstChunk(log->localShard());
+        numClaimed->fetch_add(1, std::memory_order_release);
+    }
+
+    /**
+     * Give a shard its first chunk to record into, and a spare.
+     */
+    void addFirstChunk(Shard* shard) {
+        uint32_t* chunk = mapChunk(shard->node.load(std::memory_order_relaxed));
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            shard->chunks.push_back(chunk);
+        }
+        shard->next = chunk;
+        shard->chunkEnd = chunk + CHUNK_SAMPLES;
+        addSpare(shard);
+    }
+
+    /**
+     * Map a chunk, prefer the given NUMA node for it unless that is -1, and
+     * fault it in, so that no faults are taken while recording into it.
+     */
+    uint32_t* mapChunk(int node) {
+        void* chunk = MAP_FAILED;
+        if (hugePages) {
+            chunk = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+            if (chunk == MAP_FAILED && hugePages.exchange(false)) {
+                fprintf(stderr,
+                        "No huge pages available for the latency log: %s; "
+                        "using normal pages\n",
+                        strerror(errno));
+            }
+        }
+        if (chunk == MAP_FAILED) {
+            chunk = mmap(NULL, CHUNK_BYTES, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        }
+        if (chunk == MAP_FAILED) {
+            fprintf(stderr, "Failed to allocate latency log: %s\n",
+                    strerror(errno));
+            exit(1);
+        }
+
+        // The policy has to be set before the first touch, so the chunk is
+        // faulted in here rather than with MAP_POPULATE. A failure only costs
+        // locality, so it is ignored.
+        if (node >= 0 && node < 64) {
+            unsigned long nodeMask = 1UL << node;
+            syscall(SYS_mbind, chunk, CHUNK_BYTES, MPOL_PREFERRED, &nodeMask,
+                    sizeof(nodeMask) * 8, 0);
+        }
+        memset(chunk, 0, CHUNK_BYTES);
+        return static_cast<uint32_t*>(chunk);
+    }
+
+    /**
+     * Map a spare chunk for a shard that has none, on its owner's node.
+     */
+    void addSpare(Shard* shard) {
+        uint32_t* chunk =
+            mapChunk(shard->node.load(std::memory_order_relaxed));
+        {
+            std::lock_guard<std::mutex> guard(mutex);
+            shard->chunks.push_back(chunk);
+        }
+        shard->spare.store(chunk, std::memory_order_release);
+    }
+
+    /**
+     * The body of the refill thread: give every shard that has used its
+     * spare a new one, until reset.
+     */
+    void refill() {
+        while (!stopping) {
+            for (size_t i = 0; i < shards.size(); i++) {
+                if (shards[i]->spare.load(std::memory_order_acquire) == NULL)
+                    addSpare(shards[i]);
+            }
+            usleep(REFILL_INTERVAL_US);
+        }
+    }
+
+    std::atomic<bool> hugePages;
+    std::atomic<size_t> currentInterval;
+
+    // Incremented by reset, so that kernel threads drop their old shards.
+    uint64_t generation;
+
+    // The NUMA node of each CPU, or -1 if the kernel does not say, read once
+    // by the first prepare.
+    std::vector<int> cpuNodes;
+
+    // The shards created by prepare, and the next one to be claimed.
+    std::vector<Shard*> shards;
+    std::atomic<size_t> nextShard;
+
+    // Guards the chunks of every shard.
+    mutable std::mutex mutex;
+
+    // Set by reset to stop the refill thread.
+    std::atomic<bool> stopping;
+    std::thread refiller;
+
+    LatencyLog(const LatencyLog&) = delete;
+    LatencyLog& operator=(const LatencyLog&) = delete;
+};
+
+#endif  // LATENCY_LOG_H
@@ -0,0 +1,402 @@
+#ifndef LOAD_PROFILE_H
+#define LOAD_PROFILE_H
+
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "ServiceTime.h"
+
+/**
+ * A LoadProfile describes how offered load changes over a run as a short
+ * list of shapes, instead of one line per interval as in a .bench file. Each
+ * line of a profile is one of
+ *
+ *     resolution <time>
+ *     step    <time> <load> <service>
+ *     ramp    <time> <from> <to> <service>
+ *     sine    <time> <mean> <amplitude> <period> <service>
+ *     square  <time> <low> <high> <period> <fraction_high> <service>
+ *     diurnal <time> <trough> <peak> <period> <service>
+ *     repeat  <count>
+ *     end
+ *
+ * Times take a unit of ns, us, ms, s, m, h or d, and are in nanoseconds
+ * without one. The load is whatever the benchmark offers (creations per
+ * second, or cores of load). <service> is the thread duration, optionally
+ * followed by a distribution as in a .bench line (see ServiceTime.h). The
+ * lines between repeat and its matching end run <count> times, and repeats
+ * may nest. '#' starts a comment.
+ *
+ * A step and each phase of a square wave become one interval. Ramps, sines
+ * and diurnal curves are sampled at the load midway through each interval of
+ * the current resolution (1 s unless set). A diurnal curve starts at its
+ * trough and peaks halfway through each period.
+ *
+ * Intervals are produced one at a time as the run reaches them, so a profile
+ * of a few lines can describe millions of intervals without materializing
+ * them up front.
+ */
+class LoadProfile {
+  public:
+    /**
+     * One interval of load produced by a profile.
+     */
+    struct Interval {
+        uint64_t timeToRun;
+        double load;
+        uint64_t durationPerThread;
+        ServiceTime serviceTime;
+    };
+
+    /**
+     * Parse the profile in the given file. Errors are reported with the line
+     * they occur on, and exit.
+     */
+    explicit LoadProfile(const char* path)
+        : segments(),
+          variableServiceTimes(false),
+          cursor(0),
+          elapsed(0),
+          repeats() {
+        FILE* file = fopen(path, "r");
+        if (!file) {
+            fprintf(stderr, "Error opening load profile %s: %s\n", path,
+                    strerror(errno));
+            exit(1);
+        }
+        uint64_t resolution = 1000000000;
+        std::vector<size_t> openRepeats;
+        char line[1024];
+        for (int lineNumber = 1; fgets(line, sizeof(line), file);
+             lineNumber++) {
+            char* comment = strchr(line, '#');
+            if (comment)
+                *comment = '\0';
+            char keyword[16];
+            int offset;
+            if (sscanf(line, "%15s%n", keyword, &offset) != 1)
+                continue;
+            const char* rest = line + offset;
+
+            Segment segment;
+            segment.resolution = resolution;
+            segment.count = 0;
+            segment.match = 0;
+            bool ok;
+            if (strcmp(keyword, "resolution") == 0) {
+                ok = nextTime(&rest, &resolution) && resolution > 0;
+                if (ok)
+                    continue;
+            } else if (strcmp(keyword, "repeat") == 0) {
+                segment.shape = REPEAT;
+                ok = sscanf(rest, "%lu", &segment.count) == 1;
+                openRepeats.push_back(segments.size());
+            } else if (strcmp(keyword, "end") == 0) {
+                segment.shape = END;
+                ok = !openRepeats.empty();
+                if (ok) {
+                    segment.match = openRepeats.back();
+                    segments[openRepeats.back()].match = segments.size();
+                    openRepeats.pop_back();
+                }
+            } else {
+                ok = parseShape(keyword, rest, &segment);
+            }
+            if (!ok) {
+                fprintf(stderr, "Error in load profile %s, line %d: %s", path,
+                        lineNumber, line);
+                exit(1);
+            }
+            segments.push_back(segment);
+        }
+        fclose(file);
+        if (!openRepeats.empty()) {
+            fprintf(stderr, "Load profile %s has a repeat without an end\n",
+                    path);
+            exit(1);
+        }
+    }
+
+    /**
+     * Return the number of intervals the profile will produce, without
+     * producing them.
+     */
+    size_t numIntervals() const {
+        return countIntervals(0, segments.size());
+    }
+
+    /**
+     * Return true if any interval has a service time that is not fixed.
+     */
+    bool hasVariableServiceTimes() const { return variableServiceTimes; }
+
+    /**
+     * Produce the next interval of the profile.
+     *
+     * \return
+     *      False once the profile is exhausted.
+     */
+    bool next(Interval* interval) {
+        while (cursor < segments.size()) {
+            const Segment& segment = segments[cursor];
+            if (segment.shape == REPEAT) {
+                if (segment.count == 0) {
+                    cursor = segment.match + 1;
+                } else {
+                    repeats.push_back(segment.count);
+                    cursor++;
+                }
+                continue;
+            }
+            if (segment.shape == END) {
+                if (--repeats.back() > 0) {
+                    cursor = segment.match + 1;
+                } else {
+                    repeats.pop_back();
+                    cursor++;
+                }
+                continue;
+            }
+            if (elapsed >= segment.duration) {
+                elapsed = 0;
+                cursor++;
+                continue;
+            }
+
+            uint64_t length = segment.resolution;
+            double load;
+            switch (segment.shape) {
+                case STEP:
+                    length = segment.duration;
+                    load = segment.from;
+                    break;
+                case SQUARE: {
+                    uint64_t phase = elapsed % segment.period;
+                    if (phase < segment.highTime) {
+                        length = segment.highTime - phase;
+                        load = segment.to;
+                    } else {
+                        length = segment.period - phase;
+                        load = segment.from;
+                    }
+                    break;
+                }
+                default:
+                    length = std::min(length, segment.duration - elapsed);
+                    load = sample(segment, static_cast<double>(elapsed) +
+                                               static_cast<double>(length) / 2);
+                    break;
+            }
+            length = std::min(length, segment.duration - elapsed);
+            elapsed += length;
+
+            interval->timeToRun = length;
+            interval->load = load;
+            interval->durationPerThread = segment.serviceTime.duration;
+            interval->serviceTime = segment.serviceTime;
+            return true;
+        }
+        return false;
+    }
+
+  private:
+    enum Shape { STEP, RAMP, SINE, SQUARE, DIURNAL, REPEAT, END };
+
+    struct Segment {
+        Shape shape;
+        uint64_t duration;
+
+        // The interval length that continuous shapes are sampled at.
+        uint64_t resolution;
+
+        // The load of a step, the start of a ramp, the mean of a sine, the
+        // low phase of a square wave, or the trough of a diurnal curve.
+        double from;
+
+        // The end of a ramp, the amplitude of a sine, the high phase of a
+        // square wave, or the peak of a diurnal curve.
+        double to;
+
+        uint64_t period;
+
+        // How long each period of a square wave spends in its high phase.
+        uint64_t highTime;
+
+        ServiceTime serviceTime;
+
+        // The number of times a repeat runs its body.
+        uint64_t count;
+
+        // The index of the matching end of a repeat, or vice versa.
+        size_t match;
+    };
+
+    /**
+     * Parse the parameters of a shape, which start at rest.
+     */
+    bool parseShape(const char* keyword, const char* rest, Segment* segment) {
+        bool ok;
+        if (strcmp(keyword, "step") == 0) {
+            segment->shape = STEP;
+            ok = nextTime(&rest, &segment->duration) &&
+                 nextNumber(&rest, &segment->from);
+        } else if (strcmp(keyword, "ramp") == 0) {
+            segment->shape = RAMP;
+            ok = nextTime(&rest, &segment->duration) &&
+                 nextNumber(&rest, &segment->from) &&
+                 nextNumber(&rest, &segment->to);
+        } else if (strcmp(keyword, "sine") == 0) {
+            segment->shape = SINE;
+            ok = nextTime(&rest, &segment->duration) &&
+                 nextNumber(&rest, &segment->from) &&
+                 nextNumber(&rest, &segment->to) &&
+                 nextTime(&rest, &segment->period) && segment->period > 0 &&
+                 segment->to <= segment->from;
+        } else if (strcmp(keyword, "square") == 0) {
+            double fractionHigh;
+            segment->shape = SQUARE;
+            ok = nextTime(&rest, &segment->duration) &&
+                 nextNumber(&rest, &segment->from) &&
+                 nextNumber(&rest, &segment->to) &&
+                 nextTime(&rest, &segment->period) &&
+                 nextNumber(&rest, &fractionHigh);
+            if (ok) {
+                segment->highTime = static_cast<uint64_t>(
+                    static_cast<double>(segment->period) * fractionHigh);
+                ok = segment->highTime > 0 &&
+                     segment->highTime < segment->period;
+            }
+        } else if (strcmp(keyword, "diurnal") == 0) {
+            segment->shape = DIURNAL;
+            ok = nextTime(&rest, &segment->duration) &&
+                 nextNumber(&rest, &segment->from) &&
+                 nextNumber(&rest, &segment->to) &&
+                 nextTime(&rest, &segment->period) && segment->period > 0;
+        } else {
+            return false;
+        }
+        uint64_t durationPerThread;
+        if (!ok || !nextTime(&rest, &durationPerThread) ||
+            !parseServiceTime(rest, durationPerThread,
+                              &segment->serviceTime))
+            return false;
+        if (segment->serviceTime.type != ServiceTime::FIXED)
+            variableServiceTimes = true;
+        return true;
+    }
+
+    /**
+     * Parse the next token of a line as a time with an optional unit, in
+     * nanoseconds, and advance past it.
+     */
+    static bool nextTime(const char** rest, uint64_t* nanoseconds) {
+        static const std::pair<const char*, double> units[] = {
+            {"", 1},       {"ns", 1},      {"us", 1e3},     {"ms", 1e6},
+            {"s", 1e9},    {"m", 60e9},    {"h", 3600e9},   {"d", 86400e9}};
+        char token[32];
+        int offset;
+        if (sscanf(*rest, "%31s%n", token, &offset) != 1)
+            return false;
+        char* unit;
+        double value = strtod(token, &unit);
+        if (unit == token || value < 0)
+            return false;
+        for (size_t i = 0; i < sizeof(units) / sizeof(units[0]); i++) {
+            if (strcmp(unit, units[i].first) == 0) {
+                *nanoseconds = static_cast<uint64_t>(value * units[i].second);
+                *rest += offset;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    /**
+     * Parse the next token of a line as a number and advance past it.
+     */
+    static bool nextNumber(const char** rest, double* value) {
+        int offset;
+        if (sscanf(*rest, "%lf%n", value, &offset) != 1)
+            return false;
+        *rest += offset;
+        return true;
+    }
+
+    /**
+     * Return the load of a continuous shape at the given time since the
+     * start of the segment.
+     */
+    static double sample(const Segment& segment, double time) {
+        double phase = 0;
+        if (segment.period > 0)
+            phase = 2 * M_PI * time / static_cast<double>(segment.period);
+        switch (segment.shape) {
+            case RAMP:
+                return segment.from + (segment.to - segment.from) * time /
+                                          static_cast<double>(segment.duration);
+            case SINE:
+                return segment.from + segment.to * sin(phase);
+            case DIURNAL:
+                return segment.from +
+                       (segment.to - segment.from) * (1 - cos(phase)) / 2;
+            default:
+                return segment.from;
+        }
+    }
+
+    /**
+     * Return the number of intervals produced by segments [begin, end).
+     */
+    size_t countIntervals(size_t begin, size_t end) const {
+        size_t total = 0;
+        for (size_t i = begin; i < end; i++) {
+            const Segment& segment = segments[i];
+            switch (segment.shape) {
+                case REPEAT:
+                    total += segment.count *
+                             countIntervals(i + 1, segment.match);
+                    i = segment.match;
+                    break;
+                case END:
+                    break;
+                case STEP:
+                    total += segment.duration > 0;
+                    break;
+                case SQUARE: {
+                    // Two phases per full period, and one or two for the
+                    // partial period at the end.
+                    uint64_t remainder = segment.duration % segment.period;
+                    total += 2 * (segment.duration / segment.period);
+                    if (remainder > 0)
+                        total += remainder > segment.highTime ? 2 : 1;
+                    break;
+                }
+                default:
+                    total += (segment.duration + segment.resolution - 1) /
+                             segment.resolution;
+                    break;
+            }
+        }
+        return total;
+    }
+
+    std::vector<Segment> segments;
+    bool variableServiceTimes;
+
+    // The segment being expanded, and how far into it the next interval
+    // starts.
+    size_t cursor;
+    uint64_t elapsed;
+
+    // The iterations left in each repeat that is being expanded, innermost
+    // last.
+    std::vector<uint64_t> repeats;
+};
+
+#endif  // LOAD_PROFILE_H
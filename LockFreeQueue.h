@@ -0,0 +1,109 @@
+#ifndef LOCK_FREE_QUEUE_H
+#define LOCK_FREE_QUEUE_H
+
+#include <stddef.h>
+#include <atomic>
+
+/**
+ * A LockFreeQueue is a bounded FIFO that any number of threads may push to
+ * and pop from without locks, so it works for kernel threads and Arachne
+ * threads alike. Each slot of its ring carries a sequence number that says
+ * whether the slot is ready to be written or read in the current lap of the
+ * ring (Vyukov's design). Neither push nor pop ever waits: they fail when
+ * the queue is full or empty.
+ */
+template <typename T>
+class LockFreeQueue {
+  public:
+    /**
+     * \param size
+     *      The number of items the queue holds, which must be a power of two.
+     */
+    explicit LockFreeQueue(size_t size)
+        : slots(new Slot[size]),
+          mask(size - 1),
+          tailPadding(),
+          tail(0),
+          headPadding(),
+          head(0) {
+        for (size_t i = 0; i < size; i++)
+            slots[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~LockFreeQueue() { delete[] slots; }
+
+    /**
+     * Add an item to the back of the queue.
+     *
+     * \return
+     *      False if the queue was full.
+     */
+    bool push(const T& item) {
+        size_t position = tail.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == position) {
+                if (tail.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+                    slot.item = item;
+                    slot.sequence.store(position + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position) {
+                return false;
+            } else {
+                position = tail.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    /**
+     * Remove the item at the front of the queue into item.
+     *
+     * \return
+     *      False if the queue was empty.
+     */
+    bool pop(T* item) {
+        size_t position = head.load(std::memory_order_relaxed);
+        for (;;) {
+            Slot& slot = slots[position & mask];
+            size_t sequence = slot.sequence.load(std::memory_order_acquire);
+            if (sequence == position + 1) {
+                if (head.compare_exchange_weak(position, position + 1,
+                                               std::memory_order_relaxed)) {
+                    *item = slot.item;
+                    slot.sequence.store(position + mask + 1,
+                                        std::memory_order_release);
+                    return true;
+                }
+            } else if (sequence < position + 1) {
+                return false;
+            } else {
+                position = head.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+  private:
+    struct Slot {
+        std::atomic<size_t> sequence;
+        T item;
+    };
+
+    Slot* slots;
+    size_t mask;
+
+    // Producers and consumers work at opposite ends of the ring, so the
+    // ends are kept on separate cache lines.
+    char tailPadding[64];
+    std::atomic<size_t> tail;
+    char headPadding[64 - sizeof(std::atomic<size_t>)];
+    std::atomic<size_t> head;
+
+    LockFreeQueue(const LockFreeQueue&) = delete;
+    LockFreeQueue& operator=(const LockFreeQueue&) = delete;
+};
+
+#endif  // LOCK_FREE_QUEUE_H
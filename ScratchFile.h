@@ -0,0 +1,183 @@
+#ifndef SCRATCH_FILE_H
+#define SCRATCH_FILE_H
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <string>
+
+/**
+ * A ScratchFile is a local file that synthetic requests do blocking I/O on,
+ * with system calls that stall the calling kernel thread. It supports three
+ * kinds of access:
+ *
+ *     read    a 4 KB pread of a file that is kept in the page cache
+ *     direct  a 4 KB pread with O_DIRECT, which bypasses the page cache and
+ *             goes to the device
+ *     fsync   a small append to a log file, followed by fsync
+ *
+ * The file is created, filled and read into the page cache when the
+ * ScratchFile is constructed, and both files are removed when it is
+ * destroyed.
+ */
+class ScratchFile {
+  public:
+    enum Access { READ, DIRECT, FSYNC };
+
+    /**
+     * Parse the name of an access.
+     *
+     * \return
+     *      False if the name is unknown.
+     */
+    static bool parseAccess(const char* name, Access* access) {
+        if (strcmp(name, "read") == 0)
+            *access = READ;
+        else if (strcmp(name, "direct") == 0)
+            *access = DIRECT;
+        else if (strcmp(name, "fsync") == 0)
+            *access = FSYNC;
+        else
+            return false;
+        return true;
+    }
+
+    /**
+     * \param path
+     *      The file to read; the log file is this path with ".log" appended.
+     * \param size
+     *      The size of the file to read, in bytes.
+     */
+    ScratchFile(const char* path, size_t size)
+        : path(path),
+          logPath(std::string(path) + ".log"),
+          numBlocks(size / BLOCK_BYTES),
+          fd(-1),
+          directFd(-1),
+          logFd(-1) {
+        if (numBlocks == 0) {
+            fprintf(stderr, "Scratch file %s must be at least %zd bytes\n",
+                    path, BLOCK_BYTES);
+            exit(1);
+        }
+        fd = open(path, O_RDWR | O_CREAT | O_TRUNC, 0600);
+        if (fd < 0)
+            fail("creating", path);
+        char* block = alignedBlock();
+        for (size_t i = 0; i < numBlocks; i++) {
+            memset(block, static_cast<int>(i), BLOCK_BYTES);
+            if (write(fd, block, BLOCK_BYTES) != BLOCK_BYTES)
+                fail("filling", path);
+        }
+        if (fsync(fd) != 0)
+            fail("syncing", path);
+
+        // Reading the file back brings it into the page cache for READ.
+        for (size_t i = 0; i < numBlocks; i++) {
+            if (pread(fd, block, BLOCK_BYTES,
+                      static_cast<off_t>(i * BLOCK_BYTES)) != BLOCK_BYTES)
+                fail("reading", path);
+        }
+        free(block);
+
+        directFd = open(path, O_RDONLY | O_DIRECT);
+        if (directFd < 0)
+            fail("opening with O_DIRECT", path);
+        logFd = open(logPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                     0600);
+        if (logFd < 0)
+            fail("creating", logPath.c_str());
+    }
+
+    ~ScratchFile() {
+        close(fd);
+        close(directFd);
+        close(logFd);
+        unlink(path.c_str());
+        unlink(logPath.c_str());
+    }
+
+    /**
+     * Do one access of the given kind, blocking the calling kernel thread.
+     *
+     * \param access
+     *      The kind of access.
+     * \param seed
+     *      Any value that differs between accesses; it chooses the block
+     *      that is read.
+     */
+    void access(Access access, uint64_t seed) {
+        // A buffer per kernel thread is enough, since the kernel thread does
+        // nothing else until the system call returns. It is freed when the
+        // thread exits, for threads that only live for one request.
+        static thread_local ThreadBuffer buffer;
+        char* block = buffer.block;
+        off_t offset = static_cast<off_t>(
+            ((seed * 0x9E3779B97F4A7C15UL) >> 16) % numBlocks * BLOCK_BYTES);
+        ssize_t result;
+        switch (access) {
+            case READ:
+                result = pread(fd, block, BLOCK_BYTES, offset);
+                break;
+            case DIRECT:
+                result = pread(directFd, block, BLOCK_BYTES, offset);
+                break;
+            case FSYNC:
+                result = write(logFd, block, LOG_RECORD_BYTES);
+                if (result == LOG_RECORD_BYTES && fsync(logFd) != 0)
+                    result = -1;
+                break;
+            default:
+                result = -1;
+                break;
+        }
+        if (result < 0)
+            fail("accessing", path.c_str());
+    }
+
+  private:
+    // The size of each read, and of the blocks O_DIRECT must be aligned to.
+    static const ssize_t BLOCK_BYTES = 4096;
+
+    // The size of each append to the log.
+    static const ssize_t LOG_RECORD_BYTES = 128;
+
+    static char* alignedBlock() {
+        void* block;
+        if (posix_memalign(&block, BLOCK_BYTES, BLOCK_BYTES) != 0) {
+            fprintf(stderr, "Failed to allocate an I/O buffer\n");
+            exit(1);
+        }
+        return static_cast<char*>(block);
+    }
+
+    struct ThreadBuffer {
+        ThreadBuffer() : block(alignedBlock()) {}
+        ~ThreadBuffer() { free(block); }
+        char* block;
+    };
+
+    static void fail(const char* action, const char* file) {
+        fprintf(stderr, "Error %s scratch file %s: %s\n", action, file,
+                strerror(errno));
+        exit(1);
+    }
+
+    std::string path;
+    std::string logPath;
+    size_t numBlocks;
+
+    // The file opened normally and with O_DIRECT, and the log.
+    int fd;
+    int directFd;
+    int logFd;
+
+    ScratchFile(const ScratchFile&) = delete;
+    ScratchFile& operator=(const ScratchFile&) = delete;
+};
+
+#endif  // SCRATCH_FILE_H
@@ -0,0 +1,175 @@
+#ifndef SERVICE_TIME_H
+#define SERVICE_TIME_H
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <random>
+#include "PerfUtils/Cycles.h"
+
+/**
+ * The distribution that the service time of each thread in an interval is
+ * drawn from. A .bench line may follow its thread duration with one of
+ *
+ *     fixed
+ *     exponential
+ *     bimodal <fraction_of_long_requests> <long_duration_in_ns>
+ *     lognormal <sigma>
+ *     pareto <alpha>
+ *
+ * For exponential, lognormal and pareto, the thread duration on the line is
+ * the mean service time. For bimodal, it is the duration of the common short
+ * requests, so "1000 bimodal 0.01 100000" means 99% 1us and 1% 100us.
+ */
+struct ServiceTime {
+    enum Type { FIXED, EXPONENTIAL, BIMODAL, LOGNORMAL, PARETO } type;
+
+    // Mean service time in nanoseconds, or the short duration for BIMODAL.
+    uint64_t duration;
+
+    // Fraction of long requests for BIMODAL, sigma for LOGNORMAL and alpha
+    // for PARETO. Unused otherwise.
+    double shape;
+
+    // Duration of the long requests in nanoseconds, for BIMODAL only.
+    uint64_t longDuration;
+};
+
+/**
+ * Parse the optional distribution that follows the thread duration on a
+ * .bench line. An empty spec means a fixed service time.
+ *
+ * \return
+ *      False if the distribution is unknown or its parameters are invalid.
+ */
+inline bool
+parseServiceTime(const char* spec, uint64_t duration,
+                 ServiceTime* serviceTime) {
+    serviceTime->type = ServiceTime::FIXED;
+    serviceTime->duration = duration;
+    serviceTime->shape = 0;
+    serviceTime->longDuration = 0;
+
+    char name[32];
+    if (sscanf(spec, "%31s", name) != 1 || strcmp(name, "fixed") == 0)
+        return true;
+    if (strcmp(name, "exponential") == 0) {
+        serviceTime->type = ServiceTime::EXPONENTIAL;
+        return true;
+    }
+    if (strcmp(name, "bimodal") == 0) {
+        serviceTime->type = ServiceTime::BIMODAL;
+        return sscanf(spec, "%*s %lf %lu", &serviceTime->shape,
+                      &serviceTime->longDuration) == 2 &&
+               serviceTime->shape >= 0 && serviceTime->shape <= 1;
+    }
+    if (strcmp(name, "lognormal") == 0) {
+        serviceTime->type = ServiceTime::LOGNORMAL;
+        return sscanf(spec, "%*s %lf", &serviceTime->shape) == 1 &&
+               serviceTime->shape > 0;
+    }
+    if (strcmp(name, "pareto") == 0) {
+        // The mean is only finite for alpha > 1.
+        serviceTime->type = ServiceTime::PARETO;
+        return sscanf(spec, "%*s %lf", &serviceTime->shape) == 1 &&
+               serviceTime->shape > 1;
+    }
+    return false;
+}
+
+/**
+ * Draws service times, in cycles, from a ServiceTime distribution. The random
+ * number generator is supplied by the caller, so that the draws can share a
+ * stream with arrival times. Fixed service times draw nothing from it.
+ */
+class ServiceTimeGenerator {
+  public:
+    ServiceTimeGenerator()
+        : type(ServiceTime::FIXED),
+          fixedCycles(0),
+          longCycles(0),
+          longFraction(0),
+          uniform(0.0, 1.0),
+          exponential(),
+          lognormal(),
+          paretoScale(0),
+          paretoExponent(0),
+          cyclesPerNanosecond(PerfUtils::Cycles::perSecond() * 1e-9) {}
+
+    void setDistribution(const ServiceTime& serviceTime) {
+        type = serviceTime.type;
+        fixedCycles = PerfUtils::Cycles::fromNanoseconds(serviceTime.duration);
+        double mean = static_cast<double>(serviceTime.duration);
+        switch (type) {
+            case ServiceTime::FIXED:
+                break;
+            case ServiceTime::EXPONENTIAL:
+                exponential.param(
+                    std::exponential_distribution<double>::param_type(1.0 /
+                                                                      mean));
+                break;
+            case ServiceTime::BIMODAL:
+                longFraction = serviceTime.shape;
+                longCycles = PerfUtils::Cycles::fromNanoseconds(
+                    serviceTime.longDuration);
+                break;
+            case ServiceTime::LOGNORMAL: {
+                // Choose mu so that the mean is exp(mu + sigma^2 / 2) = mean.
+                double sigma = serviceTime.shape;
+                lognormal.param(std::lognormal_distribution<double>::param_type(
+                    log(mean) - sigma * sigma / 2, sigma));
+                break;
+            }
+            case ServiceTime::PARETO: {
+                // Choose the scale so that the mean is
+                // scale * alpha / (alpha - 1) = mean.
+                double alpha = serviceTime.shape;
+                paretoScale = mean * (alpha - 1) / alpha;
+                paretoExponent = -1.0 / alpha;
+                break;
+            }
+        }
+    }
+
+    bool isFixed() const { return type == ServiceTime::FIXED; }
+
+    template <typename Generator>
+    uint64_t operator()(Generator& gen) {
+        double nanoseconds;
+        switch (type) {
+            case ServiceTime::FIXED:
+                return fixedCycles;
+            case ServiceTime::BIMODAL:
+                return uniform(gen) < longFraction ? longCycles : fixedCycles;
+            case ServiceTime::EXPONENTIAL:
+                nanoseconds = exponential(gen);
+                break;
+            case ServiceTime::LOGNORMAL:
+                nanoseconds = lognormal(gen);
+                break;
+            case ServiceTime::PARETO:
+                // Inverse transform sampling; 1 - U avoids dividing by zero.
+                nanoseconds =
+                    paretoScale * pow(1.0 - uniform(gen), paretoExponent);
+                break;
+            default:
+                return fixedCycles;
+        }
+        return static_cast<uint64_t>(nanoseconds * cyclesPerNanosecond);
+    }
+
+  private:
+    ServiceTime::Type type;
+    uint64_t fixedCycles;
+    uint64_t longCycles;
+    double longFraction;
+    std::uniform_real_distribution<double> uniform;
+    std::exponential_distribution<double> exponential;
+    std::lognormal_distribution<double> lognormal;
+    double paretoScale;
+    double paretoExponent;
+    double cyclesPerNanosecond;
+};
+
+#endif  // SERVICE_TIME_H
@@ -0,0 +1,102 @@
+#ifndef SIMULATED_BACKEND_H
+#define SIMULATED_BACKEND_H
+
+#include <stdint.h>
+#include <atomic>
+#include <functional>
+#include <queue>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "Arachne/Arachne.h"
+#include "PerfUtils/Cycles.h"
+
+/**
+ * A SimulatedBackend stands in for a downstream service that an Arachne
+ * thread calls and blocks on, such as the server of an RPC. A call parks the
+ * calling thread on a Semaphore, and a kernel thread outside Arachne notifies
+ * it once the call's delay has passed. Because the backend's thread is not
+ * one of Arachne's, the time it spends waiting for replies to come due never
+ * counts toward Arachne's load estimates.
+ *
+ * The backend polls for replies that have come due, so it keeps a core busy
+ * while running.
+ */
+class SimulatedBackend {
+  public:
+    SimulatedBackend()
+        : lock("SimulatedBackend"),
+          pending(),
+          numPending(0),
+          running(false),
+          poller() {}
+
+    ~SimulatedBackend() { stop(); }
+
+    void start() {
+        running = true;
+        poller = std::thread(&SimulatedBackend::poll, this);
+    }
+
+    /**
+     * Stop the backend once every call has been replied to.
+     */
+    void stop() {
+        running = false;
+        if (poller.joinable())
+            poller.join();
+    }
+
+    /**
+     * Block the calling Arachne thread until the backend replies, delay
+     * cycles from now.
+     */
+    void call(uint64_t delay) {
+        Arachne::Semaphore reply;
+        uint64_t dueTime = PerfUtils::Cycles::rdtsc() + delay;
+        lock.lock();
+        pending.push(std::make_pair(dueTime, &reply));
+        numPending.store(pending.size(), std::memory_order_relaxed);
+        lock.unlock();
+        reply.wait();
+    }
+
+    /**
+     * Return the number of calls waiting for a reply.
+     */
+    size_t getNumPending() const {
+        return numPending.load(std::memory_order_relaxed);
+    }
+
+  private:
+    // A call waiting for its reply, as the time the reply is due and the
+    // semaphore of the caller.
+    typedef std::pair<uint64_t, Arachne::Semaphore*> Call;
+
+    void poll() {
+        while (running || getNumPending() > 0) {
+            uint64_t now = PerfUtils::Cycles::rdtsc();
+            lock.lock();
+            while (!pending.empty() && pending.top().first <= now) {
+                pending.top().second->notify();
+                pending.pop();
+            }
+            numPending.store(pending.size(), std::memory_order_relaxed);
+            lock.unlock();
+        }
+    }
+
+    // Calls that have not been replied to, earliest reply first; guarded by
+    // lock.
+    Arachne::SpinLock lock;
+    std::priority_queue<Call, std::vector<Call>, std::greater<Call>> pending;
+    std::atomic<size_t> numPending;
+
+    std::atomic<bool> running;
+    std::thread poller;
+
+    SimulatedBackend(const SimulatedBackend&) = delete;
+    SimulatedBackend& operator=(const SimulatedBackend&) = delete;
+};
+
+#endif  // SIMULATED_BACKEND_H
@@ -1,10 +1,29 @@
+#include <malloc.h>
+#include <sched.h>
 #include <signal.h>
 #include <string.h>
+#include <sys/mman.h>
 #include <sys/time.h>
 #include <time.h>
 #include <unistd.h>
+#include <algorithm>
+#include <chrono>
+#include <new>
 #include <random>
+#include <string>
 #include <thread>
+#include "ArrivalSchedule.h"
+#include "ArrivalTrace.h"
+#include "BoundedQueue.h"
+#include "ChunkedArray.h"
+#include "CoroutineExecutor.h"
+#include "LatencyHistogram.h"
+#include "LoadProfile.h"
+#include "ScratchFile.h"
+#include "ServiceTime.h"
+#include "SimulatedBackend.h"
+#include "ThreadExecutor.h"
+#include "WorkKernel.h"
 #include "Arachne/Arachne.h"
 #include "Arachne/DefaultCorePolicy.h"
 #include "CoreArbiter/CoreArbiterClient.h"
@@ -32,8 +51,124 @@ size_t MAX_ENTRIES;
 
 uint64_t* latencies;
 
+// The service time in cycles of each thread, parallel to latencies. This is
+// only recorded if some interval has a variable service time; otherwise the
+// slowdown follows directly from the latency percentiles.
+uint64_t* serviceTimes = NULL;
+
+// The cycles each thread spent running its work kernel, parallel to
+// latencies. This is only recorded if some interval runs a kernel.
+uint64_t* executionTimes = NULL;
+
+// Slowdowns are computed in fixed point with this many steps per unit.
+const uint64_t SLOWDOWN_SCALE = 1000;
+
+// When set, latencies (and slowdowns, if service times vary) are counted in a
+// fixed-size histogram per interval instead of being stored individually, so
+// the length of a run is not limited by the latency array. Like every
+// per-interval record, the histograms are held in chunked arrays that only
+// grow as the run reaches each interval.
+bool useHistograms = false;
+int histogramPrecision = 7;
+ChunkedArray<LatencyHistogram*> latencyHistograms;
+ChunkedArray<LatencyHistogram*> slowdownHistograms;
+
+// With histograms, the total service and execution cycles of the threads of
+// each interval, if some interval runs a kernel.
+struct WorkTotals {
+    std::atomic<uint64_t> serviceCycles;
+    std::atomic<uint64_t> executionCycles;
+};
+ChunkedArray<WorkTotals> workTotals;
+
+// When set, a reporter thread prints each interval's row as soon as every
+// thread of the interval has completed, rather than after the run, and then
+// releases the interval's raw data.
+bool reportOnline = false;
+
+// Percentiles reported in addition to the median, 90% and 99%, as fractions.
+std::vector<double> extraPercentiles = {0.999, 0.9999};
+
 enum DistributionType { POISSON, UNIFORM } distType = POISSON;
 
+// When set, arrivals come from schedules generated from seed ahead of the
+// dispatch loop instead of being drawn inline by it.
+bool useSchedule = false;
+uint32_t seed;
+
+// When set, load comes from a fixed number of clients per interval, each of
+// which issues a request, waits for it to complete and thinks before issuing
+// the next, instead of from an open-loop arrival process.
+bool closedLoop = false;
+
+// When set, arrivals and service times are replayed from this trace instead,
+// and the run is divided into intervals of traceInterval nanoseconds.
+const char* traceFile = NULL;
+ArrivalTrace* trace = NULL;
+uint64_t traceInterval = 50000000;
+
+/**
+ * How the threads of an interval block partway through their service time,
+ * as a request waits on a downstream service. Each thread's service time is
+ * split evenly around its blocks.
+ */
+struct Blocking {
+    // The number of times each thread blocks; 0 means never.
+    uint32_t count;
+
+    // How long each block lasts, in nanoseconds.
+    uint64_t delay;
+
+    // True to block in Arachne::sleep, or false to block on a call to the
+    // simulated backend.
+    bool sleep;
+};
+
+/**
+ * The fraction of an interval's threads that do blocking I/O on the scratch
+ * file before their service time, and the kind of I/O they do.
+ */
+struct DiskIo {
+    double fraction;
+    ScratchFile::Access access;
+};
+
+/**
+ * The child threads that each thread of an interval fans out to and joins
+ * before completing, as a request that makes parallel calls to several
+ * backends does.
+ */
+struct FanOut {
+    // The number of children of each thread; 0 means none.
+    uint32_t count;
+
+    // The distribution of the children's service times.
+    ServiceTime serviceTime;
+};
+
+/**
+ * How the arrivals of an interval come in synchronized bursts, as requests
+ * fanned out by an aggregator land on a server all at once.
+ */
+struct BurstSpec {
+    // The number of threads created at the same arrival time in each burst;
+    // 0 means the interval's arrivals do not come in bursts.
+    uint32_t size;
+
+    // The time from one burst to the next, in nanoseconds.
+    uint64_t period;
+
+    // Each burst arrives up to this many nanoseconds before or after its
+    // period would have it, uniformly.
+    uint64_t jitter;
+};
+
+// The most children a thread may fan out to.
+const uint32_t MAX_FAN_OUT = 64;
+
+// The most stages a pipeline may have.
+const size_t MAX_STAGES = 4;
+
 struct Interval {
     uint64_t timeToRun;
 
@@ -42,109 +177,1568 @@ struct Interval {
     // are not meaningful.
     uint64_t durationPerThread;
     double creationsPerSecond;
-} * intervals;
 
+    // The distribution of thread durations, with durationPerThread as its
+    // mean (or short duration, for bimodal).
+    ServiceTime serviceTime;
+
+    // In closed-loop mode, the distribution of the time each client waits
+    // between a request completing and issuing its next one; in that mode
+    // creationsPerSecond holds the number of clients instead.
+    ServiceTime thinkTime;
+
+    // The work each thread does, or NULL to spin.
+    WorkKernel* kernel;
+
+    Blocking blocking;
+    DiskIo diskIo;
+    FanOut fanOut;
+    BurstSpec burst;
+
+    // In pipeline mode, the mean service time in nanoseconds of each stage,
+    // drawn from the same distribution as serviceTime. The first stage's is
+    // durationPerThread.
+    uint64_t stageDurations[MAX_STAGES];
+};
+
+// The intervals of the run, held in chunks that are only allocated as the run
+// reaches them and, with --online, freed once they have been reported.
+ChunkedArray<Interval> intervals;
 size_t numIntervals;
 
-// The values of arrayIndex before each change in load, which we can use later
-// to compute latency and throughput. Note that this value and perfStats
-// are not read atomically, but we believe the difference should be
-// negligible.
-std::vector<uint64_t> indices;
-std::vector<uint64_t> numTimesLoadClipped;
+// When the configuration file is a load profile, intervals are filled in from
+// it one ahead of the run; this many have been filled in so far.
+LoadProfile* profile = NULL;
+size_t numExpandedIntervals = 0;
+
+// Every distinct kernel named by the intervals, and the kernel of intervals
+// that do not name one.
+std::vector<WorkKernel*> kernels;
+WorkKernel* defaultKernel = NULL;
+
+// The blocking of intervals that do not specify any.
+Blocking defaultBlocking = {0, 0, false};
+
+// Set if any interval blocks, in which case the number of active cores and
+// of blocked threads at the end of each interval are reported as well.
+bool reportBlocking = false;
+ChunkedArray<uint64_t> activeCores;
+ChunkedArray<uint64_t> blockedThreads;
+
+// Replies to the calls of threads that block on a backend, and the number of
+// threads blocked in Arachne::sleep.
+SimulatedBackend* backend = NULL;
+std::atomic<uint64_t> numSleeping;
+
+// The disk I/O of intervals that do not specify any.
+DiskIo defaultDiskIo = {0, ScratchFile::READ};
+
+// The file that threads doing disk I/O access, created if any interval does
+// disk I/O. Latencies of the threads that do I/O and of those that do not
+// are then also reported separately, counted in their own histograms if
+// histograms are in use.
+const char* scratchPath = "SyntheticWorkload.scratch";
+ScratchFile* scratchFile = NULL;
+ChunkedArray<LatencyHistogram*> diskIoHistograms;
+ChunkedArray<LatencyHistogram*> noDiskIoHistograms;
+
+// The fan-out of intervals that do not specify any.
+FanOut defaultFanOut = {0, {ServiceTime::FIXED, 0, 0, 0}};
+
+// The time in cycles from the median child of each thread completing to its
+// last child completing, parallel to latencies, or in a histogram per
+// interval if histograms are in use. These are only recorded if some
+// interval fans out.
+uint64_t* stragglerTimes = NULL;
+ChunkedArray<LatencyHistogram*> stragglerHistograms;
+
+/**
+ * One burst of arrivals, and how long it took to be served.
+ */
+struct Burst {
+    uint64_t interval;
+
+    // The arrival time of every thread of the burst.
+    uint64_t arrivalTime;
+    uint32_t size;
+
+    // The number of threads of the burst that have not completed, and the
+    // time at which the last one completed.
+    std::atomic<uint32_t> remaining;
+    std::atomic<uint64_t> completionTime;
+
+    // The number of active cores when the burst arrived, and the time at
+    // which that number first changed, or 0 if it has not.
+    uint32_t coresAtArrival;
+    std::atomic<uint64_t> reactionTime;
+};
+
+// Every burst of the run, in order of arrival; burstIndices holds the index
+// of the first burst of each interval, and then the number of bursts. Bursts
+// need a single dispatcher, which is the only writer of these.
+Burst* bursts = NULL;
+size_t maxBursts = 0;
+size_t numBursts = 0;
+ChunkedArray<size_t> burstIndices;
+
+// With --burstFile, the file that every burst is written to after the run.
+const char* burstFile = NULL;
+
+/**
+ * A request passing through the pipeline, in pipeline mode.
+ */
+struct PipelineRequest {
+    uint64_t creationTime;
+    uint64_t arrayIndex;
+    uint64_t interval;
+
+    // The service time of the first stage, drawn by the dispatcher.
+    uint64_t firstStageCycles;
+
+    // When the request was added to the queue of the stage it is in.
+    uint64_t enqueueTime;
+
+    // The time the request spent waiting in the queue of each stage.
+    uint64_t queueingCycles[MAX_STAGES];
+
+    // The service times of the stages so far, and the time spent running
+    // them.
+    uint64_t serviceCycles;
+    uint64_t executionCycles;
+};
+
+// With --pipeline, requests pass through numStages stages in turn, each
+// served by workersPerStage long-lived threads that take requests from the
+// stage's queue of queueCapacity requests, instead of each request being a
+// thread of its own. Requests come from a fixed pool, which the dispatchers
+// take them from and the last stage returns them to. The total queueing
+// delay of the requests of each interval at each stage is in
+// stageQueueingCycles, MAX_STAGES per interval.
+size_t numStages = 0;
+size_t workersPerStage;
+size_t queueCapacity;
+std::vector<BoundedQueue<PipelineRequest*>*> stageQueues;
+BoundedQueue<PipelineRequest*>* freeRequests = NULL;
+PipelineRequest* requestPool = NULL;
+ChunkedArray<std::atomic<uint64_t>> stageQueueingCycles;
+
+/**
+ * A request waiting in the queue of the worker pool: the arguments that
+ * fixedWork would otherwise be created with.
+ */
+struct PoolRequest {
+    uint64_t duration;
+    uint64_t creationTime;
+    uint64_t arrayIndex;
+    uint64_t interval;
+};
+
+// A PoolRequest with this arrayIndex tells the worker that takes it to exit.
+const uint64_t STOP_WORKER = ~0UL;
+
+// With --workers, the number of long-lived threads that serve requests from
+// poolQueue, which holds up to poolCapacity requests; 0 runs each request as
+// a thread of its own, as without --workers, but reports the same columns.
+// -1 without --workers.
+int numWorkers = -1;
+size_t poolCapacity = 4096;
+BoundedQueue<PoolRequest>* poolQueue = NULL;
+
+// With --executor, the kernel-thread executor that runs requests instead of
+// Arachne threads, or NULL if requests run on Arachne threads. If it runs
+// coroutines, it is coroutineExecutor as well.
+ThreadExecutor* executor = NULL;
+CoroutineExecutor* coroutineExecutor = NULL;
+
+// With --executorCpus, the CPUs that the executor's threads are pinned to.
+std::vector<int> executorCpus;
+
+// True if the run reports start delays and the overhead per request, as it
+// does with --workers or --executor.
+bool reportStartDelay = false;
+
+// If reportStartDelay is set, the number of requests that have been submitted
+// and have not completed, for measuring the memory each one takes.
+std::atomic<uint64_t> numInFlight;
+
+// The time in cycles from each request's creation to the start of its work,
+// parallel to latencies, or in a histogram per interval if histograms are in
+// use. These are only recorded if reportStartDelay is set.
+uint64_t* startDelays = NULL;
+ChunkedArray<LatencyHistogram*> startDelayHistograms;
+
+// True if the run reports the work done per second, because some interval
+// uses a kernel.
+bool reportWork = false;
+
+// The number of dispatch threads that share the offered load of each interval.
+int numDispatchers = 1;
+
+/**
+ * Each dispatcher generates an equal share of the offered load using its own
+ * random number generator and arrival clock, and hands out latency slots from
+ * its own slice of the latency array, so dispatchers never share an index.
+ * Dispatcher 0 is the leader: it decides when intervals change and collects
+ * the PerfStats that the other dispatchers' indices are matched against.
+ */
+struct Dispatcher {
+    int id;
+
+    // The first entry and one past the last entry of this dispatcher's slice
+    // of the latency array.
+    uint64_t sliceStart;
+    uint64_t sliceEnd;
+
+    // The next entry of the slice to hand out.
+    uint64_t arrayIndex;
+
+    // The values of arrayIndex before each change in load, which we can use
+    // later to compute latency and throughput. Note that these values and
+    // perfStats are not read atomically, but we believe the difference should
+    // be negligible.
+    ChunkedArray<uint64_t> indices;
+    ChunkedArray<uint64_t> numTimesLoadClipped;
+
+    // The number of entries of indices and numTimesLoadClipped that have been
+    // written, for the reporter thread to read while the run continues.
+    std::atomic<size_t> numIndicesPublished;
+
+    // This dispatcher's scheduled arrivals, or NULL if arrivals are drawn
+    // inline.
+    ArrivalSchedule* schedule;
+} * dispatchers;
+
+// The interval that the leader is currently generating load for. The other
+// dispatchers poll this to learn when to move on to the next interval.
+std::atomic<size_t> sharedInterval;
+
+// Set by the leader once initial statistics are collected, so that all
+// dispatchers start their arrival clocks together.
+std::atomic<bool> loadStarted;
 
 // The performance statistics before each change in load, which we can use
 // later to compute utilization.
-std::vector<PerfStats> perfStats;
+ChunkedArray<PerfStats> perfStats;
+
+/**
+ * Return true if the thread with the given latency slot does disk I/O, in an
+ * interval where the given fraction of threads do. This depends only on the
+ * slot, so the threads that did I/O can be told apart after the run.
+ */
+bool
+doesDiskIo(uint64_t arrayIndex, double fraction) {
+    uint64_t hash = arrayIndex * 0x9E3779B97F4A7C15UL;
+    return static_cast<double>(hash >> 11) <
+           fraction * static_cast<double>(1UL << 53);
+}
 
 /**
- * Spin for duration cycles, and then compute latency from creation time.
+ * Block the calling thread once, as the given blocking describes.
  */
 void
-fixedWork(uint64_t duration, uint64_t creationTime, uint32_t arrayIndex) {
+block(const Blocking& blocking) {
+    if (blocking.sleep) {
+        numSleeping.fetch_add(1, std::memory_order_relaxed);
+        if (executor) {
+            std::this_thread::sleep_for(
+                std::chrono::nanoseconds(blocking.delay));
+        } else {
+            Arachne::sleep(blocking.delay);
+        }
+        numSleeping.fetch_sub(1, std::memory_order_relaxed);
+    } else {
+        backend->call(Cycles::fromNanoseconds(blocking.delay));
+    }
+}
+
+/**
+ * Do the given slice of the work of doWork, which divides duration evenly
+ * between the slices around each time the interval blocks.
+ *
+ * \return
+ *      The cycles spent running.
+ */
+uint64_t
+runSlice(const Interval& spec, uint64_t duration, uint64_t slice,
+         uint64_t seed) {
+    uint64_t numSlices = spec.blocking.count + 1;
+    uint64_t sliceCycles = duration / numSlices;
+    if (slice == numSlices - 1)
+        sliceCycles += duration % numSlices;
     uint64_t startTime = Cycles::rdtsc();
-    uint64_t stop = startTime + duration;
-    while (Cycles::rdtsc() < stop)
-        ;
-    uint64_t endTime = Cycles::rdtsc();
-    uint64_t latency = endTime - creationTime;
+    if (spec.kernel) {
+        spec.kernel->run(sliceCycles, seed + slice);
+    } else {
+        uint64_t stop = startTime + sliceCycles;
+        while (Cycles::rdtsc() < stop)
+            ;
+    }
+    return Cycles::rdtsc() - startTime;
+}
 
-    latencies[arrayIndex] = latency;
+/**
+ * Spin for duration cycles, or run the interval's work kernel for as long as
+ * it took to run for duration cycles when calibrated, blocking in between if
+ * the interval blocks.
+ *
+ * \param seed
+ *      Any value that differs between threads, for the kernel.
+ * \return
+ *      The cycles spent running, not counting the time spent blocked.
+ */
+uint64_t
+doWork(const Interval& spec, uint64_t duration, uint64_t seed) {
+    uint64_t executionTime = 0;
+    for (uint64_t slice = 0; slice <= spec.blocking.count; slice++) {
+        if (slice > 0)
+            block(spec.blocking);
+        executionTime += runSlice(spec, duration, slice, seed);
+    }
+    return executionTime;
 }
 
+/**
+ * Do the work of one child of a fanned-out thread, and record when it
+ * completed.
+ */
 void
-postProcessResults(const char* benchmarkFile, uint64_t totalCreationCount) {
-    // Sanity check
-    if (totalCreationCount >= MAX_ENTRIES) {
+childWork(uint64_t duration, uint64_t interval, uint64_t* completionTime) {
+    doWork(intervals[interval], duration, duration);
+    *completionTime = Cycles::rdtsc();
+}
+
+/**
+ * Create the children of a thread, with service times drawn from the
+ * interval's child distribution by a generator seeded from the thread's
+ * latency slot. A child that cannot be created, because Arachne has no room
+ * for more threads, is run inline instead, so that parents waiting for
+ * children can never occupy every thread slot.
+ */
+void
+createChildren(uint64_t arrayIndex, uint64_t interval,
+               Arachne::ThreadId* children, uint64_t* completionTimes) {
+    const FanOut& fanOut = intervals[interval].fanOut;
+    ServiceTimeGenerator childServiceTime;
+    childServiceTime.setDistribution(fanOut.serviceTime);
+    std::minstd_rand gen(static_cast<uint32_t>(arrayIndex));
+    for (uint32_t k = 0; k < fanOut.count; k++) {
+        uint64_t duration = childServiceTime(gen);
+        children[k] = Arachne::createThread(childWork, duration, interval,
+                                            &completionTimes[k]);
+        if (children[k] == Arachne::NullThread)
+            childWork(duration, interval, &completionTimes[k]);
+    }
+}
+
+/**
+ * Join the children of a thread.
+ *
+ * \return
+ *      The time from the median child completing to the last one completing.
+ */
+uint64_t
+joinChildren(uint32_t numChildren, Arachne::ThreadId* children,
+             uint64_t* completionTimes) {
+    for (uint32_t k = 0; k < numChildren; k++) {
+        if (children[k] != Arachne::NullThread)
+            Arachne::join(children[k]);
+    }
+    uint64_t* median = completionTimes + numChildren / 2;
+    std::nth_element(completionTimes, median, completionTimes + numChildren);
+    return *std::max_element(median, completionTimes + numChildren) - *median;
+}
+
+/**
+ * Record the measurements of a thread that has completed: its latency, and
+ * whichever of its service time, execution time, disk I/O and straggler time
+ * are in use. These are stored at arrayIndex, or counted in the histograms
+ * of the given interval if histograms are in use.
+ */
+void
+recordCompletion(uint64_t arrayIndex, uint64_t interval, uint64_t duration,
+                 uint64_t latency, uint64_t executionTime, bool diskIo,
+                 uint64_t stragglerTime) {
+    if (reportStartDelay)
+        numInFlight.fetch_sub(1, std::memory_order_relaxed);
+    if (useHistograms) {
+        if (workTotals.inUse()) {
+            workTotals[interval].serviceCycles.fetch_add(
+                duration, std::memory_order_relaxed);
+            workTotals[interval].executionCycles.fetch_add(
+                executionTime, std::memory_order_relaxed);
+        }
+        if (diskIoHistograms.inUse()) {
+            ChunkedArray<LatencyHistogram*>& histograms =
+                diskIo ? diskIoHistograms : noDiskIoHistograms;
+            histograms[interval]->record(latency);
+        }
+        if (stragglerHistograms.inUse())
+            stragglerHistograms[interval]->record(stragglerTime);
+        latencyHistograms[interval]->record(latency);
+        if (slowdownHistograms.inUse()) {
+            slowdownHistograms[interval]->record(
+                latency * SLOWDOWN_SCALE / std::max<uint64_t>(duration, 1));
+        }
+        return;
+    }
+    // The reporter thread takes a nonzero latency to mean the slot is
+    // complete, so it is stored last.
+    if (serviceTimes)
+        serviceTimes[arrayIndex] = duration;
+    if (executionTimes)
+        executionTimes[arrayIndex] = executionTime;
+    if (stragglerTimes)
+        stragglerTimes[arrayIndex] = stragglerTime;
+    __atomic_store_n(&latencies[arrayIndex], latency, __ATOMIC_RELEASE);
+}
+
+/**
+ * Record the start delay of a request that has just started, if start
+ * delays are being reported. This must come before the request's latency is
+ * recorded, which marks its slot complete.
+ */
+void
+recordStartDelay(uint64_t arrayIndex, uint64_t interval,
+                 uint64_t creationTime) {
+    if (startDelays)
+        startDelays[arrayIndex] = Cycles::rdtsc() - creationTime;
+    else if (startDelayHistograms.inUse())
+        startDelayHistograms[interval]->record(Cycles::rdtsc() - creationTime);
+}
+
+/**
+ * Do this thread's work (see doWork), after doing disk I/O and creating
+ * children if the interval calls for them, then join any children and
+ * record latency from creation time. The duration is this thread's service
+ * time, drawn by the dispatcher.
+ */
+void
+fixedWork(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+          uint64_t interval) {
+    recordStartDelay(arrayIndex, interval, creationTime);
+    const Interval& spec = intervals[interval];
+    bool diskIo = doesDiskIo(arrayIndex, spec.diskIo.fraction);
+    if (diskIo)
+        scratchFile->access(spec.diskIo.access, arrayIndex);
+    Arachne::ThreadId children[MAX_FAN_OUT];
+    uint64_t childCompletionTimes[MAX_FAN_OUT];
+    if (spec.fanOut.count > 0)
+        createChildren(arrayIndex, interval, children, childCompletionTimes);
+    uint64_t executionTime = doWork(spec, duration, creationTime);
+    uint64_t stragglerTime = 0;
+    if (spec.fanOut.count > 0) {
+        stragglerTime = joinChildren(spec.fanOut.count, children,
+                                     childCompletionTimes);
+    }
+    uint64_t latency = Cycles::rdtsc() - creationTime;
+    recordCompletion(arrayIndex, interval, duration, latency, executionTime,
+                     diskIo, stragglerTime);
+}
+
+/**
+ * The work of fixedWork, as a coroutine for the coroutine executor. Rather
+ * than sleeping in the middle of its work, it returns, and is resumed when
+ * the sleep is over.
+ */
+class RequestCoroutine : public Coroutine {
+  public:
+    RequestCoroutine(uint64_t duration, uint64_t creationTime,
+                     uint64_t arrayIndex, uint64_t interval)
+        : duration(duration),
+          creationTime(creationTime),
+          arrayIndex(arrayIndex),
+          interval(interval),
+          nextSlice(0),
+          executionTime(0),
+          diskIo(false) {}
+
+    uint64_t resume() {
+        const Interval& spec = intervals[interval];
+        if (nextSlice == 0) {
+            recordStartDelay(arrayIndex, interval, creationTime);
+            diskIo = doesDiskIo(arrayIndex, spec.diskIo.fraction);
+            if (diskIo)
+                scratchFile->access(spec.diskIo.access, arrayIndex);
+        } else {
+            numSleeping.fetch_sub(1, std::memory_order_relaxed);
+        }
+        executionTime += runSlice(spec, duration, nextSlice, creationTime);
+        nextSlice++;
+        if (nextSlice <= spec.blocking.count) {
+            numSleeping.fetch_add(1, std::memory_order_relaxed);
+            return Cycles::rdtsc() +
+                   Cycles::fromNanoseconds(spec.blocking.delay);
+        }
+        uint64_t latency = Cycles::rdtsc() - creationTime;
+        recordCompletion(arrayIndex, interval, duration, latency,
+                         executionTime, diskIo, 0);
+        return 0;
+    }
+
+  private:
+    uint64_t duration;
+    uint64_t creationTime;
+    uint64_t arrayIndex;
+    uint64_t interval;
+
+    // The slice of the work to run when next resumed (see runSlice), and the
+    // time spent running the slices so far.
+    uint64_t nextSlice;
+    uint64_t executionTime;
+
+    bool diskIo;
+};
+
+/**
+ * Serve requests from the worker pool's queue until told to stop.
+ */
+void
+poolWorker() {
+    for (;;) {
+        PoolRequest request = poolQueue->pop();
+        if (request.arrayIndex == STOP_WORKER)
+            return;
+        fixedWork(request.duration, request.creationTime, request.arrayIndex,
+                  request.interval);
+    }
+}
+
+/**
+ * Serve one stage of the pipeline until told to stop by a NULL request,
+ * which the worker passes on to the next stage. Each request's service time
+ * for the stage is drawn by the worker, except in the first stage, where the
+ * dispatcher drew it, and when replaying a trace. Workers of the last stage
+ * record each request's latency and return it to the pool. With --seed, each
+ * worker draws from a stream of its own, derived from the seed, its stage and
+ * its index within the stage.
+ */
+void
+stageWorker(uint64_t stage, uint64_t worker) {
+    ServiceTimeGenerator serviceTime;
+    std::random_device rd;
+    std::seed_seq seeds = {useSchedule ? seed : rd(),
+                           static_cast<uint32_t>(stage),
+                           static_cast<uint32_t>(worker)};
+    std::mt19937 gen(seeds);
+    bool isLastStage = stage == numStages - 1;
+    while (PipelineRequest* request = stageQueues[stage]->pop()) {
+        request->queueingCycles[stage] = Cycles::rdtsc() - request->enqueueTime;
+        const Interval& spec = intervals[request->interval];
+        // Replayed requests take their traced service time in every stage.
+        uint64_t duration = request->firstStageCycles;
+        if (stage > 0 && !trace) {
+            ServiceTime stageServiceTime = spec.serviceTime;
+            stageServiceTime.duration = spec.stageDurations[stage];
+            serviceTime.setDistribution(stageServiceTime);
+            duration = serviceTime(gen);
+        }
+        request->serviceCycles += duration;
+        request->executionCycles += doWork(spec, duration, request->arrayIndex);
+        if (!isLastStage) {
+            request->enqueueTime = Cycles::rdtsc();
+            stageQueues[stage + 1]->push(request);
+            continue;
+        }
+
+        uint64_t latency = Cycles::rdtsc() - request->creationTime;
+        for (size_t s = 0; s < numStages; s++) {
+            stageQueueingCycles[request->interval * MAX_STAGES + s].fetch_add(
+                request->queueingCycles[s], std::memory_order_relaxed);
+        }
+        recordCompletion(request->arrayIndex, request->interval,
+                         request->serviceCycles, latency,
+                         request->executionCycles, false, 0);
+        freeRequests->push(request);
+    }
+    if (!isLastStage)
+        stageQueues[stage + 1]->push(NULL);
+}
+
+/**
+ * Create the queues, request pool and workers of the pipeline.
+ */
+void
+startPipeline() {
+    // Every request is either in a queue or with a worker, so this many are
+    // enough to keep every stage busy.
+    size_t numRequests = numStages * (queueCapacity + workersPerStage);
+    requestPool = new PipelineRequest[numRequests];
+    freeRequests = new BoundedQueue<PipelineRequest*>(numRequests);
+    for (size_t r = 0; r < numRequests; r++)
+        freeRequests->push(&requestPool[r]);
+    for (size_t stage = 0; stage < numStages; stage++)
+        stageQueues.push_back(
+            new BoundedQueue<PipelineRequest*>(queueCapacity));
+    stageQueueingCycles.setMaxSize(numIntervals * MAX_STAGES);
+
+    for (size_t stage = 0; stage < numStages; stage++) {
+        for (size_t w = 0; w < workersPerStage; w++) {
+            if (Arachne::createThread(stageWorker, stage, w) ==
+                Arachne::NullThread) {
+                fprintf(stderr, "Failed to create pipeline worker\n");
+                exit(1);
+            }
+        }
+    }
+}
+
+/**
+ * One client of the closed-loop mode. Apart from completionTime, which its
+ * requests write, a client is only touched by the leader dispatcher. Each
+ * client has a cache line of its own, so that clients whose requests complete
+ * concurrently do not share one.
+ */
+struct alignas(64) Client {
+    // The time at which the client's last request completed, or 0 while a
+    // request is outstanding.
+    std::atomic<uint64_t> completionTime;
+
+    // True if the client is waiting to issue its next request at
+    // nextRequestTime, rather than waiting for a request to complete.
+    bool thinking;
+    uint64_t nextRequestTime;
+};
+
+/**
+ * Serve one request of a closed-loop client and tell it the request is done.
+ */
+void
+clientRequest(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+              uint64_t interval, Client* client) {
+    fixedWork(duration, creationTime, arrayIndex, interval);
+    client->completionTime.store(Cycles::rdtsc(), std::memory_order_release);
+}
+
+/**
+ * Serve one request of a burst, and record when the burst has completed.
+ */
+void
+burstRequest(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+             uint64_t interval, Burst* burst) {
+    fixedWork(duration, creationTime, arrayIndex, interval);
+    if (burst->remaining.fetch_sub(1) == 1)
+        burst->completionTime = Cycles::rdtsc();
+}
+
+/**
+ * A RequestServer serves the requests that the dispatchers generate, in one
+ * of the ways the run can be configured to: a thread per request on Arachne,
+ * the worker pool, the pipeline, the coroutine executor or a kernel-thread
+ * executor. The dispatchers hand every request to the run's server, and know
+ * nothing else about how it is served.
+ */
+class RequestServer {
+  public:
+    virtual ~RequestServer() {}
+
+    /**
+     * Serve a request with the given service time, in cycles, and arrival
+     * time, which is to record its latency in the given slot of the given
+     * interval. Like thread creation, this is retried until the request is
+     * accepted, so a server with no room holds up the dispatcher.
+     *
+     * \param burst
+     *      The burst that the request belongs to, or NULL. Only requests
+     *      served by threads of their own belong to bursts.
+     */
+    virtual void submit(uint64_t duration, uint64_t creationTime,
+                        uint64_t arrayIndex, uint64_t interval,
+                        Burst* burst) = 0;
+
+    /**
+     * Take no more requests, and let the server's own threads exit once the
+     * requests already submitted have completed.
+     */
+    virtual void stop() {}
+
+    /**
+     * Return the memory, in bytes, that each request holds while it is in
+     * flight out of memory set aside before the load started, such as the
+     * stack of the thread that serves it or its slot in a queue. This does
+     * not show up as growth in the heap while the load runs.
+     */
+    virtual size_t getReservedBytesPerRequest() { return 0; }
+};
+
+/**
+ * Runs each request on an Arachne thread of its own.
+ */
+class ArachneServer : public RequestServer {
+  public:
+    void submit(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+                uint64_t interval, Burst* burst) {
+        if (burst) {
+            while (Arachne::createThread(burstRequest, duration, creationTime,
+                                         arrayIndex, interval, burst) ==
+                   Arachne::NullThread)
+                ;
+            return;
+        }
+        while (Arachne::createThread(fixedWork, duration, creationTime,
+                                     arrayIndex, interval) ==
+               Arachne::NullThread)
+            ;
+    }
+
+    size_t getReservedBytesPerRequest() {
+        return static_cast<size_t>(Arachne::stackSize);
+    }
+};
+
+/**
+ * Queues each request for the long-lived Arachne threads of the worker pool.
+ */
+class PoolServer : public RequestServer {
+  public:
+    void submit(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+                uint64_t interval, Burst* burst) {
+        PoolRequest request = {duration, creationTime, arrayIndex, interval};
+        while (!poolQueue->tryPush(request))
+            ;
+    }
+
+    void stop() {
+        PoolRequest stop = {0, 0, STOP_WORKER, 0};
+        for (int w = 0; w < numWorkers; w++)
+            poolQueue->push(stop);
+    }
+
+    size_t getReservedBytesPerRequest() { return sizeof(PoolRequest); }
+};
+
+/**
+ * Takes a request from the pipeline's pool and adds it to the first stage's
+ * queue.
+ */
+class PipelineServer : public RequestServer {
+  public:
+    void submit(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+                uint64_t interval, Burst* burst) {
+        PipelineRequest* request;
+        while (!freeRequests->tryPop(&request))
+            ;
+        request->creationTime = creationTime;
+        request->arrayIndex = arrayIndex;
+        request->interval = interval;
+        request->firstStageCycles = duration;
+        request->serviceCycles = 0;
+        request->executionCycles = 0;
+        request->enqueueTime = Cycles::rdtsc();
+        while (!stageQueues[0]->tryPush(request))
+            ;
+    }
+
+    /**
+     * A NULL request for each worker of the first stage shuts the pipeline
+     * down once every request ahead of it has passed through.
+     */
+    void stop() {
+        for (size_t w = 0; w < workersPerStage; w++)
+            stageQueues[0]->push(NULL);
+    }
+};
+
+/**
+ * Starts each request as a coroutine on the coroutine executor.
+ */
+class CoroutineServer : public RequestServer {
+  public:
+    void submit(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+                uint64_t interval, Burst* burst) {
+        RequestCoroutine* request = new RequestCoroutine(
+            duration, creationTime, arrayIndex, interval);
+        while (!coroutineExecutor->start(request))
+            ;
+    }
+
+    void stop() { coroutineExecutor->stop(); }
+
+    size_t getReservedBytesPerRequest() {
+        return coroutineExecutor->getReservedBytesPerTask();
+    }
+};
+
+/**
+ * Submits each request to a kernel-thread executor.
+ */
+class ExecutorServer : public RequestServer {
+  public:
+    void submit(uint64_t duration, uint64_t creationTime, uint64_t arrayIndex,
+                uint64_t interval, Burst* burst) {
+        ThreadExecutor::Task task = {
+            fixedWork, {duration, creationTime, arrayIndex, interval}};
+        while (!executor->submit(task))
+            ;
+    }
+
+    void stop() { executor->stop(); }
+
+    size_t getReservedBytesPerRequest() {
+        return executor->getReservedBytesPerTask();
+    }
+};
+
+// The server that the dispatchers of an open-loop run hand requests to.
+RequestServer* server = NULL;
+
+/**
+ * A MemorySampler measures the memory that each in-flight request takes,
+ * whatever server serves it. Until stopped, it samples the bytes in use on
+ * the heap and numInFlight every millisecond from a kernel thread outside
+ * Arachne. The heap's growth since the sampler started, at the sample with
+ * the most requests in flight, is divided among those requests. Memory that
+ * the run allocates for other reasons while the load runs, such as each
+ * interval's histograms, is counted too, so this is an upper bound when few
+ * requests are in flight.
+ */
+class MemorySampler {
+  public:
+    MemorySampler()
+        : baselineBytes(heapBytes()),
+          peakInFlight(0),
+          growthAtPeak(0),
+          stopping(false),
+          sampler(&MemorySampler::sample, this) {}
+
+    /**
+     * Stop sampling, and print the memory each in-flight request took.
+     */
+    void stop() {
+        stopping = true;
+        sampler.join();
+        if (peakInFlight == 0)
+            return;
+        size_t reserved = server->getReservedBytesPerRequest();
         fprintf(stderr,
-                "Benchmark wrote past the end of latency array. Assuming "
-                "memory corruption. Final index written = %lu, MAX_ENTRIES = "
-                "%lu\n",
-                totalCreationCount, MAX_ENTRIES);
-        abort();
+                "Each in-flight request took %lu bytes: %lu of heap growth "
+                "over a peak of %lu requests in flight, and %zu set aside "
+                "before the load\n",
+                growthAtPeak / peakInFlight + reserved,
+                growthAtPeak / peakInFlight, peakInFlight, reserved);
+    }
+
+  private:
+    static uint64_t heapBytes() {
+        struct mallinfo2 info = mallinfo2();
+        return info.uordblks + info.hblkhd;
+    }
+
+    void sample() {
+        while (!stopping) {
+            uint64_t inFlight = numInFlight.load(std::memory_order_relaxed);
+            uint64_t bytes = heapBytes();
+            if (inFlight > peakInFlight) {
+                peakInFlight = inFlight;
+                growthAtPeak =
+                    bytes > baselineBytes ? bytes - baselineBytes : 0;
+            }
+            usleep(1000);
+        }
+    }
+
+    // The heap in use when the sampler started.
+    uint64_t baselineBytes;
+
+    // The most requests seen in flight, and how much the heap had grown then.
+    uint64_t peakInFlight;
+    uint64_t growthAtPeak;
+
+    std::atomic<bool> stopping;
+    std::thread sampler;
+
+    MemorySampler(const MemorySampler&) = delete;
+    MemorySampler& operator=(const MemorySampler&) = delete;
+};
+
+/**
+ * Find the values at the given fractions of count values, at the same ranks
+ * that computeStatistics uses (element count * fraction of the sorted values,
+ * so that a fraction of 1 gives the maximum). Each rank is found by selection
+ * within what is left of the array after the previous one, rather than by
+ * sorting, so this is linear in count. The data is reordered.
+ */
+void
+selectPercentiles(uint64_t* data, uint64_t count,
+                  const std::vector<double>& fractions, uint64_t* values) {
+    if (count == 0) {
+        std::fill(values, values + fractions.size(), 0);
+        return;
+    }
+    std::vector<std::pair<uint64_t, size_t>> ranks;
+    for (size_t k = 0; k < fractions.size(); k++) {
+        uint64_t rank = static_cast<uint64_t>(static_cast<double>(count) *
+                                              fractions[k]);
+        ranks.push_back(std::make_pair(std::min(rank, count - 1), k));
+    }
+    std::sort(ranks.begin(), ranks.end());
+
+    // Everything before unsorted is already in its final position.
+    uint64_t* unsorted = data;
+    for (size_t k = 0; k < ranks.size(); k++) {
+        uint64_t* target = data + ranks[k].first;
+        if (target >= unsorted) {
+            std::nth_element(unsorted, target, data + count);
+            unsorted = target + 1;
+        }
+        values[ranks[k].second] = *target;
+    }
+}
+
+/**
+ * Buffers that one post-processing thread reuses across the intervals it
+ * handles.
+ */
+struct PostProcessBuffers {
+    // With more than one dispatcher, an interval's latencies are spread
+    // across the slices, so they are gathered here before computing
+    // statistics.
+    std::vector<uint64_t> merged;
+    std::vector<uint64_t> mergedServiceTimes;
+    std::vector<uint64_t> slowdowns;
+
+    // The latencies of the threads that did and did not do disk I/O.
+    std::vector<uint64_t> diskIoLatencies;
+    std::vector<uint64_t> noDiskIoLatencies;
+
+    // The straggler times of the threads of the interval.
+    std::vector<uint64_t> stragglers;
+
+    // The start delays of the requests of the interval.
+    std::vector<uint64_t> startDelays;
+
+    // The completion and core reaction times of the bursts of the interval.
+    std::vector<uint64_t> burstCompletions;
+    std::vector<uint64_t> coreReactions;
+
+    // The percentiles computed for the current interval.
+    std::vector<uint64_t> values;
+};
+
+/**
+ * Compute the statistics of interval i - 1 and format them as a row of the
+ * output.
+ */
+std::string
+formatInterval(size_t i, PostProcessBuffers* buffers) {
+    double durationOfInterval = Cycles::toSeconds(
+        perfStats[i].collectionTime - perfStats[i - 1].collectionTime);
+    uint64_t idleCycles = perfStats[i].idleCycles - perfStats[i - 1].idleCycles;
+    uint64_t totalCycles =
+        perfStats[i].totalCycles - perfStats[i - 1].totalCycles;
+    double utilization = static_cast<double>(totalCycles - idleCycles) /
+                         static_cast<double>(totalCycles);
+    double coresUsed = static_cast<double>(totalCycles - idleCycles) /
+                       static_cast<double>(perfStats[i].collectionTime -
+                                           perfStats[i - 1].collectionTime);
+
+    // Sum creations and clipping over all dispatchers. SI and EI count
+    // creations from the start of the run, across all slices.
+    uint64_t startIndex = 0;
+    uint64_t endIndex = 0;
+    uint64_t loadClipCount = 0;
+    for (int d = 0; d < numDispatchers; d++) {
+        Dispatcher& dispatcher = dispatchers[d];
+        startIndex += dispatcher.indices[i - 1] - dispatcher.sliceStart;
+        endIndex += dispatcher.indices[i] - dispatcher.sliceStart;
+        loadClipCount += dispatcher.numTimesLoadClipped[i] -
+                         dispatcher.numTimesLoadClipped[i - 1];
+    }
+    uint64_t count = endIndex - startIndex;
+
+    // Note that this is completed tasks per second, where each task is
+    // currently 2 us
+    uint64_t throughput = static_cast<uint64_t>(static_cast<double>(count) /
+                                                durationOfInterval);
+
+    // Compute load factor.
+    uint64_t weightedLoadedCycles = perfStats[i].weightedLoadedCycles -
+                                    perfStats[i - 1].weightedLoadedCycles;
+    double loadFactor = static_cast<double>(weightedLoadedCycles) /
+                        static_cast<double>(totalCycles);
+
+    // Compute core count changes
+    uint64_t numIncrements =
+        perfStats[i].numCoreIncrements - perfStats[i - 1].numCoreIncrements;
+    uint64_t numDecrements =
+        perfStats[i].numCoreDecrements - perfStats[i - 1].numCoreDecrements;
+
+    // The median, 90% and 99% latency and the maximum, followed by any
+    // further percentiles requested, in the order they were given.
+    std::vector<double> fractions = {0.5, 0.9, 0.99, 1.0};
+    fractions.insert(fractions.end(), extraPercentiles.begin(),
+                     extraPercentiles.end());
+    std::vector<uint64_t>& values = buffers->values;
+    values.resize(fractions.size());
+    const std::vector<double> slowdownFractions = {0.5, 0.99, 1.0};
+    uint64_t slowdownValues[3];
+    // The median and 99% of the latencies of threads with and without disk
+    // I/O, and of straggler times.
+    const std::vector<double> tailFractions = {0.5, 0.99};
+    uint64_t diskIoValues[2];
+    uint64_t noDiskIoValues[2];
+    uint64_t stragglerValues[2];
+    uint64_t startDelayValues[2];
+
+    bool variableServiceTimes;
+    if (useHistograms) {
+        LatencyHistogram* histogram = latencyHistograms[i - 1];
+        for (size_t k = 0; k < fractions.size(); k++)
+            values[k] = histogram->percentile(fractions[k]);
+        values[3] = histogram->max();
+        if (slowdownHistograms.inUse()) {
+            LatencyHistogram* slowdown = slowdownHistograms[i - 1];
+            slowdownValues[0] = slowdown->percentile(0.5);
+            slowdownValues[1] = slowdown->percentile(0.99);
+            slowdownValues[2] = slowdown->max();
+        }
+        variableServiceTimes = slowdownHistograms.inUse();
+        if (stragglerHistograms.inUse()) {
+            for (size_t k = 0; k < tailFractions.size(); k++) {
+                stragglerValues[k] =
+                    stragglerHistograms[i - 1]->percentile(tailFractions[k]);
+            }
+        }
+        if (startDelayHistograms.inUse()) {
+            for (size_t k = 0; k < tailFractions.size(); k++) {
+                startDelayValues[k] =
+                    startDelayHistograms[i - 1]->percentile(tailFractions[k]);
+            }
+        }
+        if (diskIoHistograms.inUse()) {
+            for (size_t k = 0; k < tailFractions.size(); k++) {
+                diskIoValues[k] =
+                    diskIoHistograms[i - 1]->percentile(tailFractions[k]);
+                noDiskIoValues[k] =
+                    noDiskIoHistograms[i - 1]->percentile(tailFractions[k]);
+            }
+        }
+    } else {
+        uint64_t start = dispatchers[0].indices[i - 1];
+        uint64_t* intervalLatencies = latencies + start;
+        uint64_t* intervalServiceTimes =
+            serviceTimes ? serviceTimes + start : NULL;
+        if (numDispatchers > 1) {
+            std::vector<uint64_t>& merged = buffers->merged;
+            std::vector<uint64_t>& mergedServiceTimes =
+                buffers->mergedServiceTimes;
+            merged.clear();
+            mergedServiceTimes.clear();
+            for (int d = 0; d < numDispatchers; d++) {
+                Dispatcher& dispatcher = dispatchers[d];
+                merged.insert(merged.end(),
+                              latencies + dispatcher.indices[i - 1],
+                              latencies + dispatcher.indices[i]);
+                if (serviceTimes) {
+                    mergedServiceTimes.insert(
+                        mergedServiceTimes.end(),
+                        serviceTimes + dispatcher.indices[i - 1],
+                        serviceTimes + dispatcher.indices[i]);
+                }
+            }
+            intervalLatencies = merged.data();
+            if (serviceTimes)
+                intervalServiceTimes = mergedServiceTimes.data();
+        }
+
+        // Threads that did disk I/O and those that did not must be told
+        // apart before the latencies are reordered below.
+        if (scratchFile) {
+            std::vector<uint64_t>& diskIoLatencies = buffers->diskIoLatencies;
+            std::vector<uint64_t>& noDiskIoLatencies =
+                buffers->noDiskIoLatencies;
+            diskIoLatencies.clear();
+            noDiskIoLatencies.clear();
+            double fraction = intervals[i - 1].diskIo.fraction;
+            for (int d = 0; d < numDispatchers; d++) {
+                for (uint64_t j = dispatchers[d].indices[i - 1];
+                     j < dispatchers[d].indices[i]; j++) {
+                    if (doesDiskIo(j, fraction))
+                        diskIoLatencies.push_back(latencies[j]);
+                    else
+                        noDiskIoLatencies.push_back(latencies[j]);
+                }
+            }
+            selectPercentiles(diskIoLatencies.data(), diskIoLatencies.size(),
+                              tailFractions, diskIoValues);
+            selectPercentiles(noDiskIoLatencies.data(),
+                              noDiskIoLatencies.size(), tailFractions,
+                              noDiskIoValues);
+        }
+
+        if (stragglerTimes) {
+            std::vector<uint64_t>& stragglers = buffers->stragglers;
+            stragglers.clear();
+            for (int d = 0; d < numDispatchers; d++) {
+                Dispatcher& dispatcher = dispatchers[d];
+                stragglers.insert(stragglers.end(),
+                                  stragglerTimes + dispatcher.indices[i - 1],
+                                  stragglerTimes + dispatcher.indices[i]);
+            }
+            selectPercentiles(stragglers.data(), stragglers.size(),
+                              tailFractions, stragglerValues);
+        }
+
+        if (startDelays) {
+            std::vector<uint64_t>& delays = buffers->startDelays;
+            delays.clear();
+            for (int d = 0; d < numDispatchers; d++) {
+                Dispatcher& dispatcher = dispatchers[d];
+                delays.insert(delays.end(),
+                              startDelays + dispatcher.indices[i - 1],
+                              startDelays + dispatcher.indices[i]);
+            }
+            selectPercentiles(delays.data(), delays.size(), tailFractions,
+                              startDelayValues);
+        }
+
+        // Slowdown (latency / service time) must be computed per thread
+        // before the latencies are reordered below.
+        if (intervalServiceTimes) {
+            std::vector<uint64_t>& slowdowns = buffers->slowdowns;
+            slowdowns.resize(count);
+            for (uint64_t j = 0; j < count; j++) {
+                slowdowns[j] = intervalLatencies[j] * SLOWDOWN_SCALE /
+                               std::max<uint64_t>(intervalServiceTimes[j], 1);
+            }
+            selectPercentiles(slowdowns.data(), count, slowdownFractions,
+                              slowdownValues);
+        }
+
+        // Note that this computation will modify data
+        selectPercentiles(intervalLatencies, count, fractions, values.data());
+        variableServiceTimes = intervalServiceTimes != NULL;
     }
 
+    // With a fixed service time, every thread's slowdown is its latency
+    // scaled by the same amount.
+    if (!variableServiceTimes) {
+        uint64_t serviceCycles = std::max<uint64_t>(
+            Cycles::fromNanoseconds(intervals[i - 1].durationPerThread), 1);
+        slowdownValues[0] = values[0] * SLOWDOWN_SCALE / serviceCycles;
+        slowdownValues[1] = values[2] * SLOWDOWN_SCALE / serviceCycles;
+        slowdownValues[2] = values[3] * SLOWDOWN_SCALE / serviceCycles;
+    }
+    double scale = static_cast<double>(SLOWDOWN_SCALE);
+
+    // Convert statistics output to nanoseconds
+    for (size_t k = 0; k < values.size(); k++)
+        values[k] = Cycles::toNanoseconds(values[k]);
+
+    char row[4096];
+    int length = snprintf(
+        row, sizeof(row),
+        "%lf,%lf,%lf,%lf,%lu,%lu,%lu,%lu,%lu,%lf,%lu,%lu,%lu,%lu,%lu,%lf,%lf,"
+        "%lf",
+        durationOfInterval, intervals[i - 1].creationsPerSecond, utilization,
+        coresUsed, values[0], values[1], values[2], values[3], throughput,
+        loadFactor, numIncrements, numDecrements, loadClipCount, startIndex,
+        endIndex, static_cast<double>(slowdownValues[0]) / scale,
+        static_cast<double>(slowdownValues[1]) / scale,
+        static_cast<double>(slowdownValues[2]) / scale);
+    std::string result(row, std::min<size_t>(length, sizeof(row) - 1));
+    for (size_t k = 4; k < values.size(); k++) {
+        snprintf(row, sizeof(row), ",%lu", values[k]);
+        result += row;
+    }
+
+    // The total service time of the interval's requests, and the time they
+    // took to run it.
+    uint64_t serviceCycles = 0;
+    uint64_t executionCycles = 0;
+    if (workTotals.inUse()) {
+        serviceCycles = workTotals[i - 1].serviceCycles;
+        executionCycles = workTotals[i - 1].executionCycles;
+    } else {
+        for (int d = 0; (executionTimes || serviceTimes) && d < numDispatchers;
+             d++) {
+            for (uint64_t j = dispatchers[d].indices[i - 1];
+                 j < dispatchers[d].indices[i]; j++) {
+                if (executionTimes)
+                    executionCycles += executionTimes[j];
+                if (serviceTimes)
+                    serviceCycles += serviceTimes[j];
+            }
+        }
+        if (!serviceTimes) {
+            serviceCycles = count * Cycles::fromNanoseconds(
+                                        intervals[i - 1].durationPerThread);
+        }
+    }
+
+    // The work done per second, in operations of the interval's kernel (or
+    // cycles, when spinning), and how much longer that work took to run than
+    // it did when the kernel was calibrated.
+    if (reportWork) {
+        WorkKernel* kernel = intervals[i - 1].kernel;
+        double opsPerCycle = kernel ? kernel->getOpsPerCycle() : 1;
+        snprintf(row, sizeof(row), ",%lf,%lf",
+                 static_cast<double>(serviceCycles) * opsPerCycle /
+                     durationOfInterval,
+                 static_cast<double>(executionCycles) /
+                     static_cast<double>(std::max<uint64_t>(serviceCycles, 1)));
+        result += row;
+    }
+    if (reportBlocking) {
+        snprintf(row, sizeof(row), ",%lu,%lu", activeCores[i],
+                 blockedThreads[i]);
+        result += row;
+    }
+    if (scratchFile) {
+        snprintf(row, sizeof(row), ",%lu,%lu,%lu,%lu",
+                 Cycles::toNanoseconds(noDiskIoValues[0]),
+                 Cycles::toNanoseconds(noDiskIoValues[1]),
+                 Cycles::toNanoseconds(diskIoValues[0]),
+                 Cycles::toNanoseconds(diskIoValues[1]));
+        result += row;
+    }
+    // The core time spent per request beyond its service time, on creating,
+    // scheduling or queueing it, and the throughput per core that ran
+    // requests. The dispatchers' cores are busy throughout, so they are left
+    // out.
+    if (startDelays || startDelayHistograms.inUse()) {
+        uint64_t dispatcherCycles =
+            numDispatchers * (perfStats[i].collectionTime -
+                              perfStats[i - 1].collectionTime);
+        uint64_t overheadCycles = 0;
+        if (totalCycles - idleCycles > dispatcherCycles + serviceCycles) {
+            overheadCycles = totalCycles - idleCycles - dispatcherCycles -
+                             serviceCycles;
+        }
+        double workerCores = std::max(coresUsed - numDispatchers, 0.0);
+        snprintf(row, sizeof(row), ",%lu,%lu,%lu,%lf",
+                 Cycles::toNanoseconds(startDelayValues[0]),
+                 Cycles::toNanoseconds(startDelayValues[1]),
+                 Cycles::toNanoseconds(overheadCycles /
+                                       std::max<uint64_t>(count, 1)),
+                 workerCores > 0
+                     ? static_cast<double>(throughput) / workerCores
+                     : 0.0);
+        result += row;
+    }
+    for (size_t s = 0; s < numStages; s++) {
+        uint64_t queueingCycles =
+            stageQueueingCycles[(i - 1) * MAX_STAGES + s];
+        snprintf(row, sizeof(row), ",%lu",
+                 Cycles::toNanoseconds(queueingCycles / std::max<uint64_t>(
+                                                            count, 1)));
+        result += row;
+    }
+    // How long each burst took from its arrival until its last thread
+    // completed, and until the number of cores first changed, for the bursts
+    // that saw a change.
+    if (bursts) {
+        const std::vector<double> burstFractions = {0.5, 1.0};
+        std::vector<uint64_t>& completions = buffers->burstCompletions;
+        std::vector<uint64_t>& reactions = buffers->coreReactions;
+        completions.clear();
+        reactions.clear();
+        for (size_t b = burstIndices[i - 1]; b < burstIndices[i]; b++) {
+            completions.push_back(bursts[b].completionTime -
+                                  bursts[b].arrivalTime);
+            if (bursts[b].reactionTime != 0) {
+                reactions.push_back(bursts[b].reactionTime -
+                                    bursts[b].arrivalTime);
+            }
+        }
+        uint64_t completionValues[2];
+        uint64_t reactionValues[2];
+        selectPercentiles(completions.data(), completions.size(),
+                          burstFractions, completionValues);
+        selectPercentiles(reactions.data(), reactions.size(), burstFractions,
+                          reactionValues);
+        snprintf(row, sizeof(row), ",%zu,%lu,%lu,%zu,%lu,%lu",
+                 completions.size(),
+                 Cycles::toNanoseconds(completionValues[0]),
+                 Cycles::toNanoseconds(completionValues[1]), reactions.size(),
+                 Cycles::toNanoseconds(reactionValues[0]),
+                 Cycles::toNanoseconds(reactionValues[1]));
+        result += row;
+    }
+    if (stragglerTimes || stragglerHistograms.inUse()) {
+        snprintf(row, sizeof(row), ",%u,%lu,%lu",
+                 intervals[i - 1].fanOut.count,
+                 Cycles::toNanoseconds(stragglerValues[0]),
+                 Cycles::toNanoseconds(stragglerValues[1]));
+        result += row;
+    }
+    result += '\n';
+    return result;
+}
+
+/**
+ * Print the names of the columns of the output.
+ */
+void
+printHeader() {
     // Output core utilization, median & 99% latency, and throughput for each
     // interval in a plottable format.
-    puts(
+    fputs(
         "Duration,Offered Load,Core Utilization,Absolute Cores Used,50\% "
         "Latency,90\%,99\%,Max,Throughput,Load Factor,Core++,Core--,Load "
-        "Clips,SI,EI");
-    for (size_t i = 1; i < indices.size(); i++) {
-        double durationOfInterval = Cycles::toSeconds(
-            perfStats[i].collectionTime - perfStats[i - 1].collectionTime);
-        uint64_t idleCycles =
-            perfStats[i].idleCycles - perfStats[i - 1].idleCycles;
-        uint64_t totalCycles =
-            perfStats[i].totalCycles - perfStats[i - 1].totalCycles;
-        double utilization = static_cast<double>(totalCycles - idleCycles) /
-                             static_cast<double>(totalCycles);
-        double coresUsed = static_cast<double>(totalCycles - idleCycles) /
-                           static_cast<double>(perfStats[i].collectionTime -
-                                               perfStats[i - 1].collectionTime);
-
-        // Note that this is completed tasks per second, where each task is
-        // currently 2 us
-        uint64_t throughput = static_cast<uint64_t>(
-            static_cast<double>(indices[i] - indices[i - 1]) /
-            durationOfInterval);
-
-        // Compute load factor.
-        uint64_t weightedLoadedCycles = perfStats[i].weightedLoadedCycles -
-                                        perfStats[i - 1].weightedLoadedCycles;
-        double loadFactor = static_cast<double>(weightedLoadedCycles) /
-                            static_cast<double>(totalCycles);
-
-        // Compute core count changes
-        uint64_t numIncrements =
-            perfStats[i].numCoreIncrements - perfStats[i - 1].numCoreIncrements;
-        uint64_t numDecrements =
-            perfStats[i].numCoreDecrements - perfStats[i - 1].numCoreDecrements;
-
-        // Compute clipping.
-        uint64_t loadClipCount =
-            numTimesLoadClipped[i] - numTimesLoadClipped[i - 1];
-
-        // Median and 99% Latency
-        // Note that this computation will modify data
-        Statistics mathStats = computeStatistics(latencies + indices[i - 1],
-                                                 indices[i] - indices[i - 1]);
+        "Clips,SI,EI,50\% Slowdown,99\% Slowdown,Max Slowdown",
+        stdout);
+    for (size_t k = 0; k < extraPercentiles.size(); k++)
+        printf(",%g\%%", extraPercentiles[k] * 100);
+    if (reportWork)
+        fputs(",Work Rate,Work Slowdown", stdout);
+    if (reportBlocking)
+        fputs(",Active Cores,Blocked Threads", stdout);
+    if (scratchFile) {
+        fputs(",No I/O 50\% Latency,No I/O 99\%,I/O 50\% Latency,I/O 99\%",
+              stdout);
+    }
+    if (startDelays || startDelayHistograms.inUse())
+        fputs(",50\% Start Delay,99\% Start Delay,Overhead/Request,"
+              "Throughput/Core",
+              stdout);
+    for (size_t s = 0; s < numStages; s++)
+        printf(",Stage %zu Queueing", s + 1);
+    if (bursts) {
+        fputs(",Bursts,50\% Burst Completion,Max Burst Completion,Reacted,"
+              "50\% Core Reaction,Max Core Reaction",
+              stdout);
+    }
+    if (stragglerTimes || stragglerHistograms.inUse())
+        fputs(",Fan-out,50\% Straggler,99\% Straggler", stdout);
+    putchar('\n');
+}
+
+/**
+ * Print the statistics of every interval. Intervals are independent, so they
+ * are computed in parallel on every available core and then printed in
+ * order. This runs after Arachne has shut down, so its cores are free.
+ */
+void
+postProcessResults() {
+    // Sanity check
+    for (int d = 0; d < numDispatchers; d++) {
+        if (dispatchers[d].arrayIndex > dispatchers[d].sliceEnd) {
+            fprintf(stderr,
+                    "Benchmark wrote past the end of latency array. Assuming "
+                    "memory corruption. Final index written = %lu, slice end "
+                    "= %lu\n",
+                    dispatchers[d].arrayIndex, dispatchers[d].sliceEnd);
+            abort();
+        }
+    }
+
+    std::vector<std::string> rows(perfStats.size());
+    std::atomic<size_t> nextInterval(1);
+    auto worker = [&rows, &nextInterval]() {
+        PostProcessBuffers buffers;
+        for (size_t i = nextInterval++; i < rows.size(); i = nextInterval++)
+            rows[i] = formatInterval(i, &buffers);
+    };
+    unsigned numThreads = std::max(std::thread::hardware_concurrency(), 1U);
+    std::vector<std::thread> threads;
+    for (unsigned t = 1; t < numThreads; t++)
+        threads.emplace_back(worker);
+    worker();
+    for (std::thread& thread : threads)
+        thread.join();
+
+    printHeader();
+    for (size_t i = 1; i < rows.size(); i++)
+        fputs(rows[i].c_str(), stdout);
+}
+
+/**
+ * Wait until every thread created during interval i - 1 has recorded its
+ * latency.
+ */
+void
+waitForCompletions(size_t i) {
+    // A burst is complete once its last thread stores its completion time.
+    if (bursts) {
+        for (size_t b = burstIndices[i - 1]; b < burstIndices[i]; b++) {
+            while (bursts[b].completionTime.load() == 0)
+                usleep(1000);
+        }
+    }
+    if (useHistograms) {
+        uint64_t created = 0;
+        for (int d = 0; d < numDispatchers; d++) {
+            created +=
+                dispatchers[d].indices[i] - dispatchers[d].indices[i - 1];
+        }
+        while (latencyHistograms[i - 1]->count() < created ||
+               (slowdownHistograms.inUse() &&
+                slowdownHistograms[i - 1]->count() < created))
+            usleep(1000);
+        return;
+    }
+
+    // The array starts zeroed and no latency is zero, so a slot is complete
+    // once it is nonzero.
+    for (int d = 0; d < numDispatchers; d++) {
+        for (uint64_t j = dispatchers[d].indices[i - 1];
+             j < dispatchers[d].indices[i]; j++) {
+            while (__atomic_load_n(&latencies[j], __ATOMIC_ACQUIRE) == 0)
+                usleep(1000);
+        }
+    }
+}
+
+/**
+ * Return the whole pages between begin and end to the kernel.
+ */
+void
+releaseRange(uint64_t* begin, uint64_t* end) {
+    uintptr_t pageMask = ~static_cast<uintptr_t>(getpagesize() - 1);
+    uintptr_t first =
+        (reinterpret_cast<uintptr_t>(begin) + ~pageMask) & pageMask;
+    uintptr_t last = reinterpret_cast<uintptr_t>(end) & pageMask;
+    if (first < last)
+        madvise(reinterpret_cast<void*>(first), last - first, MADV_DONTNEED);
+}
+
+/**
+ * Allocate the histogram of the given interval in histograms, if histograms
+ * of that kind are in use.
+ */
+void
+allocateHistogram(ChunkedArray<LatencyHistogram*>* histograms,
+                  size_t interval) {
+    if (!histograms->inUse())
+        return;
+    histograms->resize(interval + 1);
+    (*histograms)[interval] = new LatencyHistogram(histogramPrecision);
+}
+
+/**
+ * Grow the records that the threads of the given interval write into: its
+ * histograms, if histograms are in use, its work totals and its pipeline
+ * queueing totals. The leader calls this as it opens the interval, before any
+ * thread of the interval can record into them, so only the intervals that
+ * have started and not yet been released hold any.
+ */
+void
+allocateInterval(size_t interval) {
+    if (stageQueueingCycles.inUse())
+        stageQueueingCycles.resize((interval + 1) * MAX_STAGES);
+    if (workTotals.inUse())
+        workTotals.resize(interval + 1);
+    if (!useHistograms)
+        return;
+    allocateHistogram(&latencyHistograms, interval);
+    allocateHistogram(&slowdownHistograms, interval);
+    allocateHistogram(&diskIoHistograms, interval);
+    allocateHistogram(&noDiskIoHistograms, interval);
+    allocateHistogram(&stragglerHistograms, interval);
+    allocateHistogram(&startDelayHistograms, interval);
+}
+
+/**
+ * Free the histogram of interval i - 1 in histograms, if histograms of that
+ * kind are in use and the run reached the interval, and any chunks of them
+ * that are no longer needed.
+ */
+void
+releaseHistogram(ChunkedArray<LatencyHistogram*>* histograms, size_t i) {
+    if (!histograms->inUse() || histograms->size() < i)
+        return;
+    delete (*histograms)[i - 1];
+    (*histograms)[i - 1] = NULL;
+    histograms->releaseBefore(i);
+}
 
-        // Convert statistics output to nanoseconds
-        mathStats.median = Cycles::toNanoseconds(mathStats.median);
-        mathStats.P90 = Cycles::toNanoseconds(mathStats.P90);
-        mathStats.P99 = Cycles::toNanoseconds(mathStats.P99);
-        mathStats.max = Cycles::toNanoseconds(mathStats.max);
+/**
+ * Free the raw data of interval i - 1 once its row has been printed, along
+ * with whatever per-interval records no later row needs.
+ */
+void
+releaseInterval(size_t i) {
+    intervals.releaseBefore(i);
+    perfStats.releaseBefore(i);
+    activeCores.releaseBefore(i);
+    blockedThreads.releaseBefore(i);
+    burstIndices.releaseBefore(i);
+    for (int d = 0; d < numDispatchers; d++) {
+        dispatchers[d].indices.releaseBefore(i);
+        dispatchers[d].numTimesLoadClipped.releaseBefore(i);
+    }
+    stageQueueingCycles.releaseBefore(i * MAX_STAGES);
+    workTotals.releaseBefore(i);
+    if (useHistograms) {
+        releaseHistogram(&latencyHistograms, i);
+        releaseHistogram(&slowdownHistograms, i);
+        releaseHistogram(&diskIoHistograms, i);
+        releaseHistogram(&noDiskIoHistograms, i);
+        releaseHistogram(&stragglerHistograms, i);
+        releaseHistogram(&startDelayHistograms, i);
+        return;
+    }
+    for (int d = 0; d < numDispatchers; d++) {
+        uint64_t begin = dispatchers[d].indices[i - 1];
+        uint64_t end = dispatchers[d].indices[i];
+        releaseRange(latencies + begin, latencies + end);
+        if (serviceTimes)
+            releaseRange(serviceTimes + begin, serviceTimes + end);
+        if (executionTimes)
+            releaseRange(executionTimes + begin, executionTimes + end);
+        if (stragglerTimes)
+            releaseRange(stragglerTimes + begin, stragglerTimes + end);
+        if (startDelays)
+            releaseRange(startDelays + begin, startDelays + end);
+    }
+}
 
-        printf("%lf,%lf,%lf,%lf,%lu,%lu,%lu,%lu,%lu,%lf,%lu,%lu,%lu,%lu,%lu\n",
-               durationOfInterval, intervals[i - 1].creationsPerSecond,
-               utilization, coresUsed, mathStats.median, mathStats.P90,
-               mathStats.P99, mathStats.max, throughput, loadFactor,
-               numIncrements, numDecrements, loadClipCount, indices[i - 1],
-               indices[i]);
+/**
+ * Print each interval's row as soon as every dispatcher has closed the
+ * interval and all of its threads have completed, then release its raw data.
+ * This runs on a kernel thread outside Arachne, so its work does not count
+ * toward Arachne's load estimates.
+ */
+void
+reportIntervals() {
+    printHeader();
+    fflush(stdout);
+    PostProcessBuffers buffers;
+    for (size_t i = 1; i <= numIntervals; i++) {
+        for (int d = 0; d < numDispatchers; d++) {
+            while (dispatchers[d].numIndicesPublished.load(
+                       std::memory_order_acquire) <= i)
+                usleep(1000);
+        }
+        waitForCompletions(i);
+        fputs(formatInterval(i, &buffers).c_str(), stdout);
+        fflush(stdout);
+        releaseInterval(i);
     }
 }
 
+/**
+ * Write every burst to burstFile, with its arrival relative to the start of
+ * the load and its times in nanoseconds.
+ */
+void
+writeBursts() {
+    FILE* file = fopen(burstFile, "w");
+    if (!file) {
+        fprintf(stderr, "Error opening burst file %s: %s\n", burstFile,
+                strerror(errno));
+        return;
+    }
+    fprintf(file, "Interval,Arrival,Size,Completion,Core Reaction\n");
+    for (size_t b = 0; b < numBursts; b++) {
+        const Burst& burst = bursts[b];
+        fprintf(file, "%lu,%lu,%u,%lu,", burst.interval,
+                Cycles::toNanoseconds(burst.arrivalTime -
+                                      perfStats[0].collectionTime),
+                burst.size,
+                Cycles::toNanoseconds(burst.completionTime -
+                                      burst.arrivalTime));
+        if (burst.reactionTime != 0) {
+            fprintf(file, "%lu\n",
+                    Cycles::toNanoseconds(burst.reactionTime -
+                                          burst.arrivalTime));
+        } else {
+            fprintf(file, "NA\n");
+        }
+    }
+    fclose(file);
+}
+
 void
 printTime() {
     struct timeval tv;
@@ -157,18 +1751,85 @@ printTime() {
             millisecondsSinceEpoch);
 }
 
+/**
+ * Collect the PerfStats at a change in load, along with the number of active
+ * cores and blocked threads if any interval blocks.
+ */
+void
+collectPerfStats(PerfStats* stats, CorePolicy::CoreList& allCores) {
+    PerfStats::collectStats(stats, allCores);
+    // The executor's threads are busy for as long as they use the CPU, and
+    // are never idle as far as the statistics go.
+    if (executor)
+        stats->totalCycles += executor->getCpuCycles();
+    perfStats.push_back(*stats);
+    if (reportBlocking) {
+        activeCores.push_back(Arachne::numActiveCores);
+        blockedThreads.push_back(
+            numSleeping.load(std::memory_order_relaxed) +
+            (backend ? backend->getNumPending() : 0));
+    }
+}
+
+/**
+ * Add interval i to the arrival schedule of every dispatcher, if arrivals are
+ * scheduled.
+ */
 void
-dispatch(const char* benchmarkFile) {
-    // Prevent scheduling onto this core, since threads scheduled to this core
-    // will never get a chance to run.
-    uint32_t arrayIndex = 0;
+scheduleInterval(size_t i) {
+    for (int d = 0; dispatchers && d < numDispatchers; d++) {
+        if (dispatchers[d].schedule) {
+            dispatchers[d].schedule->addInterval(
+                intervals[i].creationsPerSecond / numDispatchers,
+                intervals[i].timeToRun, &intervals[i].serviceTime);
+        }
+    }
+}
 
-    // Page in our data store
-    MAX_ENTRIES = 1L << ARRAY_EXP;
-    latencies = new uint64_t[MAX_ENTRIES];
-    memset(latencies, 0, MAX_ENTRIES * sizeof(uint64_t));
+/**
+ * Fill in intervals from the load profile up to, but not including, end, and
+ * schedule their arrivals.
+ */
+void
+expandIntervals(size_t end) {
+    LoadProfile::Interval next;
+    for (; numExpandedIntervals < end && profile->next(&next);
+         numExpandedIntervals++) {
+        intervals.resize(numExpandedIntervals + 1);
+        Interval& interval = intervals[numExpandedIntervals];
+        interval.timeToRun = next.timeToRun;
+        interval.creationsPerSecond = next.load;
+        interval.durationPerThread = next.durationPerThread;
+        interval.serviceTime = next.serviceTime;
+        parseServiceTime("", 0, &interval.thinkTime);
+        interval.kernel = defaultKernel;
+        interval.blocking = defaultBlocking;
+        interval.diskIo = defaultDiskIo;
+        interval.fanOut = defaultFanOut;
+        interval.burst.size = 0;
+        std::fill(interval.stageDurations, interval.stageDurations + MAX_STAGES,
+                  next.durationPerThread);
+        scheduleInterval(numExpandedIntervals);
+    }
+}
 
-    PerfUtils::Util::serialize();
+/**
+ * Generate this dispatcher's share of the offered load for every interval.
+ * The leader (dispatcher 0) additionally advances the intervals and collects
+ * PerfStats at each change in load; the others follow sharedInterval.
+ */
+void
+generateLoad(Dispatcher* dispatcher) {
+    bool isLeader = dispatcher->id == 0;
+    int cpu = sched_getcpu();
+    if (executor && executor->usesCpu(cpu)) {
+        fprintf(stderr,
+                "Dispatcher %d runs on CPU %d, which is in --executorCpus\n",
+                dispatcher->id, cpu);
+        exit(1);
+    }
+    uint64_t arrayIndex = dispatcher->arrayIndex;
+    double shareOfLoad = 1.0 / numDispatchers;
 
     // Initialize interval
     size_t currentInterval = 0;
@@ -176,27 +1837,267 @@ dispatch(const char* benchmarkFile) {
     // Start with a DCFT-style implementation based on shared-memory for
     // communication If that becomes too expensive, then switch to a separate
     // thread for commands.
-    uint64_t cyclesPerThread =
-        Cycles::fromNanoseconds(intervals[currentInterval].durationPerThread);
+    ServiceTimeGenerator serviceTime;
+    serviceTime.setDistribution(intervals[currentInterval].serviceTime);
+
+    // With --seed, this only draws the jitter and service times of bursts,
+    // which are not in the schedule.
+    std::random_device rd;
+    std::mt19937 gen(useSchedule ? seed + static_cast<uint32_t>(dispatcher->id)
+                                 : rd());
+
+    std::exponential_distribution<double> intervalGenerator(
+        intervals[currentInterval].creationsPerSecond * shareOfLoad);
+    std::uniform_real_distribution<> uniformIG(
+        0, 2.0 / (intervals[currentInterval].creationsPerSecond * shareOfLoad));
+
+    // Compute the time of the arrival after one at the given time, either
+    // from the trace, from the precomputed schedule or by drawing from the
+    // distribution.
+    ArrivalSchedule* schedule = dispatcher->schedule;
+    uint64_t traceStart = 0;
+    uint64_t traceServiceCycles = 0;
+    auto nextTime = [&](uint64_t previousArrival) -> uint64_t {
+        if (trace) {
+            const TraceRecord* record = trace->next();
+            if (!record)
+                return NO_MORE_ARRIVALS;
+            traceServiceCycles = Cycles::fromNanoseconds(record->serviceTime);
+            return traceStart + Cycles::fromNanoseconds(record->arrivalOffset);
+        }
+        if (distType == UNIFORM)
+            return nextArrival(schedule, previousArrival, gen, uniformIG);
+        return nextArrival(schedule, previousArrival, gen, intervalGenerator);
+    };
+    if (schedule)
+        schedule->startInterval(currentInterval);
+
+    // In an interval with bursts, each burst is due at nominalBurstTime,
+    // give or take the jitter; burstLeft of the threads of the current burst
+    // are still to be created.
+    uint64_t nominalBurstTime = 0;
+    uint32_t burstLeft = 0;
+    Burst* burst = NULL;
+    auto nextBurst = [&]() -> uint64_t {
+        uint64_t jitter =
+            Cycles::fromNanoseconds(intervals[currentInterval].burst.jitter);
+        if (jitter == 0)
+            return nominalBurstTime;
+        std::uniform_int_distribution<uint64_t> offset(0, 2 * jitter);
+        return nominalBurstTime + offset(gen) - jitter;
+    };
+    size_t unreactedBurst = 0;
+
+    uint64_t loadClipCount = 0;
+    dispatcher->indices.push_back(arrayIndex);
+    dispatcher->numTimesLoadClipped.push_back(loadClipCount);
+    dispatcher->numIndicesPublished.store(1, std::memory_order_release);
+
+    int numTotalCores = static_cast<int>(std::thread::hardware_concurrency());
+    CorePolicy::CoreList allCores(numTotalCores);
+    for (int i = 0; i < numTotalCores; i++) {
+        allCores.add(i);
+    }
+
+    PerfStats stats;
+    if (isLeader) {
+        collectPerfStats(&stats, allCores);
+        loadStarted = true;
+    } else {
+        while (!loadStarted)
+            ;
+    }
+
+    traceStart = Cycles::rdtsc();
+    uint64_t nextCycleTime = nextTime(traceStart);
+    if (intervals[currentInterval].burst.size > 0) {
+        nominalBurstTime = traceStart;
+        nextCycleTime = nextBurst();
+    }
+    // Bursts are only tracked if some interval has them.
+    if (isLeader && bursts)
+        burstIndices.push_back(numBursts);
+
+    uint64_t currentTime = Cycles::rdtsc();
+    uint64_t nextIntervalTime =
+        currentTime +
+        Cycles::fromNanoseconds(intervals[currentInterval].timeToRun);
+
+    // TODO: Output the real time with us granularity.
+    if (isLeader)
+        printTime();
+    // DCFT loop
+    for (;; currentTime = Cycles::rdtsc()) {
+        // A burst's reaction is the first change in the number of cores
+        // since it arrived.
+        while (unreactedBurst < numBursts &&
+               bursts[unreactedBurst].coresAtArrival !=
+                   Arachne::numActiveCores) {
+            bursts[unreactedBurst].reactionTime = currentTime;
+            unreactedBurst++;
+        }
+        if (nextCycleTime < currentTime) {
+            uint64_t targetIndex = arrayIndex++;
+            if (targetIndex >= dispatcher->sliceEnd) {
+                fprintf(stderr, "Death by out of bounds\n");
+                exit(0);
+            }
+            // The schedule only has arrivals and service times for intervals
+            // without bursts.
+            const BurstSpec& burstSpec = intervals[currentInterval].burst;
+            uint64_t serviceCycles;
+            if (trace)
+                serviceCycles = traceServiceCycles;
+            else if (schedule && burstSpec.size == 0)
+                serviceCycles = schedule->serviceTime();
+            else
+                serviceCycles = serviceTime(gen);
+            if (burstSpec.size > 0 && burstLeft == 0) {
+                if (numBursts == maxBursts) {
+                    fprintf(stderr, "Too many bursts\n");
+                    exit(1);
+                }
+                burst = &bursts[numBursts];
+                burst->interval = currentInterval;
+                burst->arrivalTime = nextCycleTime;
+                burst->size = burstSpec.size;
+                burst->remaining = burstSpec.size;
+                burst->completionTime = 0;
+                burst->coresAtArrival = Arachne::numActiveCores;
+                burst->reactionTime = 0;
+                numBursts++;
+                burstLeft = burstSpec.size;
+            }
+            if (reportStartDelay)
+                numInFlight.fetch_add(1, std::memory_order_relaxed);
+            server->submit(serviceCycles, nextCycleTime, targetIndex,
+                           currentInterval, burstLeft > 0 ? burst : NULL);
+            if (burstLeft > 0) {
+                // Every thread of a burst has the same arrival time, so the
+                // next is due as soon as this one is created.
+                if (--burstLeft > 0)
+                    continue;
+                nominalBurstTime += Cycles::fromNanoseconds(burstSpec.period);
+                nextCycleTime = nextBurst();
+            }
+            if (burstSpec.size == 0)
+                nextCycleTime = nextTime(nextCycleTime);
+            // Clip the nextCycle time to the current time if we're about to go
+            // into instability. Trace arrivals are at absolute times, so
+            // clipping one does not shift the rest of the trace. This way, we
+            // do not keep falling further and further behind and have latency
+            // proportional to the running time of the experiment but we do
+            // create threads as fast as possible when we are not meeting the
+            // threshold.
+            if (nextCycleTime < currentTime) {
+                nextCycleTime = currentTime;
+                loadClipCount++;
+            }
+        }
+
+        bool intervalOver;
+        if (isLeader) {
+            intervalOver = nextIntervalTime < currentTime;
+        } else {
+            intervalOver = sharedInterval.load(std::memory_order_acquire) !=
+                           currentInterval;
+        }
+
+        if (intervalOver) {
+            // Collect latency, throughput, and core utilization information
+            // from the past interval
+            if (isLeader) {
+                collectPerfStats(&stats, allCores);
+            }
+            // A trace's offered load is whatever arrived in the interval.
+            if (trace) {
+                intervals[currentInterval].creationsPerSecond =
+                    static_cast<double>(arrayIndex -
+                                        dispatcher->indices.back()) /
+                    (static_cast<double>(traceInterval) * 1e-9);
+            }
+            if (isLeader && bursts)
+                burstIndices.push_back(numBursts);
+            dispatcher->indices.push_back(arrayIndex);
+            dispatcher->numTimesLoadClipped.push_back(loadClipCount);
+            dispatcher->numIndicesPublished.store(dispatcher->indices.size(),
+                                                  std::memory_order_release);
+
+            // Advance the interval
+            currentInterval++;
+            if (isLeader) {
+                if (profile)
+                    expandIntervals(currentInterval + 2);
+                if (currentInterval < numIntervals)
+                    allocateInterval(currentInterval);
+                sharedInterval.store(currentInterval,
+                                     std::memory_order_release);
+            }
+            if (currentInterval == numIntervals)
+                break;
+
+            // Trace intervals stay aligned with the trace's own clock, and the
+            // trace supplies arrivals and service times, so there is nothing
+            // else to update.
+            if (trace) {
+                nextIntervalTime =
+                    traceStart + Cycles::fromNanoseconds(
+                                     traceInterval * (currentInterval + 1));
+                continue;
+            }
+            nextIntervalTime =
+                currentTime +
+                Cycles::fromNanoseconds(intervals[currentInterval].timeToRun);
+            serviceTime.setDistribution(
+                intervals[currentInterval].serviceTime);
+            double creationsPerSecond =
+                intervals[currentInterval].creationsPerSecond * shareOfLoad;
+            if (schedule) {
+                schedule->startInterval(currentInterval);
+            } else {
+                intervalGenerator.param(
+                    std::exponential_distribution<double>::param_type(
+                        creationsPerSecond));
+                uniformIG.param(
+                    std::uniform_real_distribution<double>::param_type(
+                        0, 2.0 / creationsPerSecond));
+            }
+            nextCycleTime = nextTime(Cycles::rdtsc());
+            if (intervals[currentInterval].burst.size > 0) {
+                nominalBurstTime = Cycles::rdtsc();
+                nextCycleTime = nextBurst();
+            }
+        }
+    }
+    dispatcher->arrayIndex = arrayIndex;
+}
+
+/**
+ * Generate the load of the closed-loop mode on the leader dispatcher. Each
+ * client has at most one request outstanding; when it completes, the client
+ * thinks for a time drawn from the interval's think time distribution and then
+ * issues its next request. Clients are added when an interval calls for more
+ * of them, and clients beyond the current count stop issuing requests once
+ * their outstanding one completes.
+ */
+void
+generateClosedLoad(Dispatcher* dispatcher) {
+    uint64_t arrayIndex = dispatcher->arrayIndex;
+
+    // Initialize interval
+    size_t currentInterval = 0;
+
+    ServiceTimeGenerator serviceTime;
+    serviceTime.setDistribution(intervals[currentInterval].serviceTime);
+    ServiceTimeGenerator thinkTime;
+    thinkTime.setDistribution(intervals[currentInterval].thinkTime);
 
     std::random_device rd;
-    std::mt19937 gen(rd());
+    std::mt19937 gen(useSchedule ? seed : rd());
 
-    std::exponential_distribution<double> intervalGenerator(
-        intervals[currentInterval].creationsPerSecond);
-    std::uniform_real_distribution<> uniformIG(
-        0, 2.0 / intervals[currentInterval].creationsPerSecond);
-
-    uint64_t nextCycleTime;
-    switch (distType) {
-        case POISSON:
-            nextCycleTime =
-                Cycles::rdtsc() + Cycles::fromSeconds(intervalGenerator(gen));
-            break;
-        case UNIFORM:
-            nextCycleTime =
-                Cycles::rdtsc() + Cycles::fromSeconds(uniformIG(gen));
-    }
+    dispatcher->indices.push_back(arrayIndex);
+    dispatcher->numTimesLoadClipped.push_back(0);
+    dispatcher->numIndicesPublished.store(1, std::memory_order_release);
 
     int numTotalCores = static_cast<int>(std::thread::hardware_concurrency());
     CorePolicy::CoreList allCores(numTotalCores);
@@ -205,91 +2106,304 @@ dispatch(const char* benchmarkFile) {
     }
 
     PerfStats stats;
-    PerfStats::collectStats(&stats, allCores);
-    uint64_t loadClipCount = 0;
+    collectPerfStats(&stats, allCores);
 
-    indices.push_back(arrayIndex);
-    numTimesLoadClipped.push_back(loadClipCount);
-    perfStats.push_back(stats);
+    // Clients are allocated individually so that they never move while their
+    // requests hold pointers to them. Plain new does not honor their
+    // alignment before C++17.
+    std::vector<Client*> clients;
+    size_t numClients = 0;
+    auto setNumClients = [&](size_t count, uint64_t now) {
+        while (clients.size() < count) {
+            void* memory;
+            if (posix_memalign(&memory, alignof(Client), sizeof(Client)) !=
+                0) {
+                fprintf(stderr, "Failed to allocate a client\n");
+                exit(1);
+            }
+            Client* client = new (memory) Client;
+            client->completionTime = now;
+            client->thinking = false;
+            clients.push_back(client);
+        }
+        numClients = count;
+    };
 
     uint64_t currentTime = Cycles::rdtsc();
+    setNumClients(
+        static_cast<size_t>(intervals[currentInterval].creationsPerSecond),
+        currentTime);
     uint64_t nextIntervalTime =
         currentTime +
         Cycles::fromNanoseconds(intervals[currentInterval].timeToRun);
 
-    // TODO: Output the real time with us granularity.
     printTime();
-    // DCFT loop
     for (;; currentTime = Cycles::rdtsc()) {
-        if (nextCycleTime < currentTime) {
+        for (size_t c = 0; c < numClients; c++) {
+            Client* client = clients[c];
+            if (!client->thinking) {
+                uint64_t completionTime =
+                    client->completionTime.load(std::memory_order_acquire);
+                if (completionTime == 0)
+                    continue;
+                client->nextRequestTime = completionTime + thinkTime(gen);
+                client->thinking = true;
+            }
+            if (client->nextRequestTime > currentTime)
+                continue;
+
             uint64_t targetIndex = arrayIndex++;
-            if (targetIndex > MAX_ENTRIES) {
+            if (targetIndex >= dispatcher->sliceEnd) {
                 fprintf(stderr, "Death by out of bounds\n");
                 exit(0);
             }
+            client->thinking = false;
+            client->completionTime = 0;
             // Keep trying to create this thread until we succeed.
-            while (Arachne::createThread(fixedWork, cyclesPerThread,
-                                         nextCycleTime,
-                                         targetIndex) == Arachne::NullThread)
+            while (Arachne::createThread(clientRequest, serviceTime(gen),
+                                         client->nextRequestTime, targetIndex,
+                                         currentInterval, client) ==
+                   Arachne::NullThread)
                 ;
-
-            switch (distType) {
-                case POISSON:
-                    nextCycleTime = nextCycleTime +
-                                    Cycles::fromSeconds(intervalGenerator(gen));
-                    break;
-                case UNIFORM:
-                    nextCycleTime =
-                        nextCycleTime + Cycles::fromSeconds(uniformIG(gen));
-            }
-            // Clip the nextCycle time to the current time if we're about to go
-            // into instability. This way, we do not keep falling further and
-            // further behind and have latency proportional to the running time
-            // of the experiment but we do create threads as fast as possible
-            // when we are not meeting the threshold.
-            if (nextCycleTime < currentTime) {
-                nextCycleTime = currentTime;
-                loadClipCount++;
-            }
         }
 
         if (nextIntervalTime < currentTime) {
             // Collect latency, throughput, and core utilization information
             // from the past interval
-            PerfStats::collectStats(&stats, allCores);
-            indices.push_back(arrayIndex);
-            numTimesLoadClipped.push_back(loadClipCount);
-            perfStats.push_back(stats);
+            collectPerfStats(&stats, allCores);
+            dispatcher->indices.push_back(arrayIndex);
+            dispatcher->numTimesLoadClipped.push_back(0);
+            dispatcher->numIndicesPublished.store(dispatcher->indices.size(),
+                                                  std::memory_order_release);
 
             // Advance the interval
             currentInterval++;
+            if (profile)
+                expandIntervals(currentInterval + 2);
+            sharedInterval.store(currentInterval, std::memory_order_release);
             if (currentInterval == numIntervals)
                 break;
+            allocateInterval(currentInterval);
 
             nextIntervalTime =
                 currentTime +
                 Cycles::fromNanoseconds(intervals[currentInterval].timeToRun);
-            cyclesPerThread = Cycles::fromNanoseconds(
-                intervals[currentInterval].durationPerThread);
-            switch (distType) {
-                case POISSON:
-                    intervalGenerator.param(
-                        std::exponential_distribution<double>::param_type(
-                            intervals[currentInterval].creationsPerSecond));
-                    nextCycleTime = Cycles::rdtsc() +
-                                    Cycles::fromSeconds(intervalGenerator(gen));
-                    break;
-                case UNIFORM:
-                    uniformIG.param(
-                        std::uniform_real_distribution<double>::param_type(
-                            0,
-                            2.0 /
-                                intervals[currentInterval].creationsPerSecond));
-                    nextCycleTime =
-                        Cycles::rdtsc() + Cycles::fromSeconds(uniformIG(gen));
+            serviceTime.setDistribution(
+                intervals[currentInterval].serviceTime);
+            thinkTime.setDistribution(intervals[currentInterval].thinkTime);
+            setNumClients(static_cast<size_t>(
+                              intervals[currentInterval].creationsPerSecond),
+                          currentTime);
+        }
+    }
+    dispatcher->arrayIndex = arrayIndex;
+
+    // Requests still running hold pointers to their clients, so these are
+    // only freed once every request has completed.
+    for (size_t c = 0; c < clients.size(); c++) {
+        while (clients[c]->completionTime.load(std::memory_order_acquire) ==
+               0)
+            Arachne::yield();
+        clients[c]->~Client();
+        free(clients[c]);
+    }
+}
+
+void
+dispatch() {
+    bool variableServiceTimes =
+        trace != NULL || (profile && profile->hasVariableServiceTimes());
+    bool useKernels = defaultKernel != NULL;
+    bool useBackend = defaultBlocking.count > 0 && !defaultBlocking.sleep;
+    reportBlocking = defaultBlocking.count > 0;
+    bool useDiskIo = defaultDiskIo.fraction > 0;
+    bool useFanOut = defaultFanOut.count > 0;
+    for (size_t i = 0; !profile && i < numIntervals; i++) {
+        if (intervals[i].burst.size > 0) {
+            maxBursts += intervals[i].timeToRun / intervals[i].burst.period + 1;
+        }
+        if (intervals[i].serviceTime.type != ServiceTime::FIXED)
+            variableServiceTimes = true;
+        if (intervals[i].kernel)
+            useKernels = true;
+        if (intervals[i].diskIo.fraction > 0)
+            useDiskIo = true;
+        if (intervals[i].fanOut.count > 0)
+            useFanOut = true;
+        if (intervals[i].blocking.count > 0) {
+            reportBlocking = true;
+            if (!intervals[i].blocking.sleep)
+                useBackend = true;
+        }
+    }
+    // The threads of a burst are created on Arachne, and the burst's
+    // reaction is timed by the only dispatcher.
+    if (maxBursts > 0 && (numDispatchers != 1 || closedLoop || executor ||
+                          numStages > 0 || numWorkers > 0)) {
+        fprintf(stderr,
+                "Bursts need a single dispatcher and a thread per request on "
+                "Arachne!\n");
+        exit(1);
+    }
+    if (maxBursts > 0) {
+        bursts = new Burst[maxBursts];
+        burstIndices.setMaxSize(numIntervals + 1);
+    }
+
+    // Blocking on the backend and joining children both need Arachne
+    // threads.
+    if (executor && (useBackend || useFanOut)) {
+        fprintf(stderr,
+                "The %s executor can only block by sleeping, and cannot fan "
+                "out!\n",
+                executor->getName());
+        exit(1);
+    }
+    if (useBackend) {
+        backend = new SimulatedBackend;
+        backend->start();
+    }
+    if (useDiskIo)
+        scratchFile = new ScratchFile(scratchPath, 64 << 20);
+    if (numStages > 0)
+        startPipeline();
+    if (numWorkers > 0) {
+        poolQueue = new BoundedQueue<PoolRequest>(poolCapacity);
+        for (int w = 0; w < numWorkers; w++) {
+            if (Arachne::createThread(poolWorker) == Arachne::NullThread) {
+                fprintf(stderr, "Failed to create pool worker\n");
+                exit(1);
             }
         }
     }
+    if (numStages > 0)
+        server = new PipelineServer;
+    else if (coroutineExecutor)
+        server = new CoroutineServer;
+    else if (executor)
+        server = new ExecutorServer;
+    else if (poolQueue)
+        server = new PoolServer;
+    else
+        server = new ArachneServer;
+    reportWork = useKernels;
+
+    if (useHistograms) {
+        // Histograms do not bound the number of arrivals.
+        MAX_ENTRIES = ~0UL;
+
+        // Each interval's histograms are allocated when the leader opens
+        // the interval, and with --online freed once its row is printed.
+        latencyHistograms.setMaxSize(numIntervals);
+        if (variableServiceTimes)
+            slowdownHistograms.setMaxSize(numIntervals);
+        if (useDiskIo) {
+            diskIoHistograms.setMaxSize(numIntervals);
+            noDiskIoHistograms.setMaxSize(numIntervals);
+        }
+        if (useFanOut)
+            stragglerHistograms.setMaxSize(numIntervals);
+        if (reportStartDelay)
+            startDelayHistograms.setMaxSize(numIntervals);
+        fprintf(stderr, "Using %zu bytes of histograms per interval\n",
+                LatencyHistogram(histogramPrecision).footprint() *
+                    ((variableServiceTimes ? 2 : 1) + (useDiskIo ? 2 : 0) +
+                     (useFanOut ? 1 : 0) + (reportStartDelay ? 1 : 0)));
+        // The overhead per request needs the total service time, which only
+        // the histograms would otherwise have.
+        if (useKernels || (reportStartDelay && variableServiceTimes))
+            workTotals.setMaxSize(numIntervals);
+    } else {
+        // Page in our data store
+        MAX_ENTRIES = 1L << ARRAY_EXP;
+        latencies = new uint64_t[MAX_ENTRIES];
+        memset(latencies, 0, MAX_ENTRIES * sizeof(uint64_t));
+        if (variableServiceTimes) {
+            serviceTimes = new uint64_t[MAX_ENTRIES];
+            memset(serviceTimes, 0, MAX_ENTRIES * sizeof(uint64_t));
+        }
+        if (useKernels) {
+            executionTimes = new uint64_t[MAX_ENTRIES];
+            memset(executionTimes, 0, MAX_ENTRIES * sizeof(uint64_t));
+        }
+        if (useFanOut) {
+            stragglerTimes = new uint64_t[MAX_ENTRIES];
+            memset(stragglerTimes, 0, MAX_ENTRIES * sizeof(uint64_t));
+        }
+        if (reportStartDelay) {
+            startDelays = new uint64_t[MAX_ENTRIES];
+            memset(startDelays, 0, MAX_ENTRIES * sizeof(uint64_t));
+        }
+    }
+    allocateInterval(0);
+
+    PerfUtils::Util::serialize();
+
+    // Give each dispatcher an equal slice of the latency array.
+    dispatchers = new Dispatcher[numDispatchers];
+    uint64_t sliceSize = MAX_ENTRIES / numDispatchers;
+    for (int d = 0; d < numDispatchers; d++) {
+        dispatchers[d].id = d;
+        dispatchers[d].sliceStart = d * sliceSize;
+        dispatchers[d].sliceEnd = (d + 1) * sliceSize;
+        dispatchers[d].arrayIndex = dispatchers[d].sliceStart;
+        dispatchers[d].schedule = NULL;
+
+        // The reporter thread reads these while they grow, which chunked
+        // arrays allow since their elements never move.
+        dispatchers[d].indices.setMaxSize(numIntervals + 1);
+        dispatchers[d].numTimesLoadClipped.setMaxSize(numIntervals + 1);
+        dispatchers[d].numIndicesPublished = 0;
+    }
+    perfStats.setMaxSize(numIntervals + 1);
+    activeCores.setMaxSize(numIntervals + 1);
+    blockedThreads.setMaxSize(numIntervals + 1);
+
+    // Draw arrivals ahead of the dispatch loop so the generator stays off the
+    // dispatch path. Each dispatcher gets its own stream, derived from the
+    // seed.
+    if (useSchedule && !closedLoop) {
+        ArrivalSchedule::Distribution distribution =
+            distType == POISSON ? ArrivalSchedule::POISSON
+                                : ArrivalSchedule::UNIFORM;
+        for (int d = 0; d < numDispatchers; d++) {
+            dispatchers[d].schedule = new ArrivalSchedule(seed + d,
+                                                          distribution);
+        }
+        // A profile's later intervals are scheduled as they are expanded.
+        size_t numScheduled = profile ? numExpandedIntervals : numIntervals;
+        for (size_t i = 0; i < numScheduled; i++)
+            scheduleInterval(i);
+    }
+
+    // Every dispatcher needs a core of its own, since threads scheduled to a
+    // dispatcher's core will never get a chance to run.
+    std::thread reporter;
+    if (reportOnline)
+        reporter = std::thread(reportIntervals);
+    MemorySampler* memorySampler = NULL;
+    if (reportStartDelay)
+        memorySampler = new MemorySampler;
+
+    std::vector<Arachne::ThreadId> followers;
+    for (int d = 1; d < numDispatchers; d++) {
+        followers.push_back(Arachne::createThreadWithClass(
+            Arachne::DefaultCorePolicy::EXCLUSIVE, generateLoad,
+            &dispatchers[d]));
+        if (followers.back() == Arachne::NullThread) {
+            fprintf(stderr, "Failed to create dispatcher %d\n", d);
+            exit(1);
+        }
+    }
+    if (closedLoop)
+        generateClosedLoad(&dispatchers[0]);
+    else
+        generateLoad(&dispatchers[0]);
+    for (Arachne::ThreadId follower : followers)
+        Arachne::join(follower);
+
+    server->stop();
+
     // Wait for completions so the checksum will be useful. Exactly two threads
     // should exist when this loop exits. One is the core scaling thread and
     // one is this thread.
@@ -304,12 +2418,17 @@ dispatch(const char* benchmarkFile) {
         if (sum == 2)
             break;
     }
+    if (memorySampler) {
+        memorySampler->stop();
+        delete memorySampler;
+    }
+    if (backend)
+        backend->stop();
+    if (reporter.joinable())
+        reporter.join();
 
-    // We can compute statistics and then shut down since we already stored the
-    // last index of the last interval.
-    postProcessResults(benchmarkFile, arrayIndex);
-
-    delete[] latencies;
+    // We can shut down and then compute statistics since we already stored
+    // the last index of the last interval.
     Arachne::shutDown();
 }
 
@@ -357,6 +2476,162 @@ installSignalHandler() {
         fprintf(stderr, "Couldn't set signal handler for SIGABRT");
 }
 
+/**
+ * Find the kernel with the given specification (see WorkKernel.h), creating
+ * and calibrating it the first time it is named. Spinning is a NULL kernel.
+ *
+ * \return
+ *      False if the specification is malformed.
+ */
+bool
+findKernel(const char* spec, WorkKernel** kernel) {
+    WorkKernel::Type type;
+    size_t workingSet;
+    if (!WorkKernel::parse(spec, &type, &workingSet))
+        return false;
+    *kernel = NULL;
+    if (type == WorkKernel::SPIN)
+        return true;
+    for (size_t k = 0; k < kernels.size(); k++) {
+        if (kernels[k]->getType() == type &&
+            kernels[k]->getWorkingSet() == workingSet) {
+            *kernel = kernels[k];
+            return true;
+        }
+    }
+    *kernel = new WorkKernel(type, workingSet);
+    kernels.push_back(*kernel);
+    return true;
+}
+
+/**
+ * Parse how threads block, as "<count> <delay_in_ns> [sleep|backend]". Threads
+ * block on the backend unless sleep is given.
+ *
+ * \return
+ *      False if the specification is malformed.
+ */
+bool
+parseBlocking(const char* spec, Blocking* blocking) {
+    char method[16] = "backend";
+    if (sscanf(spec, "%u %lu %15s", &blocking->count, &blocking->delay,
+               method) < 2)
+        return false;
+    blocking->sleep = strcmp(method, "sleep") == 0;
+    return blocking->sleep || strcmp(method, "backend") == 0;
+}
+
+/**
+ * Parse the disk I/O of threads, as "<fraction> <read|direct|fsync>" (see
+ * ScratchFile.h).
+ *
+ * \return
+ *      False if the specification is malformed.
+ */
+bool
+parseDiskIo(const char* spec, DiskIo* diskIo) {
+    char access[16];
+    return sscanf(spec, "%lf %15s", &diskIo->fraction, access) == 2 &&
+           diskIo->fraction >= 0 && diskIo->fraction <= 1 &&
+           ScratchFile::parseAccess(access, &diskIo->access);
+}
+
+/**
+ * Parse the fan-out of threads, as "<count> <child_duration_in_ns>
+ * [<distribution> [<parameters>]]" (see ServiceTime.h).
+ *
+ * \return
+ *      False if the specification is malformed.
+ */
+bool
+parseFanOut(const char* spec, FanOut* fanOut) {
+    uint64_t childDuration;
+    int consumed;
+    return sscanf(spec, "%u %lu%n", &fanOut->count, &childDuration,
+                  &consumed) == 2 &&
+           fanOut->count <= MAX_FAN_OUT &&
+           parseServiceTime(spec + consumed, childDuration,
+                            &fanOut->serviceTime);
+}
+
+// The optional clauses that may end a line of the configuration file, and
+// the keyword that starts each.
+enum Clause {
+    THINK_CLAUSE,
+    KERNEL_CLAUSE,
+    BLOCK_CLAUSE,
+    DISK_CLAUSE,
+    FANOUT_CLAUSE,
+    STAGES_CLAUSE,
+    BURST_CLAUSE,
+    NUM_CLAUSES
+};
+const char* const clauseKeywords[NUM_CLAUSES] = {
+    "think", "kernel", "block", "disk", "fanout", "stages", "burst"};
+
+/**
+ * Split the optional clauses off a line of the configuration file. The line
+ * is split into words, and each word that is a whole keyword starts a clause,
+ * which runs until the next keyword; the keyword is cut off, so that the
+ * line ends before its first clause and clauses[c] holds the arguments of
+ * clause c, or NULL if the line has none.
+ *
+ * \return
+ *      False if a clause appears more than once.
+ */
+bool
+splitClauses(char* line, char* clauses[NUM_CLAUSES]) {
+    std::fill(clauses, clauses + NUM_CLAUSES, static_cast<char*>(NULL));
+    const char* whitespace = " \t\r\n";
+    char* word = line + strspn(line, whitespace);
+    while (*word != '\0') {
+        size_t length = strcspn(word, whitespace);
+        for (int c = 0; c < NUM_CLAUSES; c++) {
+            if (length != strlen(clauseKeywords[c]) ||
+                strncmp(word, clauseKeywords[c], length) != 0)
+                continue;
+            if (clauses[c])
+                return false;
+            clauses[c] = word + length;
+            *word = '\0';
+        }
+        word += length;
+        word += strspn(word, whitespace);
+    }
+    return true;
+}
+
+/**
+ * Parse a list of CPUs, as numbers and ranges such as "8-11" separated by
+ * commas.
+ *
+ * \return
+ *      False if the list is empty or malformed.
+ */
+bool
+parseCpuList(const char* list, std::vector<int>* cpus) {
+    cpus->clear();
+    for (;;) {
+        int first, last;
+        int consumed;
+        int numFields = sscanf(list, "%d%n-%d%n", &first, &consumed, &last,
+                               &consumed);
+        if (numFields < 1)
+            return false;
+        if (numFields == 1)
+            last = first;
+        if (first < 0 || last < first || last >= CPU_SETSIZE)
+            return false;
+        for (int cpu = first; cpu <= last; cpu++)
+            cpus->push_back(cpu);
+        list += consumed;
+        if (*list == '\0')
+            return true;
+        if (*list++ != ',')
+            return false;
+    }
+}
+
 /**
  * This function currently supports only long options.
  */
@@ -377,7 +2652,30 @@ parseOptions(int* argcp, const char** argv) {
     } optionSpecifiers[] = {{"arraySize", 'a', true},
                             {"distribution", 'd', true},
                             {"utilizationThreshold", 'u', true},
-                            {"loadFactorThreshold", 'f', true}};
+                            {"loadFactorThreshold", 'f', true},
+                            {"numDispatchers", 'n', true},
+                            {"seed", 's', true},
+                            // Must precede "trace", which is its prefix.
+                            {"traceInterval", 'i', true},
+                            {"trace", 't', true},
+                            // Must precede "histogram", which is its prefix.
+                            {"histogramPrecision", 'H', true},
+                            {"histogram", 'h', false},
+                            {"percentiles", 'P', true},
+                            {"online", 'o', false},
+                            {"closedLoop", 'c', false},
+                            {"kernel", 'k', true},
+                            {"block", 'b', true},
+                            // Must precede "disk", which is its prefix.
+                            {"diskFile", 'F', true},
+                            {"disk", 'D', true},
+                            {"fanOut", 'K', true},
+                            {"pipeline", 'p', true},
+                            {"workers", 'w', true},
+                            // Must precede "executor", which is its prefix.
+                            {"executorCpus", 'E', true},
+                            {"executor", 'e', true},
+                            {"burstFile", 'Q', true}};
     const int UNRECOGNIZED = ~0;
 
     int i = 1;
@@ -441,6 +2739,128 @@ parseOptions(int* argcp, const char** argv) {
                     ->getEstimator()
                     ->setLoadFactorThreshold(atof(optionArgument));
                 break;
+            case 'n':
+                numDispatchers = atoi(optionArgument);
+                if (numDispatchers < 1) {
+                    fprintf(stderr, "numDispatchers must be at least 1!\n");
+                    abort();
+                }
+                break;
+            case 's':
+                useSchedule = true;
+                seed = static_cast<uint32_t>(strtoul(optionArgument, NULL, 0));
+                break;
+            case 'i':
+                traceInterval = strtoul(optionArgument, NULL, 0);
+                break;
+            case 't':
+                traceFile = optionArgument;
+                break;
+            case 'H':
+                histogramPrecision = atoi(optionArgument);
+                if (histogramPrecision < 1 || histogramPrecision > 20) {
+                    fprintf(stderr, "histogramPrecision must be 1 to 20!\n");
+                    abort();
+                }
+                break;
+            case 'h':
+                useHistograms = true;
+                break;
+            case 'P': {
+                // A comma-separated list of percentages, e.g. 99.9,99.99
+                extraPercentiles.clear();
+                char* end = const_cast<char*>(optionArgument);
+                while (*end) {
+                    double percent = strtod(end, &end);
+                    if (percent <= 0 || percent >= 100) {
+                        fprintf(stderr, "Bad percentile in %s!\n",
+                                optionArgument);
+                        abort();
+                    }
+                    extraPercentiles.push_back(percent / 100);
+                    if (*end == ',')
+                        end++;
+                }
+                break;
+            }
+            case 'o':
+                reportOnline = true;
+                break;
+            case 'c':
+                closedLoop = true;
+                break;
+            case 'k':
+                if (!findKernel(optionArgument, &defaultKernel)) {
+                    fprintf(stderr, "Bad kernel %s!\n", optionArgument);
+                    abort();
+                }
+                break;
+            case 'b':
+                if (!parseBlocking(optionArgument, &defaultBlocking)) {
+                    fprintf(stderr, "Bad blocking %s!\n", optionArgument);
+                    abort();
+                }
+                break;
+            case 'F':
+                scratchPath = optionArgument;
+                break;
+            case 'D':
+                if (!parseDiskIo(optionArgument, &defaultDiskIo)) {
+                    fprintf(stderr, "Bad disk I/O %s!\n", optionArgument);
+                    abort();
+                }
+                break;
+            case 'K':
+                if (!parseFanOut(optionArgument, &defaultFanOut)) {
+                    fprintf(stderr, "Bad fan-out %s!\n", optionArgument);
+                    abort();
+                }
+                break;
+            case 'p':
+                // <stages> <workers_per_stage> <queue_capacity>
+                if (sscanf(optionArgument, "%zu %zu %zu", &numStages,
+                           &workersPerStage, &queueCapacity) != 3 ||
+                    numStages < 1 || numStages > MAX_STAGES ||
+                    workersPerStage < 1 || queueCapacity < 1) {
+                    fprintf(stderr, "Bad pipeline %s!\n", optionArgument);
+                    abort();
+                }
+                break;
+            case 'w': {
+                // <count> [<queue_capacity>]
+                int numFields = sscanf(optionArgument, "%d %zu", &numWorkers,
+                                       &poolCapacity);
+                if (numFields < 1 || numWorkers < 0 || poolCapacity < 1) {
+                    fprintf(stderr, "Bad workers %s!\n", optionArgument);
+                    abort();
+                }
+                reportStartDelay = true;
+                break;
+            }
+            case 'Q':
+                burstFile = optionArgument;
+                break;
+            case 'e':
+                // "arachne" runs a thread per request, as without --executor.
+                if (strcmp(optionArgument, "arachne") != 0) {
+                    coroutineExecutor =
+                        CoroutineExecutor::create(optionArgument);
+                    executor = coroutineExecutor;
+                    if (!executor)
+                        executor = ThreadExecutor::create(optionArgument);
+                    if (!executor) {
+                        fprintf(stderr, "Bad executor %s!\n", optionArgument);
+                        abort();
+                    }
+                }
+                reportStartDelay = true;
+                break;
+            case 'E':
+                if (!parseCpuList(optionArgument, &executorCpus)) {
+                    fprintf(stderr, "Bad executorCpus %s!\n", optionArgument);
+                    abort();
+                }
+                break;
             case UNRECOGNIZED:
                 fprintf(stderr, "Unrecognized option %s given.", optionName);
                 abort();
@@ -449,6 +2869,197 @@ parseOptions(int* argcp, const char** argv) {
     *argcp = argc;
 }
 
+/**
+ * Read a load profile (see LoadProfile.h) in place of a list of intervals.
+ * Only the first two intervals are expanded before the run; the leader
+ * expands each of the others as the one before it starts, so that schedules
+ * can draw its arrivals in time, and intervals are only allocated as far as
+ * the run has got.
+ */
+void
+loadProfileIntervals(const char* profileFile) {
+    profile = new LoadProfile(profileFile);
+    numIntervals = profile->numIntervals();
+    if (numIntervals == 0) {
+        printf("Load profile '%s' has no intervals!\n", profileFile);
+        exit(1);
+    }
+    intervals.setMaxSize(numIntervals);
+    expandIntervals(2);
+}
+
+/**
+ * Read the intervals to run from a configuration file.
+ */
+void
+loadIntervals(const char* benchmarkFile) {
+    // The configuration file has the following format
+    // <count_of_rows>
+    // <time_to_run_in_ns> <attempted_creations_per_second>
+    // <thread_duration_in_ns> [<service_time_distribution> [<parameters>]]
+    // [think <think_time_in_ns> [<think_time_distribution> [<parameters>]]]
+    // [kernel <kernel_name> [<working_set>]]
+    // [block <count> <delay_in_ns> [sleep|backend]]
+    // [disk <fraction> <read|direct|fsync>]
+    // [fanout <count> <child_duration_in_ns> [<distribution> [<parameters>]]]
+    // [stages <stage_2_duration_in_ns> ... <stage_N_duration_in_ns>]
+    // [burst <size> <period_in_ns> [<jitter_in_ns>]]
+    // See ServiceTime.h for the supported distributions and WorkKernel.h for
+    // the kernels. Think times are only used in closed-loop mode. The
+    // optional clauses may come in any order.
+    FILE* specFile = fopen(benchmarkFile, "r");
+    if (!specFile) {
+        printf("Configuration file '%s' non existent!\n", benchmarkFile);
+        exit(1);
+    }
+    char buffer[1024];
+    if (fgets(buffer, 1024, specFile) == NULL) {
+        printf("Error reading configuration file: %s\n", strerror(errno));
+        exit(1);
+    }
+    if (sscanf(buffer, "%zu", &numIntervals) != 1) {
+        // Not a count of rows, so it must be a load profile.
+        fclose(specFile);
+        loadProfileIntervals(benchmarkFile);
+        return;
+    }
+    intervals.setMaxSize(numIntervals);
+    intervals.resize(numIntervals);
+    for (size_t i = 0; i < numIntervals; i++) {
+        if (fgets(buffer, 1024, specFile) == NULL) {
+            printf("Error reading configuration file: %s\n", strerror(errno));
+            exit(1);
+        }
+        int consumed = 0;
+        sscanf(buffer, "%lu %lf %lu%n", &intervals[i].timeToRun,
+               &intervals[i].creationsPerSecond,
+               &intervals[i].durationPerThread, &consumed);
+
+        // Split off the optional clauses before parsing any of them, so that
+        // each one ends where the next begins.
+        char* clauses[NUM_CLAUSES];
+        if (!splitClauses(buffer + consumed, clauses)) {
+            printf("Repeated clause on line %zu\n", i + 2);
+            exit(1);
+        }
+        char* think = clauses[THINK_CLAUSE];
+        char* kernel = clauses[KERNEL_CLAUSE];
+        char* blocking = clauses[BLOCK_CLAUSE];
+        char* diskIo = clauses[DISK_CLAUSE];
+        char* fanOut = clauses[FANOUT_CLAUSE];
+        char* stages = clauses[STAGES_CLAUSE];
+        char* burst = clauses[BURST_CLAUSE];
+
+        intervals[i].kernel = defaultKernel;
+        if (kernel && !findKernel(kernel, &intervals[i].kernel)) {
+            printf("Bad kernel on line %zu: %s\n", i + 2, kernel);
+            exit(1);
+        }
+        intervals[i].blocking = defaultBlocking;
+        if (blocking && !parseBlocking(blocking, &intervals[i].blocking)) {
+            printf("Bad blocking on line %zu: %s\n", i + 2, blocking);
+            exit(1);
+        }
+        intervals[i].diskIo = defaultDiskIo;
+        if (diskIo && !parseDiskIo(diskIo, &intervals[i].diskIo)) {
+            printf("Bad disk I/O on line %zu: %s\n", i + 2, diskIo);
+            exit(1);
+        }
+        intervals[i].fanOut = defaultFanOut;
+        if (fanOut && !parseFanOut(fanOut, &intervals[i].fanOut)) {
+            printf("Bad fan-out on line %zu: %s\n", i + 2, fanOut);
+            exit(1);
+        }
+        intervals[i].burst.size = 0;
+        if (burst) {
+            BurstSpec& spec = intervals[i].burst;
+            spec.jitter = 0;
+            if (sscanf(burst, "%u %lu %lu", &spec.size, &spec.period,
+                       &spec.jitter) < 2 ||
+                spec.size == 0 || spec.period == 0 ||
+                spec.jitter > spec.period) {
+                printf("Bad burst on line %zu: %s\n", i + 2, burst);
+                exit(1);
+            }
+            // The offered load of a bursty interval is set by its bursts.
+            intervals[i].creationsPerSecond =
+                spec.size * 1e9 / static_cast<double>(spec.period);
+        }
+        // Stages without a duration of their own take the first stage's.
+        std::fill(intervals[i].stageDurations,
+                  intervals[i].stageDurations + MAX_STAGES,
+                  intervals[i].durationPerThread);
+        const char* stageDuration = stages ? stages : "";
+        int stageConsumed;
+        for (size_t stage = 1;
+             stage < MAX_STAGES &&
+             sscanf(stageDuration, "%lu%n", &intervals[i].stageDurations[stage],
+                    &stageConsumed) == 1;
+             stage++)
+            stageDuration += stageConsumed;
+        uint64_t meanThinkTime = 0;
+        int thinkConsumed = 0;
+        if (think) {
+            if (sscanf(think, "%lu%n", &meanThinkTime, &thinkConsumed) != 1) {
+                printf("Missing think time on line %zu\n", i + 2);
+                exit(1);
+            }
+        }
+        if (!parseServiceTime(buffer + consumed,
+                              intervals[i].durationPerThread,
+                              &intervals[i].serviceTime) ||
+            !parseServiceTime(think ? think + thinkConsumed : "",
+                              meanThinkTime, &intervals[i].thinkTime)) {
+            printf("Bad service or think time distribution on line %zu: %s",
+                   i + 2, buffer);
+            exit(1);
+        }
+        //        // Adjust the offered load down to match the maximum Poisson
+        //        load achieved. if (distType == UNIFORM)
+        //            // For 70% utilization threshold and load factor 225
+        //            // intervals[i].creationsPerSecond *= 0.87;
+        //            // For 85% utilization threshold, the maximum throughput
+        //            ratio for
+        //            // poisson is this much.
+        //            intervals[i].creationsPerSecond *= 0.9327956;
+    }
+    fclose(specFile);
+}
+
+/**
+ * Open the trace to replay and divide its duration into intervals of
+ * traceInterval nanoseconds.
+ */
+void
+loadTraceIntervals() {
+    if (numDispatchers != 1 || useSchedule) {
+        printf("Trace replay needs a single dispatcher and no --seed!\n");
+        exit(1);
+    }
+    if (traceInterval == 0) {
+        printf("traceInterval must be positive!\n");
+        exit(1);
+    }
+    trace = new ArrivalTrace(traceFile);
+    numIntervals = trace->duration() / traceInterval + 1;
+    intervals.setMaxSize(numIntervals);
+    intervals.resize(numIntervals);
+    for (size_t i = 0; i < numIntervals; i++) {
+        intervals[i].timeToRun = traceInterval;
+        intervals[i].durationPerThread = 0;
+        intervals[i].creationsPerSecond = 0;
+        parseServiceTime("", 0, &intervals[i].serviceTime);
+        parseServiceTime("", 0, &intervals[i].thinkTime);
+        intervals[i].kernel = defaultKernel;
+        intervals[i].blocking = defaultBlocking;
+        intervals[i].diskIo = defaultDiskIo;
+        intervals[i].fanOut = defaultFanOut;
+        intervals[i].burst.size = 0;
+        std::fill(intervals[i].stageDurations,
+                  intervals[i].stageDurations + MAX_STAGES, 0);
+    }
+}
+
 /**
  * This synthetic benchmarking tool allows us to create threads at a Poisson
  * arrival rate with a configurable mean. These threads run for a configurable
@@ -462,6 +3073,145 @@ parseOptions(int* argcp, const char** argv) {
  *
  * Note that we should probably bechmark the cost of extracting randomness as
  * well, but we haven't yet done that.
+ *
+ * A single dispatcher is limited by the rate at which one core can create
+ * threads. With --numDispatchers N, each interval's load is split evenly
+ * across N dispatchers, each on its own exclusive core, so maxNumCores must
+ * leave room for them in addition to the worker cores.
+ *
+ * With --seed S, each interval's arrivals are generated from seed S by a
+ * separate thread while the interval before it runs, so the dispatch loop does
+ * no random number generation and runs with the same seed offer identical
+ * arrivals.
+ *
+ * With --trace FILE, arrivals and service times are instead replayed from a
+ * binary trace (see ArrivalTrace.h) and no configuration file is needed. The
+ * run is divided into intervals of --traceInterval nanoseconds (50 ms by
+ * default), and each interval's offered load is the rate at which the trace
+ * delivered arrivals during it.
+ *
+ * With --histogram, each interval's latencies are counted in a log-linear
+ * histogram (see LatencyHistogram.h) of --histogramPrecision bits instead of
+ * the latency array, so runs are unbounded in length. --percentiles lists the
+ * percentiles reported after the fixed columns (99.9,99.99 by default).
+ *
+ * The configuration file may also be a load profile, which describes the load
+ * as steps, ramps, sines, square waves and diurnal curves (see LoadProfile.h)
+ * and is expanded into intervals as the run proceeds.
+ *
+ * With --closedLoop, the load is instead generated by a number of clients
+ * given in place of the creation rate. Each client issues one request at a
+ * time and, once it completes, thinks for a time given by an optional
+ * "think <ns> [<distribution>]" at the end of the interval's line before
+ * issuing the next. The Offered Load column then reports the number of
+ * clients. A profile's load is likewise the number of clients, with no think
+ * time. With --seed, the think and service times are drawn from a generator
+ * seeded with it.
+ *
+ * With --kernel SPEC, threads run a work kernel with a memory footprint (see
+ * WorkKernel.h) instead of spinning, for as long as the kernel took to run
+ * for their service time when it was calibrated. A .bench line may name a
+ * kernel for its own interval with "kernel <name> [<working_set>]" at its
+ * end. Runs with kernels add a Work Rate column, the kernel operations done
+ * per second, and a Work Slowdown column, the time threads spent running
+ * their kernels relative to their service times, which rises as cores
+ * contend for caches and memory bandwidth.
+ *
+ * With --block "<count> <delay_ns> [sleep|backend]", each thread blocks count
+ * times partway through its service time, for delay_ns each time, as a
+ * request waiting on a downstream RPC does. Threads block on a call to a
+ * simulated backend (see SimulatedBackend.h) by default, or in Arachne::sleep.
+ * A .bench line may set its own interval's blocking with "block <count>
+ * <delay_ns> [sleep|backend]" at its end. Runs with blocking add columns for
+ * the number of cores Arachne had active and the number of threads blocked
+ * at the end of each interval.
+ *
+ * With --disk "<fraction> <read|direct|fsync>", that fraction of threads do a
+ * system call that blocks their kernel thread before their service time: a
+ * read of a scratch file in the page cache, an O_DIRECT read of it, or a
+ * small append to a log followed by fsync (see ScratchFile.h). A .bench line
+ * may set its own interval's I/O with "disk <fraction> <read|direct|fsync>"
+ * at its end. The scratch file is --diskFile (SyntheticWorkload.scratch in
+ * the current directory by default), and is removed after the run. Runs
+ * with disk I/O add the median and 99% latency of the threads that did no
+ * I/O and of those that did.
+ *
+ * With --fanOut "<count> <child_duration_ns> [<distribution>]", each thread
+ * creates count children with service times from the given distribution
+ * before doing its own work, and joins them all before completing, as a
+ * request making parallel calls to several backends does. Children that
+ * cannot be created because Arachne is out of thread slots are run inline.
+ * A .bench line may set its own interval's fan-out with "fanout <count>
+ * <child_duration_ns> [<distribution>]" at its end, so that latency can be
+ * compared across counts. Runs with fan-out add the interval's count and the
+ * median and 99% straggler time, from each thread's median child completing
+ * to its last child completing.
+ *
+ * With --pipeline "<stages> <workers_per_stage> <queue_capacity>", requests
+ * pass through up to four stages in turn, as in a server that parses,
+ * computes and then serializes, instead of each running as a thread of its
+ * own. Each stage is served by long-lived worker threads that take requests
+ * from a bounded queue (see BoundedQueue.h) and pass them to the next
+ * stage's queue, blocking while it is full. The first stage's service time
+ * is the interval's; a .bench line may give each later stage a mean service
+ * time of its own, from the same distribution, with "stages <ns> ..." at its
+ * end. Runs with a pipeline add the mean time requests of each interval
+ * spent queued for each stage. Pipeline stages do kernels and blocking, but
+ * no disk I/O or fan-out.
+ *
+ * With --workers "<count> [<queue_capacity>]", a fixed pool of count
+ * long-lived threads serves the requests, taking each from a queue of up to
+ * queue_capacity (4096 unless given) that the dispatchers fill, instead of
+ * each request being created as a thread of its own. A count of 0 keeps
+ * thread-per-request, so that the same .bench file run both ways gives rows
+ * that compare directly. Either way the run adds the median and 99% start
+ * delay, from each request's arrival to the start of its work, the core time
+ * used per request beyond its service time, and the throughput per core,
+ * not counting the dispatchers' cores, which spin throughout.
+ *
+ * With --executor, the same arrivals are served by kernel threads rather
+ * than Arachne threads (see ThreadExecutor.h): "pthread" creates a pthread
+ * per request, "pthreadPool <threads> [<capacity>]" is a fixed pool sharing a
+ * queue guarded by a mutex, and "stealing <threads> [<capacity>]" is a fixed
+ * pool of lock-free queues with work stealing. "coroutine <threads>
+ * [<capacity>]" runs each request as a stackless coroutine on a run queue per
+ * thread (see CoroutineExecutor.h); a coroutine that sleeps gives up its
+ * thread until it wakes. "arachne" names the default, a thread per request.
+ * Every executor reports the same columns as --workers, so that runs of one
+ * .bench file compare directly. Like --workers, each prints the memory an
+ * in-flight request took: the heap's growth when the most requests were in
+ * flight, divided among them, plus what each held of memory set aside before
+ * the load, such as its thread's stack (Arachne's --stackSize for Arachne
+ * threads). The CPU time of an executor's threads counts as busy cores,
+ * while Arachne's counters, such as the load factor and core changes, cover
+ * only the dispatchers; Arachne's --maxNumCores should leave the executor the
+ * rest of the machine. Kernel threads can block by sleeping and do disk I/O,
+ * but cannot block on the backend or fan out.
+ *
+ * With --executorCpus "<cpus>", such as "8-11,14", the executor's threads
+ * are pinned to the given CPUs, one to each CPU round robin for a pool, and
+ * any of them for a pthread per request. The executor's threads are created
+ * before Arachne's cores are known, so these should be CPUs that the core
+ * arbiter does not manage; the run exits if a dispatcher lands on one.
+ *
+ * A .bench line may make its interval's arrivals come in bursts with
+ * "burst <size> <period_ns> [<jitter_ns>]" at its end: every period, give or
+ * take up to the jitter, size threads arrive at the same instant, as when an
+ * aggregator fans a request out to many servers. The offered load of such an
+ * interval is size per period, whatever the line's rate says. Runs with
+ * bursts add each interval's number of bursts, the median and longest time
+ * from a burst's arrival until its last thread completed, and the median and
+ * longest time until the number of cores first changed, over the bursts for
+ * which it did. With --burstFile, every burst is also written to the given
+ * file after the run. Bursts need a single dispatcher creating a thread per
+ * request.
+ *
+ * With --online, each interval's row is printed as soon as all of its threads
+ * have completed rather than after the run, and the interval's latencies are
+ * then released. With --histogram as well, only the intervals still in
+ * flight hold histograms, which are allocated as each interval starts, so
+ * memory grows by a small fixed record per interval rather than with the
+ * number of requests.
  */
 
 int
@@ -479,49 +3229,75 @@ main(int argc, const char** argv) {
     // Arachne.
     parseOptions(&argc, argv);
 
-    if (argc < 2) {
-        printf("Please specify a configuration file!\n");
+    if (closedLoop && (numDispatchers != 1 || traceFile || numStages > 0 ||
+                       reportStartDelay)) {
+        printf("Closed-loop mode needs a single dispatcher, no trace, no "
+               "pipeline, no workers and no executor!\n");
         exit(1);
     }
-
-    // First argument specifies a configuration file with the following format
-    // <count_of_rows>
-    // <time_to_run_in_ns> <attempted_creations_per_second>
-    // <thread_duration_in_ns>
-    FILE* specFile = fopen(argv[1], "r");
-    if (!specFile) {
-        printf("Configuration file '%s' non existent!\n", argv[1]);
+    if (numStages > 0 && reportStartDelay) {
+        printf("A pipeline has workers of its own; drop --workers and "
+               "--executor!\n");
         exit(1);
     }
-    char buffer[1024];
-    if (fgets(buffer, 1024, specFile) == NULL) {
-        printf("Error reading configuration file: %s\n", strerror(errno));
+    if (executor && numWorkers >= 0) {
+        printf("--workers is for Arachne threads; use --executor's own "
+               "pool!\n");
         exit(1);
     }
-    sscanf(buffer, "%zu", &numIntervals);
-    intervals = new Interval[numIntervals];
-    for (size_t i = 0; i < numIntervals; i++) {
-        if (fgets(buffer, 1024, specFile) == NULL) {
-            printf("Error reading configuration file: %s\n", strerror(errno));
+    if (!executorCpus.empty()) {
+        if (!executor) {
+            printf("--executorCpus needs an --executor other than "
+                   "arachne!\n");
             exit(1);
         }
-        sscanf(buffer, "%lu %lf %lu", &intervals[i].timeToRun,
-               &intervals[i].creationsPerSecond,
-               &intervals[i].durationPerThread);
-        //        // Adjust the offered load down to match the maximum Poisson
-        //        load achieved. if (distType == UNIFORM)
-        //            // For 70% utilization threshold and load factor 225
-        //            // intervals[i].creationsPerSecond *= 0.87;
-        //            // For 85% utilization threshold, the maximum throughput
-        //            ratio for
-        //            // poisson is this much.
-        //            intervals[i].creationsPerSecond *= 0.9327956;
+        executor->pinThreads(executorCpus);
+    }
+    if (traceFile) {
+        loadTraceIntervals();
+    } else {
+        if (argc < 2) {
+            printf("Please specify a configuration file!\n");
+            exit(1);
+        }
+        loadIntervals(argv[1]);
     }
-    fclose(specFile);
 
     // Catch intermittent errors
     installSignalHandler();
     Arachne::createThreadWithClass(Arachne::DefaultCorePolicy::EXCLUSIVE,
-                                   dispatch, argv[1]);
+                                   dispatch);
     Arachne::waitForTermination();
+
+    if (!reportOnline)
+        postProcessResults();
+    if (burstFile && bursts)
+        writeBursts();
+
+    delete[] latencies;
+    delete[] serviceTimes;
+    delete[] executionTimes;
+    delete backend;
+    for (size_t k = 0; k < kernels.size(); k++)
+        delete kernels[k];
+    // With --online, the reporter has already released every interval.
+    for (size_t i = 1; useHistograms && !reportOnline && i <= numIntervals;
+         i++)
+        releaseInterval(i);
+    delete[] stragglerTimes;
+    delete[] bursts;
+    delete[] startDelays;
+    delete server;
+    delete poolQueue;
+    delete executor;
+    for (size_t stage = 0; stage < stageQueues.size(); stage++)
+        delete stageQueues[stage];
+    delete freeRequests;
+    delete[] requestPool;
+    delete scratchFile;
+    for (int d = 0; d < numDispatchers; d++)
+        delete dispatchers[d].schedule;
+    delete[] dispatchers;
+    delete trace;
+    delete profile;
 }
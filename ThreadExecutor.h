@@ -0,0 +1,463 @@
+#ifndef THREAD_EXECUTOR_H
+#define THREAD_EXECUTOR_H
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "LockFreeQueue.h"
+#include "PerfUtils/Cycles.h"
+
+/**
+ * A ThreadExecutor runs synthetic requests on kernel threads instead of
+ * Arachne threads, so that the same arrivals can be served by the usual
+ * alternatives to Arachne. An executor is named on the command line as one
+ * of
+ *
+ *     pthread                            a detached pthread per request
+ *     pthreadPool <threads> [<capacity>] a fixed pool of threads that take
+ *                                        requests from one queue guarded by
+ *                                        a mutex
+ *     stealing <threads> [<capacity>]    a fixed pool of threads that each
+ *                                        take requests from a lock-free queue
+ *                                        of their own, and steal from the
+ *                                        others' queues when theirs is empty
+ *
+ * where <capacity> is the number of requests the pool's queues hold in all
+ * (4096 unless given). A request is a function and four arguments, like the
+ * ones passed to Arachne::createThread. An executor's threads may run on any
+ * CPU until pinned to a list of them with pinThreads.
+ */
+class ThreadExecutor {
+  public:
+    typedef void (*Function)(uint64_t, uint64_t, uint64_t, uint64_t);
+    struct Task {
+        Function function;
+        uint64_t arguments[4];
+    };
+
+    /**
+     * Create and start the executor that spec names.
+     *
+     * \return
+     *      NULL if the name is unknown or its parameters are malformed.
+     */
+    static ThreadExecutor* create(const char* spec);
+
+    virtual ~ThreadExecutor() {}
+
+    /**
+     * Start running a task, unless the executor has no room for it.
+     *
+     * \return
+     *      False if the task was not accepted; the caller may try again.
+     */
+    virtual bool submit(const Task& task) = 0;
+
+    /**
+     * Wait for every submitted task to complete, and stop the executor's
+     * threads.
+     */
+    virtual void stop() = 0;
+
+    virtual const char* getName() const = 0;
+
+    /**
+     * Run the executor's threads only on the given CPUs, which should be
+     * ones that neither Arachne nor the dispatchers use. A pool's threads
+     * are pinned one to each CPU, round robin. Exits if a thread cannot be
+     * pinned, as when a CPU is in a cpuset the process may not use.
+     */
+    virtual void pinThreads(const std::vector<int>& cpuList) {
+        cpus = cpuList;
+        for (size_t t = 0; t < threads.size(); t++) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[t % cpus.size()], &set);
+            int error = pthread_setaffinity_np(threads[t].native_handle(),
+                                               sizeof(set), &set);
+            if (error != 0)
+                failToPin(error);
+        }
+    }
+
+    /**
+     * Return the memory, in bytes, that each task holds while it is in
+     * flight out of memory the executor set aside before it was submitted,
+     * such as a queue slot or a thread's stack. Memory that tasks allocate
+     * as they are submitted is not counted.
+     */
+    virtual size_t getReservedBytesPerTask() const { return 0; }
+
+    /**
+     * Return true if the executor's threads have been pinned to CPUs that
+     * include the given one.
+     */
+    bool usesCpu(int cpu) const {
+        return std::find(cpus.begin(), cpus.end(), cpu) != cpus.end();
+    }
+
+    /**
+     * Return the CPU time, in cycles, that the executor's threads have used
+     * so far, including any time they spent looking for work. This is only
+     * complete until the executor is stopped.
+     */
+    uint64_t getCpuCycles() {
+        uint64_t nanoseconds = exitedNanoseconds.load();
+        for (size_t t = 0; t < threads.size(); t++) {
+            if (!threads[t].joinable())
+                continue;
+            clockid_t clock;
+            struct timespec time;
+            if (pthread_getcpuclockid(threads[t].native_handle(), &clock) ==
+                    0 &&
+                clock_gettime(clock, &time) == 0) {
+                nanoseconds += toNanoseconds(time);
+            }
+        }
+        return PerfUtils::Cycles::fromNanoseconds(nanoseconds);
+    }
+
+  protected:
+    ThreadExecutor() : threads(), exitedNanoseconds(0), cpus() {}
+
+    void failToPin(int error) {
+        fprintf(stderr, "Error pinning the %s executor's threads: %s\n",
+                getName(), strerror(error));
+        exit(1);
+    }
+
+    static uint64_t toNanoseconds(const struct timespec& time) {
+        return static_cast<uint64_t>(time.tv_sec) * 1000000000UL +
+               static_cast<uint64_t>(time.tv_nsec);
+    }
+
+    static void run(const Task& task) {
+        task.function(task.arguments[0], task.arguments[1],
+                      task.arguments[2], task.arguments[3]);
+    }
+
+    /**
+     * Add the CPU time of the calling thread to the executor's, for threads
+     * that exit before the executor stops.
+     */
+    void recordExit() {
+        struct timespec time;
+        if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &time) == 0)
+            exitedNanoseconds += toNanoseconds(time);
+    }
+
+    // The long-lived threads of a pool; empty for pthread.
+    std::vector<std::thread> threads;
+
+    // The CPU time of the threads that have exited.
+    std::atomic<uint64_t> exitedNanoseconds;
+
+    // The CPUs the threads are pinned to, or empty if they are not pinned.
+    std::vector<int> cpus;
+
+  private:
+    ThreadExecutor(const ThreadExecutor&) = delete;
+    ThreadExecutor& operator=(const ThreadExecutor&) = delete;
+};
+
+/**
+ * Runs each task on a detached pthread of its own, the kernel-thread
+ * counterpart of creating an Arachne thread per request.
+ */
+class PthreadPerRequest : public ThreadExecutor {
+  public:
+    PthreadPerRequest() : numRunning(0) {
+        pthread_attr_init(&attributes);
+        pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+        // Requests need little stack, and smaller stacks let more of them be
+        // outstanding at once.
+        pthread_attr_setstacksize(&attributes, STACK_BYTES);
+    }
+
+    ~PthreadPerRequest() {
+        stop();
+        pthread_attr_destroy(&attributes);
+    }
+
+    bool submit(const Task& task) {
+        Launch* launch = new Launch;
+        launch->executor = this;
+        launch->task = task;
+        numRunning++;
+        pthread_t thread;
+        if (pthread_create(&thread, &attributes, start, launch) != 0) {
+            numRunning--;
+            delete launch;
+            return false;
+        }
+        return true;
+    }
+
+    void stop() {
+        while (numRunning > 0)
+            usleep(1000);
+    }
+
+    const char* getName() const { return "pthread"; }
+
+    size_t getReservedBytesPerTask() const { return STACK_BYTES; }
+
+    /**
+     * Let each request's thread run on any of the given CPUs.
+     */
+    void pinThreads(const std::vector<int>& cpuList) {
+        cpus = cpuList;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (size_t c = 0; c < cpus.size(); c++)
+            CPU_SET(cpus[c], &set);
+        int error =
+            pthread_attr_setaffinity_np(&attributes, sizeof(set), &set);
+        if (error != 0)
+            failToPin(error);
+    }
+
+  private:
+    static const size_t STACK_BYTES = 256 << 10;
+
+    // What a new thread needs; it is freed by the thread.
+    struct Launch {
+        PthreadPerRequest* executor;
+        Task task;
+    };
+
+    static void* start(void* argument) {
+        Launch* launch = static_cast<Launch*>(argument);
+        PthreadPerRequest* executor = launch->executor;
+        run(launch->task);
+        delete launch;
+        executor->recordExit();
+        executor->numRunning--;
+        return NULL;
+    }
+
+    pthread_attr_t attributes;
+
+    // The number of threads that have been created and not yet exited.
+    std::atomic<uint64_t> numRunning;
+};
+
+/**
+ * A fixed pool of threads that take tasks from a single bounded queue
+ * guarded by a mutex, waiting on a condition variable while it is empty.
+ */
+class PthreadPool : public ThreadExecutor {
+  public:
+    PthreadPool(size_t numThreads, size_t capacity)
+        : capacity(capacity), lock(), nonEmpty(), queue(), stopping(false) {
+        for (size_t t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(&PthreadPool::work, this));
+    }
+
+    ~PthreadPool() { stop(); }
+
+    bool submit(const Task& task) {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            if (queue.size() >= capacity)
+                return false;
+            queue.push_back(task);
+        }
+        nonEmpty.notify_one();
+        return true;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(lock);
+            stopping = true;
+        }
+        nonEmpty.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) {
+            if (threads[t].joinable())
+                threads[t].join();
+        }
+    }
+
+    const char* getName() const { return "pthreadPool"; }
+
+  private:
+    void work() {
+        std::unique_lock<std::mutex> guard(lock);
+        for (;;) {
+            while (queue.empty() && !stopping)
+                nonEmpty.wait(guard);
+            if (queue.empty())
+                return;
+            Task task = queue.front();
+            queue.pop_front();
+            guard.unlock();
+            run(task);
+            guard.lock();
+        }
+    }
+
+    size_t capacity;
+
+    // Guards queue and stopping.
+    std::mutex lock;
+    std::condition_variable nonEmpty;
+    std::deque<Task> queue;
+
+    // Set once no more tasks will be submitted; the threads exit when the
+    // queue is then empty.
+    bool stopping;
+};
+
+/**
+ * A fixed pool of threads that each take tasks from a lock-free queue of
+ * their own, and steal from the other threads' queues, in order, when theirs
+ * is empty. Submitted tasks are spread over the queues round robin. A thread
+ * that finds no work anywhere for a while parks on a condition variable, so
+ * that an idle pool does not keep its cores busy.
+ */
+class WorkStealingPool : public ThreadExecutor {
+  public:
+    WorkStealingPool(size_t numThreads, size_t capacity)
+        : queues(),
+          nextQueue(0),
+          parkLock(),
+          unparked(),
+          numParked(0),
+          stopping(false) {
+        size_t perQueue = 2;
+        while (perQueue * numThreads < capacity)
+            perQueue *= 2;
+        for (size_t t = 0; t < numThreads; t++)
+            queues.push_back(new LockFreeQueue<Task>(perQueue));
+        for (size_t t = 0; t < numThreads; t++)
+            threads.push_back(std::thread(&WorkStealingPool::work, this, t));
+    }
+
+    ~WorkStealingPool() {
+        stop();
+        for (size_t q = 0; q < queues.size(); q++)
+            delete queues[q];
+    }
+
+    bool submit(const Task& task) {
+        size_t first = nextQueue.fetch_add(1, std::memory_order_relaxed);
+        for (size_t q = 0; q < queues.size(); q++) {
+            if (queues[(first + q) % queues.size()]->push(task)) {
+                // Either a parking thread sees the task when it looks again
+                // under parkLock, or this sees it parking.
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (numParked.load() > 0) {
+                    std::lock_guard<std::mutex> guard(parkLock);
+                    unparked.notify_one();
+                }
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void stop() {
+        {
+            std::lock_guard<std::mutex> guard(parkLock);
+            stopping = true;
+        }
+        unparked.notify_all();
+        for (size_t t = 0; t < threads.size(); t++) {
+            if (threads[t].joinable())
+                threads[t].join();
+        }
+    }
+
+    const char* getName() const { return "stealing"; }
+
+    size_t getReservedBytesPerTask() const { return sizeof(Task); }
+
+  private:
+    // The number of times a thread looks through every queue before parking.
+    static const int SPINS_BEFORE_PARKING = 1000;
+
+    /**
+     * Take a task from the given thread's own queue, or else from another
+     * thread's.
+     */
+    bool findTask(size_t self, Task* task) {
+        for (size_t q = 0; q < queues.size(); q++) {
+            if (queues[(self + q) % queues.size()]->pop(task))
+                return true;
+        }
+        return false;
+    }
+
+    void work(size_t self) {
+        Task task;
+        int spins = 0;
+        for (;;) {
+            if (findTask(self, &task)) {
+                run(task);
+                spins = 0;
+                continue;
+            }
+            if (++spins < SPINS_BEFORE_PARKING)
+                continue;
+            spins = 0;
+            std::unique_lock<std::mutex> guard(parkLock);
+            numParked++;
+            bool found = findTask(self, &task);
+            if (!found && stopping) {
+                numParked--;
+                return;
+            }
+            if (!found)
+                unparked.wait(guard);
+            numParked--;
+            guard.unlock();
+            if (found)
+                run(task);
+        }
+    }
+
+    std::vector<LockFreeQueue<Task>*> queues;
+
+    // The queue the next submitted task is offered to first.
+    std::atomic<size_t> nextQueue;
+
+    // Guards stopping and parking.
+    std::mutex parkLock;
+    std::condition_variable unparked;
+    std::atomic<int> numParked;
+    bool stopping;
+};
+
+inline ThreadExecutor*
+ThreadExecutor::create(const char* spec) {
+    char name[16];
+    unsigned long numThreads = 0;
+    unsigned long capacity = 4096;
+    int numFields = sscanf(spec, "%15s %lu %lu", name, &numThreads, &capacity);
+    if (numFields < 1)
+        return NULL;
+    if (strcmp(name, "pthread") == 0)
+        return numFields == 1 ? new PthreadPerRequest : NULL;
+    if (numFields < 2 || numThreads < 1 || capacity < 1)
+        return NULL;
+    if (strcmp(name, "pthreadPool") == 0)
+        return new PthreadPool(numThreads, capacity);
+    if (strcmp(name, "stealing") == 0)
+        return new WorkStealingPool(numThreads, capacity);
+    return NULL;
+}
+
+#endif  // THREAD_EXECUTOR_H
@@ -9,6 +9,11 @@
 #include "PerfUtils/Stats.h"
 #include "CoreArbiter/Logger.h"
 #include "Arachne/DefaultCorePolicy.h"
+#include "BenchmarkOptions.h"
+#include "ChunkedArray.h"
+#include "LatencyHistogram.h"
+#include "LatencyLog.h"
+#include "LoadProfile.h"
 
 using PerfUtils::Cycles;
 using Arachne::PerfStats;
@@ -21,12 +26,30 @@ extern double loadFactorThreshold;
 
 using PerfUtils::TimeTrace;
 
-// Support a maximum of 100 million entries.
-#define MAX_ENTRIES (1 << 27)
+// Every latency, in per-core shards.
+LatencyLog latencyLog;
 
-uint64_t latencies[MAX_ENTRIES];
+// With --histogram, latencies are counted in a fixed-size histogram per
+// interval instead, so memory use does not grow with the length of a run.
+// There is one more histogram than intervals, for threads that finish after
+// the last interval.
+bool useHistograms = false;
+int histogramPrecision = 7;
+ChunkedArray<LatencyHistogram*> histograms;
 
-std::atomic<uint64_t> arrayIndex;
+// The histogram of the interval that is currently running.
+std::atomic<LatencyHistogram*> currentHistogram;
+
+/**
+ * Allocate the histogram of an interval as it starts, and count the latencies
+ * of threads that finish from now on in it. Histograms of intervals the run
+ * never reaches are never allocated.
+ */
+void startHistogram(size_t interval) {
+    histograms.resize(interval + 1);
+    histograms[interval] = new LatencyHistogram(histogramPrecision);
+    currentHistogram = histograms[interval];
+}
 
 struct Interval {
     uint64_t timeToRun;
@@ -36,14 +59,38 @@ struct Interval {
     // are not meaningful.
     uint64_t durationPerThread;
     int numCoresOfLoad;
-} *intervals;
+};
 
+// The intervals of the run, held in chunks that are only allocated as the run
+// reaches them.
+ChunkedArray<Interval> intervals;
 size_t numIntervals;
 
-// The values of arrayIndex before each change in load, which we can use later
-// to compute latency and throughput. Note that this value and perfStats
-// are not read atomically, but we believe the difference should be
-// negligible.
+// When the configuration file is a load profile, intervals are filled in from
+// it as the run reaches them; this many have been filled in so far.
+LoadProfile* profile = NULL;
+size_t numExpandedIntervals = 0;
+
+/**
+ * Fill in intervals from the load profile up to, but not including, end. The
+ * profile's load is the number of cores of load.
+ */
+void expandIntervals(size_t end) {
+    LoadProfile::Interval next;
+    for (; numExpandedIntervals < end && profile->next(&next);
+            numExpandedIntervals++) {
+        intervals.resize(numExpandedIntervals + 1);
+        Interval& interval = intervals[numExpandedIntervals];
+        interval.timeToRun = next.timeToRun;
+        interval.numCoresOfLoad = static_cast<int>(lround(next.load));
+        interval.durationPerThread = next.durationPerThread;
+    }
+}
+
+// The number of completions before each change in load, which we can use
+// later to compute latency and throughput. These are filled in after the run
+// from the latency log or histograms, so that completing threads do not
+// contend on a shared counter.
 std::vector<uint64_t> indices;
 // The performance statistics before each change in load, which we can use
 // later to compute utilization.
@@ -70,15 +117,17 @@ void fixedWork(int threadId, uint64_t duration, uint64_t creationTime) {
 
     // Compute latency
     uint64_t latency = Cycles::rdtsc() - creationTime;
-    latencies[arrayIndex++] = latency;
+    if (useHistograms)
+        currentHistogram.load(std::memory_order_relaxed)->record(latency);
+    else
+        latencyLog.record(latency);
 }
 
 void dispatch() {
-    // Page in our data store
-    memset(latencies, 0, MAX_ENTRIES*sizeof(uint64_t));
-
     // Initialize interval
     size_t currentInterval = 0;
+    if (useHistograms)
+        startHistogram(currentInterval);
 
     uint64_t cyclesPerThread = Cycles::fromNanoseconds(intervals[currentInterval].durationPerThread);
     int numCoresOfLoad = intervals[currentInterval].numCoresOfLoad;
@@ -87,7 +136,6 @@ void dispatch() {
     PerfStats stats;
     PerfStats::collectStats(&stats);
 
-    indices.push_back(arrayIndex);
     perfStats.push_back(stats);
 
     uint64_t currentTime = Cycles::rdtsc();
@@ -106,12 +154,17 @@ void dispatch() {
         if (nextIntervalTime < currentTime) {
             // Collect latency, throughput, and core utilization information from the past interval
             PerfStats::collectStats(&stats);
-            indices.push_back(arrayIndex);
             perfStats.push_back(stats);
 
             // Advance the interval
             currentInterval++;
+            if (useHistograms)
+                startHistogram(currentInterval);
+            else
+                latencyLog.startInterval(currentInterval);
             if (currentInterval == numIntervals) break;
+            if (profile)
+                expandIntervals(currentInterval + 1);
             TimeTrace::record("Load Change START %u --> %u Cores.",
                     static_cast<uint32_t>(intervals[currentInterval - 1].numCoresOfLoad),
                     static_cast<uint32_t>(intervals[currentInterval].numCoresOfLoad));
@@ -196,6 +249,13 @@ installSignalHandler() {
  *
  * Note that we should probably bechmark the cost of extracting randomness as
  * well, but we haven't yet done that.
+ *
+ * With --histogram, each interval's latencies are counted in a histogram of
+ * --histogramPrecision bits (default 7) rather than stored one by one, so
+ * memory use stays fixed however long the run is.
+ *
+ * Otherwise every latency is kept, in a log sharded by core so that recording
+ * touches no shared cache lines; --hugePages backs the log with huge pages.
  */
 
 int main(int argc, const char** argv) {
@@ -212,9 +272,23 @@ int main(int argc, const char** argv) {
     Arachne::setErrorStream(stderr);
     Arachne::init(&argc, argv);
 
+    const char* precisionOption =
+        extractOption(&argc, argv, "histogramPrecision", true);
+    if (precisionOption) {
+        histogramPrecision = atoi(precisionOption);
+        if (histogramPrecision < 1 || histogramPrecision > 20) {
+            fprintf(stderr, "histogramPrecision must be 1 to 20!\n");
+            exit(1);
+        }
+    }
+    useHistograms = extractOption(&argc, argv, "histogram", false) != NULL;
+    latencyLog.setHugePages(
+        extractOption(&argc, argv, "hugePages", false) != NULL);
+
     // First argument specifies a configuration file with the following format
     // <count_of_rows>
     // <time_to_run_in_ns> <number_of_cores_of_load> <thread_duration_in_ns>
+    // or a load profile (see LoadProfile.h) whose load is cores of load.
     FILE *specFile = fopen(argv[1], "r");
     if (!specFile) {
         printf("Configuration file '%s' non existent!\n", argv[1]);
@@ -225,20 +299,46 @@ int main(int argc, const char** argv) {
         printf("Error reading configuration file: %s\n", strerror(errno));
         exit(1);
     }
-    sscanf(buffer, "%zu", &numIntervals);
-    intervals = new Interval[numIntervals];
-    for (size_t i = 0; i < numIntervals; i++) {
-        if (fgets(buffer, 1024, specFile) == NULL) {
-            printf("Error reading configuration file: %s\n", strerror(errno));
+    if (sscanf(buffer, "%zu", &numIntervals) != 1) {
+        // Not a count of rows, so it must be a load profile, which is only
+        // expanded into intervals as the run reaches them.
+        profile = new LoadProfile(argv[1]);
+        if (profile->hasVariableServiceTimes()) {
+            printf("Only fixed thread durations are supported!\n");
+            exit(1);
+        }
+        numIntervals = profile->numIntervals();
+        if (numIntervals == 0) {
+            printf("Load profile '%s' has no intervals!\n", argv[1]);
             exit(1);
         }
-        sscanf(buffer, "%lu %d %lu",
-                &intervals[i].timeToRun,
-                &intervals[i].numCoresOfLoad,
-                &intervals[i].durationPerThread);
+        intervals.setMaxSize(numIntervals);
+        expandIntervals(1);
+    } else {
+        intervals.setMaxSize(numIntervals);
+        for (size_t i = 0; i < numIntervals; i++) {
+            if (fgets(buffer, 1024, specFile) == NULL) {
+                printf("Error reading configuration file: %s\n", strerror(errno));
+                exit(1);
+            }
+            intervals.resize(i + 1);
+            sscanf(buffer, "%lu %d %lu",
+                    &intervals[i].timeToRun,
+                    &intervals[i].numCoresOfLoad,
+                    &intervals[i].durationPerThread);
+        }
     }
     fclose(specFile);
 
+    if (useHistograms) {
+        histograms.setMaxSize(numIntervals + 1);
+    } else {
+        // A shard for each core, since each of Arachne's kernel threads runs
+        // on a core of its own.
+        latencyLog.prepare(std::thread::hardware_concurrency(),
+                           numIntervals + 1);
+    }
+
     if (argc > 2) {
         reinterpret_cast<Arachne::DefaultCorePolicy*>(
                 Arachne::getCorePolicy())
@@ -261,15 +361,23 @@ int main(int argc, const char** argv) {
     TimeTrace::keepOldEvents = true;
     TimeTrace::print();
 
-    // Sanity check
-    if (arrayIndex >= MAX_ENTRIES) {
-        puts("Guaranteed memory corruption.");
-        abort();
+    // Count the completions in each interval, and make room to merge the
+    // largest interval's shards.
+    indices.push_back(0);
+    uint64_t maxCount = 0;
+    for (size_t i = 1; i < perfStats.size(); i++) {
+        uint64_t count = useHistograms ? histograms[i-1]->count()
+                                       : latencyLog.count(i-1);
+        indices.push_back(indices.back() + count);
+        maxCount = std::max(maxCount, count);
     }
-
-    // Convert latencies to ns
-    for (size_t i = 0; i < arrayIndex; i++)
-        latencies[i] = Cycles::toNanoseconds(latencies[i]);
+    std::vector<uint64_t> latencies(useHistograms ? 0 : maxCount);
+    if (latencyLog.numSaturated() > 0)
+        fprintf(stderr, "%lu latencies did not fit in 32 bits of cycles\n",
+                latencyLog.numSaturated());
+    if (latencyLog.numDropped() > 0)
+        fprintf(stderr, "%lu latencies were dropped waiting for log space\n",
+                latencyLog.numDropped());
     // Output core utilization, median & 99% latency, and throughput for each interval in a
     // plottable format.
     puts("Duration,Offered Load,Core Utilization,50\% Latency,90\%,99\%,Max,Throughput,Load Factor,Core++,Core--,U x LF,(1-idle) x LF");
@@ -300,7 +408,20 @@ int main(int argc, const char** argv) {
 
         // Median and 99% Latency
         // Note that this computation will modify data
-        Statistics mathStats = computeStatistics(latencies + indices[i-1], indices[i] - indices[i-1]);
+        Statistics mathStats;
+        if (useHistograms) {
+            LatencyHistogram* histogram = histograms[i-1];
+            mathStats.median = Cycles::toNanoseconds(histogram->percentile(0.5));
+            mathStats.P90 = Cycles::toNanoseconds(histogram->percentile(0.9));
+            mathStats.P99 = Cycles::toNanoseconds(histogram->percentile(0.99));
+            mathStats.max = Cycles::toNanoseconds(histogram->max());
+        } else {
+            // Merge the shards and convert latencies to ns
+            uint64_t count = latencyLog.copyInterval(i-1, latencies.data());
+            for (size_t j = 0; j < count; j++)
+                latencies[j] = Cycles::toNanoseconds(latencies[j]);
+            mathStats = computeStatistics(latencies.data(), count);
+        }
         printf("%lf,%d,%lf,%lu,%lu,%lu,%lu,%lu,%lf,%lu,%lu,%lf,%lf\n", durationOfInterval,
                 intervals[i-1].numCoresOfLoad, utilization,
                 mathStats.median, mathStats.P90, mathStats.P99, mathStats.max,
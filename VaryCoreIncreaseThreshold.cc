@@ -3,6 +3,10 @@
 #include <signal.h>
 #include <string.h>
 #include <unistd.h>
+#include "ArrivalSchedule.h"
+#include "BenchmarkOptions.h"
+#include "LatencyHistogram.h"
+#include "LatencyLog.h"
 #include "Arachne/Arachne.h"
 #include "Arachne/DefaultCorePolicy.h"
 #include "PerfUtils/Cycles.h"
@@ -14,12 +18,16 @@ using PerfUtils::Cycles;
 using Arachne::PerfStats;
 using PerfUtils::TimeTrace;
 
-// Support a maximum of 100 million entries.
-#define MAX_ENTRIES (1 << 27)
+// Every latency of the current run, in per-core shards.
+LatencyLog latencyLog;
 
-uint64_t latencies[MAX_ENTRIES];
+// With --histogram, latencies are counted in a fixed-size histogram that is
+// reset for each threshold instead, so memory use does not grow with the
+// length of a run.
+bool useHistograms = false;
+int histogramPrecision = 7;
+LatencyHistogram* histogram;
 
-std::atomic<uint64_t> arrayIndex;
 std::atomic<uint64_t> failures;
 
 struct Interval {
@@ -34,10 +42,13 @@ struct Interval {
 
 size_t numIntervals;
 
-// The values of arrayIndex before each change in load, which we can use later
-// to compute latency and throughput. Note that this value and perfStats
-// are not read atomically, but we believe the difference should be
-// negligible.
+// Arrivals generated ahead of time from --seed, or NULL to draw them inline.
+ArrivalSchedule* schedule = NULL;
+
+// The number of completions before each change in load, which we can use
+// later to compute latency and throughput. These are filled in after the run
+// from the latency log or histograms, so that completing threads do not
+// contend on a shared counter.
 std::vector<uint64_t> indices;
 // The performance statistics before each change in load, which we can use
 // later to compute utilization.
@@ -50,13 +61,13 @@ void fixedWork(uint64_t duration, uint64_t creationTime) {
     uint64_t stop = Cycles::rdtsc() + duration;
     while (Cycles::rdtsc() < stop);
     uint64_t latency = Cycles::rdtsc() - creationTime;
-    latencies[arrayIndex++] = latency;
+    if (useHistograms)
+        histogram->record(latency);
+    else
+        latencyLog.record(latency);
 }
 
 void dispatch() {
-    // Page in our data store
-    memset(latencies, 0, MAX_ENTRIES*sizeof(uint64_t));
-
     // Initialize interval
     size_t currentInterval = 0;
 
@@ -68,14 +79,15 @@ void dispatch() {
 	std::mt19937 gen(rd());
 
     std::exponential_distribution<double> intervalGenerator(intervals[currentInterval].creationsPerSecond);
-    uint64_t nextCycleTime = Cycles::rdtsc() +
-		Cycles::fromSeconds(intervalGenerator(gen));
+    if (schedule)
+        schedule->startInterval(currentInterval);
+    uint64_t nextCycleTime = nextArrival(schedule, Cycles::rdtsc(), gen,
+                                         intervalGenerator);
 
 
     PerfStats stats;
     PerfStats::collectStats(&stats);
 
-    indices.push_back(arrayIndex);
     perfStats.push_back(stats);
 
     uint64_t currentTime = Cycles::rdtsc();
@@ -91,18 +103,18 @@ void dispatch() {
             while (Arachne::createThread(fixedWork, cyclesPerThread, currentTime) == Arachne::NullThread);
 
             // Compute the next cycle time only after we win successfully
-            nextCycleTime = currentTime +
-                Cycles::fromSeconds(intervalGenerator(gen));
+            nextCycleTime = nextArrival(schedule, currentTime, gen,
+                                        intervalGenerator);
         }
 
         if (nextIntervalTime < currentTime) {
             // Collect latency, throughput, and core utilization information from the past interval
             PerfStats::collectStats(&stats);
-            indices.push_back(arrayIndex);
             perfStats.push_back(stats);
 
             // Advance the interval
             currentInterval++;
+            latencyLog.startInterval(currentInterval);
             if (currentInterval == numIntervals) break;
             TimeTrace::record("Load Change START %u --> %u Creations Per Second.",
                     static_cast<uint32_t>(intervals[currentInterval - 1].creationsPerSecond),
@@ -116,6 +128,13 @@ void dispatch() {
             intervalGenerator.param(
                     std::exponential_distribution<double>::param_type(
                     intervals[currentInterval].creationsPerSecond));
+            if (schedule) {
+                // The previous interval's arrivals may have run out, so
+                // restart the arrival clock from this interval's schedule.
+                schedule->startInterval(currentInterval);
+                nextCycleTime = nextArrival(schedule, currentTime, gen,
+                                            intervalGenerator);
+            }
             TimeTrace::record("Load Change END %u --> %u Creations Per Second.",
                     static_cast<uint32_t>(intervals[currentInterval - 1].creationsPerSecond),
                     static_cast<uint32_t>(intervals[currentInterval].creationsPerSecond));
@@ -176,6 +195,13 @@ installSignalHandler() {
  *
  * Note that we should probably bechmark the cost of extracting randomness as
  * well, but we haven't yet done that.
+ *
+ * With --histogram, latencies are counted in a histogram of
+ * --histogramPrecision bits (default 7) rather than stored one by one, so
+ * memory use stays fixed however long each run is.
+ *
+ * Otherwise every latency is kept, in a log sharded by core so that recording
+ * touches no shared cache lines; --hugePages backs the log with huge pages.
  */
 
 int main(int argc, const char** argv) {
@@ -195,6 +221,26 @@ int main(int argc, const char** argv) {
     Arachne::setErrorStream(stdout);
     Arachne::init(&argc, argv);
 
+    // With --seed, arrivals are generated before the run from the given seed
+    // so that runs are reproducible and the dispatch loop draws no random
+    // numbers.
+    const char* seedOption = extractOption(&argc, argv, "seed", true);
+
+    const char* precisionOption =
+        extractOption(&argc, argv, "histogramPrecision", true);
+    if (precisionOption) {
+        histogramPrecision = atoi(precisionOption);
+        if (histogramPrecision < 1 || histogramPrecision > 20) {
+            fprintf(stderr, "histogramPrecision must be 1 to 20!\n");
+            exit(1);
+        }
+    }
+    useHistograms = extractOption(&argc, argv, "histogram", false) != NULL;
+    latencyLog.setHugePages(
+        extractOption(&argc, argv, "hugePages", false) != NULL);
+    if (useHistograms)
+        histogram = new LatencyHistogram(histogramPrecision);
+
     // First argument specifies a configuration file with the following format
     // <count_of_rows>
     // <time_to_run_in_ns> <attempted_creations_per_second> <thread_duration_in_ns>
@@ -232,18 +278,42 @@ int main(int argc, const char** argv) {
                 Arachne::getCorePolicy())
             ->getEstimator()
             ->setLoadFactorThreshold(threshold);
+        // A schedule only runs through its intervals once, so give each
+        // threshold a fresh one; with the same seed, every threshold sees
+        // exactly the same arrivals.
+        if (seedOption) {
+            schedule = new ArrivalSchedule(
+                static_cast<uint32_t>(strtoul(seedOption, NULL, 0)),
+                ArrivalSchedule::POISSON);
+            for (size_t i = 0; i < numIntervals; i++) {
+                schedule->addInterval(intervals[i].creationsPerSecond,
+                                      intervals[i].timeToRun);
+            }
+        }
+        // A shard for each core, since each of Arachne's kernel threads runs
+        // on a core of its own.
+        if (!useHistograms) {
+            latencyLog.prepare(std::thread::hardware_concurrency(),
+                               numIntervals + 1);
+        }
         Arachne::createThreadWithClass(Arachne::DefaultCorePolicy::EXCLUSIVE, dispatch);
         Arachne::waitForTermination();
 
-        // Sanity check
-        if (arrayIndex >= MAX_ENTRIES) {
-            puts("Guaranteed memory corruption.");
-            abort();
+        // Count the completions in each interval. The histogram covers the
+        // whole run, so it only gives the total.
+        indices.push_back(0);
+        for (size_t i = 1; i < perfStats.size(); i++) {
+            indices.push_back(indices.back() +
+                    (useHistograms ? 0 : latencyLog.count(i - 1)));
         }
-
-        // Convert latencies to ns
-        for (size_t i = 0; i < arrayIndex; i++)
-            latencies[i] = Cycles::toNanoseconds(latencies[i]);
+        if (useHistograms)
+            indices.back() = histogram->count();
+        else if (latencyLog.numSaturated() > 0)
+            fprintf(stderr, "%lu latencies did not fit in 32 bits of cycles\n",
+                    latencyLog.numSaturated());
+        if (!useHistograms && latencyLog.numDropped() > 0)
+            fprintf(stderr, "%lu latencies were dropped waiting for log space\n",
+                    latencyLog.numDropped());
 
         // Output CORE_INCREASE_THRESHOLD,overall core utilization,median,latency,99% latency,throughput
         PerfStats& last = perfStats[indices.size()-1];
@@ -265,14 +335,29 @@ int main(int argc, const char** argv) {
         uint64_t numIncrements = last.numCoreIncrements - first.numCoreIncrements;
         uint64_t numDecrements = last.numCoreDecrements - first.numCoreDecrements;
 
-        Statistics mathStats = computeStatistics(latencies, indices[indices.size()-1]);
+        Statistics mathStats;
+        if (useHistograms) {
+            mathStats.median = Cycles::toNanoseconds(histogram->percentile(0.5));
+            mathStats.P99 = Cycles::toNanoseconds(histogram->percentile(0.99));
+            histogram->reset();
+        } else {
+            // Merge the shards and convert latencies to ns
+            std::vector<uint64_t> latencies(indices[indices.size()-1]);
+            for (size_t i = 1; i < indices.size(); i++)
+                latencyLog.copyInterval(i - 1, latencies.data() + indices[i-1]);
+            for (size_t i = 0; i < latencies.size(); i++)
+                latencies[i] = Cycles::toNanoseconds(latencies[i]);
+            mathStats = computeStatistics(latencies.data(), latencies.size());
+            latencyLog.reset();
+        }
         printf("%lf,%lf,%lu,%lu,%lu,%lf,%lu,%lu\n", threshold, utilization,
                 mathStats.median, mathStats.P99,throughput, loadFactor,
                 numIncrements, numDecrements);
 
         indices.clear();
         perfStats.clear();
-        arrayIndex = 0;
+        delete schedule;
+        schedule = NULL;
 
         Arachne::init();
     }
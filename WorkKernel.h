@@ -0,0 +1,308 @@
+#ifndef WORK_KERNEL_H
+#define WORK_KERNEL_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <random>
+#include <vector>
+#include "PerfUtils/Cycles.h"
+
+/**
+ * A WorkKernel is the body of a synthetic request that does real work with a
+ * memory footprint, instead of spinning on the cycle counter. A kernel is
+ * named on a .bench line or on the command line as
+ *
+ *     <name> [<working_set>]
+ *
+ * where <name> is one of
+ *
+ *     spin     spin on the cycle counter, touching no memory
+ *     chase    follow a random cycle of pointers, one per cache line
+ *     stream   read cache lines in order, summing them
+ *     hash     look up random keys in an open-addressing hash table
+ *     compute  a chain of dependent multiplies, touching no memory
+ *
+ * and <working_set> is a number of bytes, optionally followed by K, M or G
+ * (32M unless given). All threads running a kernel share its working set, so
+ * a working set larger than a core's private caches competes for the shared
+ * cache and memory bandwidth as more cores run it.
+ *
+ * Each kernel is calibrated when it is created, by timing it on an otherwise
+ * idle thread. A request for a given service time then does the number of
+ * operations that took that long during calibration, so that the request
+ * takes longer, rather than doing less work, when cores interfere with each
+ * other.
+ */
+class WorkKernel {
+  public:
+    enum Type { SPIN, CHASE, STREAM, HASH, COMPUTE };
+
+    /**
+     * Parse a kernel specification.
+     *
+     * \return
+     *      False if the name is unknown or the working set is malformed.
+     */
+    static bool parse(const char* spec, Type* type, size_t* workingSet) {
+        char name[16];
+        char size[32];
+        int numFields = sscanf(spec, "%15s %31s", name, size);
+        if (numFields < 1)
+            return false;
+        size_t k = 0;
+        while (k < NUM_TYPES && strcmp(name, names()[k]) != 0)
+            k++;
+        if (k == NUM_TYPES)
+            return false;
+        *type = static_cast<Type>(k);
+        *workingSet = 32 << 20;
+        if (numFields < 2)
+            return true;
+
+        char* unit;
+        double bytes = strtod(size, &unit);
+        if (strcmp(unit, "K") == 0)
+            bytes *= 1 << 10;
+        else if (strcmp(unit, "M") == 0)
+            bytes *= 1 << 20;
+        else if (strcmp(unit, "G") == 0)
+            bytes *= 1 << 30;
+        else if (*unit != '\0')
+            return false;
+        *workingSet = static_cast<size_t>(bytes);
+        return *workingSet >= 2 * LINE_BYTES;
+    }
+
+    /**
+     * Allocate and fill in the working set of a kernel, and calibrate it.
+     */
+    WorkKernel(Type type, size_t workingSet)
+        : type(type),
+          workingSet(workingSet),
+          memory(NULL),
+          numWords(0),
+          keyMask(0),
+          opsPerCycle(1) {
+        if (type == CHASE || type == STREAM || type == HASH)
+            allocate();
+        if (type != SPIN)
+            calibrate();
+    }
+
+    ~WorkKernel() { free(memory); }
+
+    Type getType() const { return type; }
+    const char* getName() const { return names()[type]; }
+
+    /**
+     * Return the working set that was asked for. The kernel uses a power of
+     * two number of cache lines no larger than it.
+     */
+    size_t getWorkingSet() const { return workingSet; }
+
+    /**
+     * Return the number of operations the kernel completed per cycle during
+     * calibration. The operations of spin are cycles.
+     */
+    double getOpsPerCycle() const { return opsPerCycle; }
+
+    /**
+     * Do as many operations as took the given number of cycles during
+     * calibration.
+     *
+     * \param cycles
+     *      The service time of the request.
+     * \param start
+     *      Any value that differs between requests, so that concurrent
+     *      requests start at different places in the working set.
+     */
+    void run(uint64_t cycles, uint64_t start) {
+        if (type == SPIN) {
+            uint64_t stop = PerfUtils::Cycles::rdtsc() + cycles;
+            while (PerfUtils::Cycles::rdtsc() < stop)
+                ;
+            return;
+        }
+        uint64_t ops = std::max<uint64_t>(
+            static_cast<uint64_t>(static_cast<double>(cycles) * opsPerCycle),
+            1);
+        runOps(ops, start);
+    }
+
+  private:
+    static const size_t NUM_TYPES = 5;
+    static const size_t LINE_BYTES = 64;
+    static const size_t LINE_WORDS = LINE_BYTES / sizeof(uint64_t);
+
+    /**
+     * Allocate the working set, rounded down to a power of two number of
+     * cache lines, and lay out the kernel's data structure in it.
+     */
+    void allocate() {
+        size_t numLines = 1;
+        while (2 * numLines * LINE_BYTES <= workingSet)
+            numLines *= 2;
+        numWords = numLines * LINE_WORDS;
+        void* buffer;
+        if (posix_memalign(&buffer, LINE_BYTES, numWords * sizeof(uint64_t)) !=
+            0) {
+            fprintf(stderr, "Failed to allocate %zu byte working set\n",
+                    numWords * sizeof(uint64_t));
+            exit(1);
+        }
+        memory = static_cast<uint64_t*>(buffer);
+        std::mt19937_64 gen(0);
+        switch (type) {
+            case CHASE: {
+                // Sattolo's algorithm gives a single cycle through every
+                // line, in an order the prefetchers cannot follow.
+                std::vector<uint64_t> order(numLines);
+                for (size_t i = 0; i < numLines; i++)
+                    order[i] = i;
+                for (size_t i = numLines - 1; i > 0; i--) {
+                    std::uniform_int_distribution<size_t> pick(0, i - 1);
+                    std::swap(order[i], order[pick(gen)]);
+                }
+                for (size_t i = 0; i < numLines; i++)
+                    memory[order[i] * LINE_WORDS] =
+                        order[(i + 1) % numLines] * LINE_WORDS;
+                break;
+            }
+            case STREAM:
+                for (size_t i = 0; i < numWords; i++)
+                    memory[i] = gen();
+                break;
+            case HASH:
+                // Half of the slots hold keys, and every lookup is for one
+                // of them. Zero marks an empty slot.
+                memset(memory, 0, numWords * sizeof(uint64_t));
+                keyMask = numWords / 2 - 1;
+                for (uint64_t k = 0; k <= keyMask; k++) {
+                    uint64_t key = hashKey(k);
+                    size_t slot = key & (numWords - 1);
+                    while (memory[slot] != 0)
+                        slot = (slot + 1) & (numWords - 1);
+                    memory[slot] = key;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+
+    /**
+     * Time the kernel over batches of doubling size until one takes at least
+     * 10 ms, after a pass over the working set to warm the caches.
+     */
+    void calibrate() {
+        runOps(std::max<size_t>(numWords / LINE_WORDS, 1), 0);
+        uint64_t minimumCycles = PerfUtils::Cycles::fromNanoseconds(10000000);
+        for (uint64_t ops = 1024;; ops *= 2) {
+            uint64_t startTime = PerfUtils::Cycles::rdtsc();
+            runOps(ops, startTime);
+            uint64_t elapsed = PerfUtils::Cycles::rdtsc() - startTime;
+            if (elapsed >= minimumCycles) {
+                opsPerCycle = static_cast<double>(ops) /
+                              static_cast<double>(elapsed);
+                break;
+            }
+        }
+        fprintf(stderr, "Calibrated %s kernel", getName());
+        if (memory)
+            fprintf(stderr, " over %zu bytes", numWords * sizeof(uint64_t));
+        fprintf(stderr, " at %.1f Mops/s\n",
+                opsPerCycle * PerfUtils::Cycles::perSecond() / 1e6);
+    }
+
+    /**
+     * Do the given number of operations of the kernel: one dependent load
+     * for chase, one cache line for stream, one lookup for hash, and eight
+     * dependent multiply-adds for compute.
+     */
+    void runOps(uint64_t ops, uint64_t start) {
+        uint64_t result = start;
+        switch (type) {
+            case CHASE: {
+                uint64_t word = (start % (numWords / LINE_WORDS)) * LINE_WORDS;
+                for (uint64_t i = 0; i < ops; i++)
+                    word = memory[word];
+                result = word;
+                break;
+            }
+            case STREAM: {
+                size_t word = (start * LINE_WORDS) & (numWords - 1);
+                uint64_t sum = 0;
+                for (uint64_t i = 0; i < ops; i++) {
+                    const uint64_t* line = memory + word;
+                    sum += line[0] + line[1] + line[2] + line[3] + line[4] +
+                           line[5] + line[6] + line[7];
+                    word = (word + LINE_WORDS) & (numWords - 1);
+                }
+                result = sum;
+                break;
+            }
+            case HASH: {
+                uint64_t state = start;
+                uint64_t found = 0;
+                for (uint64_t i = 0; i < ops; i++) {
+                    state = state * 6364136223846793005UL +
+                            1442695040888963407UL;
+                    uint64_t key = hashKey((state >> 32) & keyMask);
+                    size_t slot = key & (numWords - 1);
+                    while (memory[slot] != key && memory[slot] != 0)
+                        slot = (slot + 1) & (numWords - 1);
+                    found += memory[slot] == key;
+                }
+                result = found;
+                break;
+            }
+            case COMPUTE:
+                for (uint64_t i = 0; i < ops; i++) {
+                    for (int j = 0; j < 8; j++)
+                        result = result * 6364136223846793005UL +
+                                 1442695040888963407UL;
+                }
+                break;
+            default:
+                break;
+        }
+        // Keep the compiler from discarding the work.
+        __asm__ __volatile__("" : : "r"(result));
+    }
+
+    static const char** names() {
+        static const char* names[NUM_TYPES] = {"spin", "chase", "stream",
+                                               "hash", "compute"};
+        return names;
+    }
+
+    /**
+     * Map the k-th key of the hash table to a nonzero key.
+     */
+    static uint64_t hashKey(uint64_t k) {
+        uint64_t x = (k + 1) * 0x9E3779B97F4A7C15UL;
+        x ^= x >> 31;
+        return x | 1;
+    }
+
+    Type type;
+    size_t workingSet;
+
+    // The memory the kernel works over, for the kernels that have any, and
+    // its length in words.
+    uint64_t* memory;
+    size_t numWords;
+
+    // One less than the number of keys in the hash table.
+    uint64_t keyMask;
+
+    double opsPerCycle;
+
+    WorkKernel(const WorkKernel&) = delete;
+    WorkKernel& operator=(const WorkKernel&) = delete;
+};
+
+#endif  // WORK_KERNEL_H